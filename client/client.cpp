@@ -1,4 +1,4 @@
-#include <array>
+#include "network/file.hpp"
 #include <atomic>
 #include <boost/asio.hpp>
 #include <boost/asio/read_until.hpp>
@@ -15,151 +15,209 @@
 
 using boost::asio::ip::tcp;
 
-std::string hex_encode(const std::string &input) {
-  std::stringstream ss;
-  ss << std::hex << std::setfill('0');
-  for (unsigned char c : input) {
-    ss << std::setw(2) << static_cast<unsigned int>(c);
-  }
-  return ss.str();
-}
-
-std::string hex_decode(const std::string &input) {
-  std::string output;
-  if (input.length() % 2 != 0) {
-    return "";
-  }
-  output.reserve(input.length() / 2);
-  for (size_t i = 0; i < input.length(); i += 2) {
-    std::string byte_str = input.substr(i, 2);
-    char byte = static_cast<char>(std::stoul(byte_str, nullptr, 16));
-    output.push_back(byte);
+// The server opens with a telnet option offer. This client never answers
+// it, which keeps the connection a raw byte stream, so just hide the bytes.
+void strip_telnet(std::string &line) {
+  std::string plain;
+  plain.reserve(line.size());
+  for (std::size_t i = 0; i < line.size(); ++i) {
+    if (static_cast<unsigned char>(line[i]) == 255 && i + 2 < line.size()) {
+      i += 2;
+      continue;
+    }
+    plain.push_back(line[i]);
   }
-  return output;
+  line = std::move(plain);
 }
 
 std::mutex cout_mutex;
 std::atomic<bool> running = true;
 std::atomic<bool> file_mode = false;
 std::atomic<bool> file_offer_pending = false;
-std::string pending_sender_endpoint;
-std::string current_file_path;
-std::string target_recipient_endpoint;
-std::ofstream receiving_file;
-std::size_t received_file_size = 0;
-std::size_t total_file_size = 0;
-std::string receiving_file_name;
-
-void send_file_data(tcp::socket &socket, const std::string &file_path,
-                    const std::string &recipient_endpoint);
 
-void read_handler(tcp::socket &socket) {
-  try {
-    boost::asio::streambuf buffer;
-    boost::system::error_code error;
+// Everything below runs on the network thread (the one running the
+// io_context); the input thread hands work over with boost::asio::post.
+struct file_offer {
+  std::string sender;
+  std::string file_name;
+  std::size_t size = 0;
+};
+file_offer pending_offer;
+std::string current_file_path;
+bool receiving = false;
 
-    while (running) {
-      size_t n = boost::asio::read_until(socket, buffer, '\n', error);
-      if (error == boost::asio::error::eof)
-        break;
-      else if (error)
-        throw boost::system::system_error(error);
+// Splits "head:tail" at the last ':'.
+bool split_last(const std::string &in, std::string &head, std::string &tail) {
+  auto colon = in.rfind(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+  head = in.substr(0, colon);
+  tail = in.substr(colon + 1);
+  return true;
+}
 
-      std::istream is(&buffer);
-      std::string line;
-      std::getline(is, line);
+void print_line(const std::string &text) {
+  std::lock_guard<std::mutex> lock(cout_mutex);
+  std::cout << "\r\033[K" << text << "\n"
+            << (file_mode ? "file > " : "message > ") << std::flush;
+}
 
-      if (line.rfind("file_offer:", 0) == 0) {
-        std::stringstream ss(line);
-        std::string command, file_name, file_size_str, sender_endpoint;
-        std::getline(ss, command, ':');
-        std::getline(ss, file_name, ':');
-        std::getline(ss, file_size_str, ':');
-        std::getline(ss, sender_endpoint, '\n');
+void answer_offer(mud::file &transfer, bool accept) {
+  if (!accept) {
+    transfer.send_line("file_decline:" + pending_offer.sender);
+    return;
+  }
+  std::size_t offset = transfer.begin_receive(
+      pending_offer.sender, pending_offer.file_name, pending_offer.size);
+  if (offset == std::string::npos) {
+    transfer.send_line("file_decline:" + pending_offer.sender);
+    return;
+  }
+  receiving = true;
+  if (offset > 0) {
+    print_line("Resuming '" + pending_offer.file_name + "' at " +
+               std::to_string(offset) + " bytes.");
+  }
+  transfer.send_line("file_accept:" + pending_offer.sender + ":" +
+                     std::to_string(offset));
+}
 
-        pending_sender_endpoint = sender_endpoint;
-        file_offer_pending = true;
+void handle_line(mud::file &transfer, const std::string &line) {
+  std::string head, tail;
+  if (line.rfind("file_offer:", 0) == 0) {
+    std::stringstream ss(line);
+    std::string command, file_name, file_size_str, sender;
+    std::getline(ss, command, ':');
+    std::getline(ss, file_name, ':');
+    std::getline(ss, file_size_str, ':');
+    std::getline(ss, sender, '\n');
+
+    pending_offer = {sender, file_name, std::stoull(file_size_str)};
+    file_offer_pending = true;
+    print_line("Incoming file transfer offer for '" + file_name + "' (" +
+               file_size_str + " bytes) from " + sender +
+               ". Accept? (yes/no)");
+  } else if (line.rfind("file_accepted:", 0) == 0 &&
+             split_last(line.substr(14), head, tail)) {
+    print_line("File transfer accepted by " + head + ". Starting transfer" +
+               (tail == "0" ? "" : " at " + tail + " bytes") + "...");
+    transfer.send_file(current_file_path, head, std::stoull(tail),
+                       [](bool sent) {
+                         file_mode = false;
+                         print_line(sent ? "\nFile sent."
+                                         : "\nFile transfer failed.");
+                       });
+  } else if (line.rfind("file_declined:", 0) == 0) {
+    print_line("File transfer declined by " + line.substr(14) + ".");
+    file_mode = false;
+  } else if (line.rfind("file_begin_transfer:", 0) == 0) {
+    print_line("File transfer starting. Receiving '" +
+               pending_offer.file_name + "'.");
+  } else if (line.rfind("file_ack:", 0) == 0 &&
+             split_last(line.substr(9), head, tail)) {
+    transfer.acknowledged(std::stoull(tail));
+  } else if (line.rfind("file_nack:", 0) == 0 &&
+             split_last(line.substr(10), head, tail)) {
+    transfer.rejected(std::stoull(tail));
+  } else if (line.rfind("file_end:", 0) == 0) {
+    std::uint32_t checksum = 0;
+    bool complete = split_last(line.substr(9), head, tail) &&
+                    mud::file::parse_checksum(tail, checksum) &&
+                    transfer.end_receive(checksum);
+    if (receiving) {
+      print_line(complete ? "\nFile transfer complete."
+                          : "\nFile transfer incomplete or corrupted; the "
+                            "partial file is kept to resume from.");
+    }
+    receiving = false;
+    file_mode = false;
+  } else if (line.rfind("file_cancelled:", 0) == 0) {
+    transfer.cancel_receive();
+    transfer.cancel_send();
+    receiving = false;
+    file_offer_pending = false;
+    file_mode = false;
+    print_line("File transfer with " + line.substr(15) +
+               " was cancelled.");
+  } else {
+    print_line(line);
+  }
+}
 
-        std::lock_guard<std::mutex> lock(cout_mutex);
-        std::cout << "\r\033[K" << "Incoming file transfer offer for '"
-                  << file_name << "' (" << file_size_str << " bytes) from "
-                  << sender_endpoint << ". Accept? (yes/no)\nfile > "
-                  << std::flush;
-      } else if (line.rfind("file_accepted:", 0) == 0) {
-        std::stringstream ss(line);
-        std::string command, recipient_endpoint;
-        std::getline(ss, command, ':');
-        std::getline(ss, recipient_endpoint, '\n');
-        std::cout << "\r\033[K" << "File transfer accepted by "
-                  << recipient_endpoint << ". Starting transfer...\nfile > "
-                  << std::flush;
-        send_file_data(socket, current_file_path, recipient_endpoint);
-      } else if (line.rfind("file_declined:", 0) == 0) {
-        std::stringstream ss(line);
-        std::string command, recipient_endpoint;
-        std::getline(ss, command, ':');
-        std::getline(ss, recipient_endpoint, '\n');
-        std::cout << "\r\033[K" << "File transfer declined by "
-                  << recipient_endpoint << ".\nfile > " << std::flush;
-        file_mode = false;
-      } else if (line.rfind("file_begin_transfer:", 0) == 0) {
-        std::stringstream ss(line);
-        std::string command, file_name, file_size_str;
-        std::getline(ss, command, ':');
-        std::getline(ss, file_name, ':');
-        std::getline(ss, file_size_str, '\n');
-        std::cout << "\r\033[K" << "File transfer starting. Receiving '"
-                  << file_name << "'.\nfile > " << std::flush;
-        receiving_file_name = file_name;
-        receiving_file.open(receiving_file_name, std::ios_base::binary);
-        if (!receiving_file.is_open()) {
-          std::cerr << "Failed to create file for writing: "
-                    << receiving_file_name << std::endl;
-          return;
-        }
-        total_file_size = std::stoull(file_size_str);
-        received_file_size = 0;
-      } else if (line.rfind("file_data:", 0) == 0) {
-        if (receiving_file.is_open()) {
-          std::string hex_data =
-              line.substr(std::string("file_data:").length());
-          // std::cout << "\r\033[K" << "Receiving data chunk of size " <<
-          // hex_data.length() / 2 << " bytes.\nfile > " << std::flush;
-          // std::cout << "\r\033[K" << "Receiving hex data " << hex_data <<
-          // "\nfile > " << std::flush;
-          if (!hex_data.empty()) {
-            std::string decoded_data = hex_decode(hex_data);
-            receiving_file.write(decoded_data.c_str(), decoded_data.length());
-            received_file_size += decoded_data.length();
-            if (total_file_size > 0) {
-              double progress =
-                  (double)received_file_size / total_file_size * 100;
-              std::lock_guard<std::mutex> lock(cout_mutex);
-              std::cout << "\rDownloading " << receiving_file_name << "... "
-                        << std::fixed << std::setprecision(2) << progress << "%"
-                        << std::flush;
-            }
+void do_read(tcp::socket &socket, mud::file &transfer,
+             boost::asio::streambuf &buffer) {
+  boost::asio::async_read_until(
+      socket, buffer, '\n',
+      [&socket, &transfer, &buffer](boost::system::error_code error,
+                                    std::size_t /*bytes_transferred*/) {
+        if (error) {
+          if (error != boost::asio::error::eof &&
+              error != boost::asio::error::operation_aborted) {
+            std::cerr << "Read error: " << error.message() << "\n";
           }
+          running = false;
+          return;
         }
-      } else if (line.rfind("file_end:", 0) == 0) {
-        if (receiving_file.is_open()) {
-          receiving_file.close();
-          std::cout << "\nFile transfer complete.\nfile > " << std::flush;
+        std::istream is(&buffer);
+        std::string line;
+        std::getline(is, line);
+        strip_telnet(line);
+
+        // file_data:<offset>:<length>:<crc32> is followed by raw bytes,
+        // not a line; mud::file reads them before we look for the next one.
+        std::string rest, offset, length, checksum_text;
+        std::uint32_t checksum = 0;
+        if (line.rfind("file_data:", 0) == 0 &&
+            split_last(line.substr(10), rest, checksum_text) &&
+            split_last(rest, offset, length) &&
+            mud::file::parse_checksum(checksum_text, checksum)) {
+          transfer.receive_chunk(
+              buffer, std::stoull(offset), std::stoull(length), checksum,
+              [&socket, &transfer, &buffer](bool written) {
+                if (!written && receiving) {
+                  print_line("\nFailed to write the incoming file.");
+                  transfer.cancel_receive();
+                  receiving = false;
+                }
+                do_read(socket, transfer, buffer);
+              });
+          return;
         }
-        file_mode = false;
-        std::cout << "\r\033[K" << "message > " << std::flush;
-      } else {
+        handle_line(transfer, line);
+        do_read(socket, transfer, buffer);
+      });
+}
+
+void read_handler(tcp::socket &socket, mud::file &transfer,
+                  boost::asio::io_context &io_context) {
+  try {
+    boost::asio::streambuf buffer;
+    transfer.set_progress_handler([](std::size_t done, std::size_t total) {
+      static int last_percent = -1;
+      int percent = total == 0 ? 100 : static_cast<int>(done * 100 / total);
+      if (percent != last_percent) {
+        last_percent = percent;
         std::lock_guard<std::mutex> lock(cout_mutex);
-        std::cout << "\r\033[K" << line << "\n"
-                  << (file_mode ? "file > " : "message > ") << std::flush;
+        std::cout << "\rTransferring... " << percent << "%" << std::flush;
       }
-    }
+    });
+    do_read(socket, transfer, buffer);
+    io_context.run();
   } catch (std::exception &e) {
     std::cerr << "Exception in read thread: " << e.what() << "\n";
   }
+  running = false;
 }
 
-void input_thread(tcp::socket &socket) {
+void input_thread(tcp::socket &socket, mud::file &transfer,
+                  boost::asio::io_context &io_context) {
+  auto send_line = [&](std::string line) {
+    boost::asio::post(io_context, [&transfer, line = std::move(line)]() mutable {
+      transfer.send_line(std::move(line));
+    });
+  };
+
   try {
     std::string line;
     while (running) {
@@ -174,15 +232,9 @@ void input_thread(tcp::socket &socket) {
       }
 
       if (file_offer_pending) {
-        if (line == "yes") {
-          boost::asio::write(
-              socket, boost::asio::buffer(
-                          "file_accept:" + pending_sender_endpoint + "\n"));
-        } else {
-          boost::asio::write(
-              socket, boost::asio::buffer(
-                          "file_decline:" + pending_sender_endpoint + "\n"));
-        }
+        boost::asio::post(io_context, [&transfer, accept = line == "yes"] {
+          answer_offer(transfer, accept);
+        });
         file_offer_pending = false;
         file_mode = false;
         continue;
@@ -199,7 +251,7 @@ void input_thread(tcp::socket &socket) {
           size_t last_space = temp.rfind(' ');
           if (last_space != std::string::npos) {
             std::string file_path = temp.substr(0, last_space);
-            std::string target_endpoint = temp.substr(last_space + 1);
+            std::string target = temp.substr(last_space + 1);
 
             std::ifstream file(file_path,
                                std::ios_base::binary | std::ios_base::ate);
@@ -207,18 +259,18 @@ void input_thread(tcp::socket &socket) {
               std::streamsize file_size = file.tellg();
               std::string file_name =
                   file_path.substr(file_path.find_last_of("/\\") + 1);
-              current_file_path = file_path;
-              target_recipient_endpoint = target_endpoint;
-              boost::asio::write(socket, boost::asio::buffer(
-                                             "file_offer:" + target_endpoint +
-                                             ":" + file_name + ":" +
-                                             std::to_string(file_size) + "\n"));
+              std::string offer = "file_offer:" + target + ":" + file_name +
+                                  ":" + std::to_string(file_size);
+              boost::asio::post(io_context, [&transfer, file_path, offer] {
+                current_file_path = file_path;
+                transfer.send_line(offer);
+              });
             } else {
               std::lock_guard<std::mutex> lock(cout_mutex);
               std::cerr << "Failed to open file: " << file_path << std::endl;
             }
           } else {
-            std::cout << "Usage: send <file_path> <target_endpoint>\n";
+            std::cout << "Usage: send <file_path> <player>\n";
           }
           continue;
         }
@@ -233,7 +285,10 @@ void input_thread(tcp::socket &socket) {
         }
 
         running = false;
-        socket.close();
+        boost::asio::post(io_context, [&socket] {
+          boost::system::error_code ignored;
+          socket.close(ignored);
+        });
         break;
       }
 
@@ -243,7 +298,7 @@ void input_thread(tcp::socket &socket) {
       }
 
       if (!file_mode) {
-        boost::asio::write(socket, boost::asio::buffer(line + "\n"));
+        send_line(line);
 
         {
           std::lock_guard<std::mutex> lock(cout_mutex);
@@ -254,7 +309,7 @@ void input_thread(tcp::socket &socket) {
         std::lock_guard<std::mutex> lock(cout_mutex);
         std::cout << "\r\033[K"
                   << "Invalid command in file mode. Use 'send <file_path> "
-                     "<target_endpoint>' or 'exit' to leave file mode.\n"
+                     "<player>' or 'exit' to leave file mode.\n"
                   << std::flush;
       }
     }
@@ -265,31 +320,6 @@ void input_thread(tcp::socket &socket) {
   }
 }
 
-void send_file_data(tcp::socket &socket, const std::string &file_path,
-                    const std::string &recipient_endpoint) {
-  std::ifstream file(file_path, std::ios_base::binary);
-  if (!file.is_open()) {
-    std::lock_guard<std::mutex> lock(cout_mutex);
-    std::cerr << "Failed to open file for sending: " << file_path << std::endl;
-    return;
-  }
-
-  std::array<char, 2048> buffer;
-  while (!file.eof()) {
-    file.read(buffer.data(), buffer.size());
-    std::streamsize bytes_read = file.gcount();
-    if (bytes_read > 0) {
-      std::string raw_data(buffer.data(), bytes_read);
-      std::string hex_data = hex_encode(raw_data);
-      boost::asio::write(socket,
-                         boost::asio::buffer("file_data:" + recipient_endpoint +
-                                             ":" + hex_data + "\n"));
-    }
-  }
-  boost::asio::write(
-      socket, boost::asio::buffer("file_end:" + recipient_endpoint + "\n"));
-}
-
 int main(int argc, char *argv[]) {
   if (argc != 3) {
     std::cerr << "Usage: client <host> <port>\n";
@@ -305,8 +335,11 @@ int main(int argc, char *argv[]) {
 
     std::cout << "Connected to " << argv[1] << ":" << argv[2] << "\n";
 
-    std::thread reader(read_handler, std::ref(socket));
-    std::thread inputter(input_thread, std::ref(socket));
+    mud::file transfer(socket);
+    std::thread reader(read_handler, std::ref(socket), std::ref(transfer),
+                       std::ref(io_context));
+    std::thread inputter(input_thread, std::ref(socket), std::ref(transfer),
+                         std::ref(io_context));
 
     reader.join();
     inputter.join();
@@ -0,0 +1,128 @@
+#include "commands/command_args.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Microbenchmark for the command line parser. Runs each sample line
+// through the old path (istringstream into a vector of strings, "say "
+// prepended to chat, the words joined back together for the message) and
+// through split_command + CommandArgs, and reports the time and the
+// global allocations per command for both.
+
+namespace {
+std::atomic<std::uint64_t> allocations{0};
+} // namespace
+
+void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return ::operator new(size); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+using bench_clock = std::chrono::steady_clock;
+
+const char *const samples[] = {
+    "/n",
+    "/m 5,5",
+    "/look",
+    "hello there",
+    "/whisper bob are you coming to the square?",
+    "/귓 bob 안녕하세요 광장에서 만나요",
+    "그냥 채팅 메시지입니다",
+    "a chat line long enough that it no longer fits in the argument buffer "
+    "of a queued command",
+};
+
+constexpr int iterations = 200000;
+
+// Keeps the optimiser from dropping the work.
+std::size_t sink = 0;
+
+void legacy(std::string_view msg) {
+  std::string input = msg[0] == '/' ? std::string(msg.substr(1))
+                                    : "say " + std::string(msg);
+  std::istringstream iss(input);
+  std::string alias;
+  iss >> alias;
+  std::vector<std::string> args;
+  std::string arg;
+  while (iss >> arg) {
+    args.push_back(arg);
+  }
+  std::string message;
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    message += args[i] + (i == args.size() - 1 ? "" : " ");
+  }
+  sink += alias.size() + message.size();
+}
+
+void current(std::string_view msg) {
+  std::string_view word = "say";
+  std::string_view rest = msg;
+  if (msg[0] == '/') {
+    auto line = mud::split_command(msg.substr(1));
+    word = line.word;
+    rest = line.rest;
+  }
+  mud::CommandArgs args(rest);
+  sink += word.size() + args.rest().size() + args.size();
+}
+
+// The sample, cut short on a UTF-8 character boundary.
+std::string label(std::string_view msg) {
+  constexpr std::size_t width = 40;
+  if (msg.size() <= width) {
+    return std::string(msg);
+  }
+  std::size_t end = width;
+  while (end > 0 && (static_cast<unsigned char>(msg[end]) & 0xC0) == 0x80) {
+    --end;
+  }
+  return std::string(msg.substr(0, end)) + "...";
+}
+
+template <typename Parser> void measure(const char *name, Parser parse) {
+  std::cout << name << '\n';
+  for (const char *sample : samples) {
+    std::string_view msg(sample);
+    parse(msg); // Warm up.
+    auto before = allocations.load(std::memory_order_relaxed);
+    auto start = bench_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      parse(msg);
+    }
+    auto elapsed = bench_clock::now() - start;
+    auto allocated = allocations.load(std::memory_order_relaxed) - before;
+    std::cout << std::fixed << std::setprecision(1) << std::setw(10)
+              << std::chrono::duration<double, std::nano>(elapsed).count() /
+                     iterations
+              << " ns" << std::setprecision(2) << std::setw(8)
+              << static_cast<double>(allocated) / iterations << " allocs  "
+              << label(msg) << '\n';
+  }
+}
+} // namespace
+
+int main() {
+  measure("istringstream + vector<string>", legacy);
+  measure("split_command + CommandArgs", current);
+  return sink == 0;
+}
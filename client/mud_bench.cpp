@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Load generator for comparing server builds (e.g. epoll vs io_uring).
+// Opens N connections, logs each one in, then has every connection send a
+// probe command at a fixed interval and measures the time until the reply
+// arrives. The probe is an unknown command, so the server-side cost is one
+// read, one line parse and one write: the path the reactor dominates.
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+namespace {
+const std::string probe = "/bench_ping\n";
+const std::string probe_reply = "Unknown command: bench_ping";
+const std::string login_reply = "Welcome to the MUD";
+
+struct settings {
+  std::size_t connections = 1000;
+  std::chrono::seconds warmup{10};
+  std::chrono::seconds duration{30};
+  std::chrono::milliseconds interval{1000};
+  std::size_t threads = 1;
+};
+
+class bot : public std::enable_shared_from_this<bot> {
+public:
+  bot(boost::asio::io_context &io_context, std::string name,
+      const settings &settings, bench_clock::time_point measure_from,
+      bench_clock::time_point deadline)
+      : socket_(boost::asio::make_strand(io_context)),
+        timer_(socket_.get_executor()), name_(std::move(name)),
+        settings_(settings), measure_from_(measure_from), deadline_(deadline) {}
+
+  void start(const tcp::resolver::results_type &endpoints) {
+    auto self(shared_from_this());
+    started_ = bench_clock::now();
+    boost::asio::async_connect(
+        socket_, endpoints,
+        [self](boost::system::error_code ec, const tcp::endpoint &) {
+          if (ec) {
+            self->failed_ = true;
+            return;
+          }
+          self->socket_.set_option(tcp::no_delay(true));
+          self->send(self->name_ + "\n");
+          self->do_read();
+        });
+  }
+
+  bool logged_in() const { return logged_in_; }
+  bool failed() const { return failed_; }
+  std::chrono::microseconds login_time() const { return login_time_; }
+  const std::vector<std::uint32_t> &latencies() const { return latencies_; }
+
+private:
+  void send(std::string data) {
+    auto self(shared_from_this());
+    auto payload = std::make_shared<std::string>(std::move(data));
+    boost::asio::async_write(socket_, boost::asio::buffer(*payload),
+                             [self, payload](boost::system::error_code ec,
+                                             std::size_t) {
+                               if (ec) {
+                                 self->close();
+                               }
+                             });
+  }
+
+  void do_read() {
+    auto self(shared_from_this());
+    socket_.async_read_some(
+        boost::asio::buffer(buffer_),
+        [self](boost::system::error_code ec, std::size_t length) {
+          if (ec) {
+            if (!self->logged_in_) {
+              self->failed_ = true;
+            }
+            return;
+          }
+          self->on_data(length);
+          self->do_read();
+        });
+  }
+
+  void on_data(std::size_t length) {
+    // Replies can straddle reads and arrive among broadcasts, so keep a
+    // short tail of the previous read around while scanning.
+    window_.append(buffer_.data(), length);
+    std::size_t pos = 0;
+    const std::string &expected = logged_in_ ? probe_reply : login_reply;
+    while ((pos = window_.find(expected, pos)) != std::string::npos) {
+      pos += expected.size();
+      if (!logged_in_) {
+        logged_in_ = true;
+        login_time_ = std::chrono::duration_cast<std::chrono::microseconds>(
+            bench_clock::now() - started_);
+        schedule_probe();
+        break;
+      }
+      if (waiting_) {
+        waiting_ = false;
+        if (sent_at_ >= measure_from_) {
+          latencies_.push_back(static_cast<std::uint32_t>(
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  bench_clock::now() - sent_at_)
+                  .count()));
+        }
+      }
+    }
+    std::size_t keep = std::max(login_reply.size(), probe_reply.size());
+    if (window_.size() > keep) {
+      window_.erase(0, window_.size() - keep);
+    }
+  }
+
+  void schedule_probe() {
+    auto now = bench_clock::now();
+    if (now >= deadline_) {
+      close();
+      return;
+    }
+    // Spread the first probes over one interval so they don't line up.
+    std::chrono::milliseconds delay = settings_.interval;
+    if (sent_at_ == bench_clock::time_point{}) {
+      delay = delay * static_cast<long>(std::hash<std::string>{}(name_) % 1000) /
+              1000;
+    }
+    timer_.expires_after(delay);
+    auto self(shared_from_this());
+    timer_.async_wait([self](boost::system::error_code ec) {
+      if (ec) {
+        return;
+      }
+      if (!self->waiting_) {
+        self->waiting_ = true;
+        self->sent_at_ = bench_clock::now();
+        self->send(probe);
+      }
+      self->schedule_probe();
+    });
+  }
+
+  void close() {
+    boost::system::error_code ignored;
+    timer_.cancel();
+    socket_.shutdown(tcp::socket::shutdown_both, ignored);
+    socket_.close(ignored);
+  }
+
+  tcp::socket socket_;
+  boost::asio::steady_timer timer_;
+  std::string name_;
+  const settings &settings_;
+  bench_clock::time_point measure_from_;
+  bench_clock::time_point deadline_;
+  bench_clock::time_point started_;
+  bench_clock::time_point sent_at_{};
+  std::array<char, 8192> buffer_;
+  std::string window_;
+  bool logged_in_ = false;
+  bool failed_ = false;
+  bool waiting_ = false;
+  std::chrono::microseconds login_time_{0};
+  std::vector<std::uint32_t> latencies_;
+};
+
+double percentile_ms(const std::vector<std::uint32_t> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  std::size_t index = static_cast<std::size_t>(p * (sorted.size() - 1));
+  return sorted[index] / 1000.0;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: mud_bench <host> <port> [connections] [seconds]\n"
+                 "         [interval_ms] [threads] [warmup_seconds]\n";
+    return 1;
+  }
+
+  settings config;
+  if (argc > 3) {
+    config.connections = std::strtoul(argv[3], nullptr, 10);
+  }
+  if (argc > 4) {
+    config.duration = std::chrono::seconds(std::atoi(argv[4]));
+  }
+  if (argc > 5) {
+    config.interval = std::chrono::milliseconds(std::atoi(argv[5]));
+  }
+  if (argc > 6) {
+    config.threads = std::max<std::size_t>(1, std::strtoul(argv[6], nullptr, 10));
+  }
+  if (argc > 7) {
+    config.warmup = std::chrono::seconds(std::atoi(argv[7]));
+  }
+
+  try {
+    boost::asio::io_context io_context;
+    tcp::resolver resolver(io_context);
+    auto endpoints = resolver.resolve(argv[1], argv[2]);
+
+    auto start = bench_clock::now();
+    auto measure_from = start + config.warmup;
+    auto deadline = measure_from + config.duration;
+    // Names must be unique across runs against the same server.
+    std::string prefix =
+        "b" + std::to_string(start.time_since_epoch().count() % 100000) + "_";
+
+    std::vector<std::shared_ptr<bot>> bots;
+    bots.reserve(config.connections);
+    for (std::size_t i = 0; i < config.connections; ++i) {
+      bots.push_back(std::make_shared<bot>(io_context,
+                                           prefix + std::to_string(i), config,
+                                           measure_from, deadline));
+      bots.back()->start(endpoints);
+    }
+
+    // Connections that never finished logging in would keep run() going.
+    boost::asio::steady_timer stop_timer(io_context, deadline + std::chrono::seconds(5));
+    stop_timer.async_wait([&io_context](boost::system::error_code ec) {
+      if (!ec) {
+        io_context.stop();
+      }
+    });
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < config.threads; ++i) {
+      workers.emplace_back([&io_context] { io_context.run(); });
+    }
+    io_context.run();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+
+    std::size_t logged_in = 0;
+    std::size_t failed = 0;
+    std::vector<std::uint32_t> logins;
+    std::vector<std::uint32_t> latencies;
+    for (const auto &b : bots) {
+      if (b->logged_in()) {
+        ++logged_in;
+        logins.push_back(static_cast<std::uint32_t>(b->login_time().count()));
+      }
+      if (b->failed()) {
+        ++failed;
+      }
+      latencies.insert(latencies.end(), b->latencies().begin(),
+                       b->latencies().end());
+    }
+    std::sort(logins.begin(), logins.end());
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "connections: " << config.connections
+              << " (logged in " << logged_in << ", failed " << failed << ")\n"
+              << "login ms: p50 " << percentile_ms(logins, 0.50) << ", p99 "
+              << percentile_ms(logins, 0.99) << ", max "
+              << percentile_ms(logins, 1.0) << "\n"
+              << "round trips: " << latencies.size() << " ("
+              << latencies.size() / static_cast<double>(config.duration.count())
+              << "/s)\n"
+              << "latency ms: p50 " << percentile_ms(latencies, 0.50)
+              << ", p90 " << percentile_ms(latencies, 0.90) << ", p99 "
+              << percentile_ms(latencies, 0.99) << ", max "
+              << percentile_ms(latencies, 1.0) << std::endl;
+  } catch (std::exception &e) {
+    std::cerr << "Exception: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mud {
+
+struct Command;
+
+struct AliasMatch {
+  enum class kind {
+    none,      // No alias starts with the text.
+    exact,     // The text is an alias.
+    prefix,    // The text starts aliases of exactly one command.
+    ambiguous, // The text starts aliases of several commands.
+  };
+  kind result = kind::none;
+  // Set for exact and prefix.
+  const Command *command = nullptr;
+};
+
+// Byte trie over every alias, for abbreviations: "sh" finds SHOUT, "귓속"
+// WHISPER. An exact alias always wins, so "s" stays SOUTH even though
+// "shout" and "stats" start with it too. Each node knows whether all the
+// aliases below it belong to one command, so a lookup is one walk down the
+// text with no backtracking.
+//
+// Aliases are UTF-8. A Hangul syllable is three bytes, and text that stops
+// inside one (a client cut the line short) matches nothing rather than
+// every alias that shares the first byte.
+//
+// Nodes and edges live in two flat arrays, each node's edges contiguous
+// and sorted by byte. Built once, then only read.
+class AliasTrie {
+public:
+  AliasTrie() = default;
+  // Aliases must be unique.
+  explicit AliasTrie(
+      std::vector<std::pair<std::string, const Command *>> aliases);
+
+  AliasMatch match(std::string_view text) const;
+  // Every alias that starts with text, in byte order. For telling the
+  // player what an ambiguous abbreviation could mean.
+  std::vector<std::string> completions(std::string_view text) const;
+
+private:
+  struct node {
+    std::uint32_t first_edge = 0;
+    std::uint32_t edge_count = 0;
+    // The command whose alias ends here.
+    const Command *exact = nullptr;
+    // The command every alias below here belongs to, or null if there are
+    // several.
+    const Command *only = nullptr;
+  };
+  struct edge {
+    unsigned char byte = 0;
+    std::uint32_t child = 0;
+  };
+
+  using alias_list = std::vector<std::pair<std::string, const Command *>>;
+
+  void build(std::uint32_t index, const alias_list &aliases, std::size_t begin,
+             std::size_t end, std::size_t depth);
+  // The node text leads to, or -1.
+  std::int64_t walk(std::string_view text) const;
+  void collect(std::uint32_t index, std::string &prefix,
+               std::vector<std::string> &out) const;
+
+  std::vector<node> nodes_;
+  std::vector<edge> edges_;
+};
+
+} // namespace mud
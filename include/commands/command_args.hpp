@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mud {
+
+// A command line split into its command word and everything after it,
+// without copying. Splitting is on ASCII whitespace only: every byte of a
+// multi-byte UTF-8 character is >= 0x80, so Korean aliases and chat are
+// never cut in the middle of a character.
+struct CommandLine {
+  std::string_view word;
+  // The rest of the line as typed, minus surrounding whitespace.
+  std::string_view rest;
+};
+
+CommandLine split_command(std::string_view line);
+
+// A command's arguments, kept as spans of one buffer so they can wait in
+// the tick's queue. Lines up to inline_bytes long are stored in place, so
+// parsing and queueing a typical command allocates nothing.
+class CommandArgs {
+public:
+  static constexpr std::size_t inline_bytes = 80;
+  // Words past max_args are only reachable through rest().
+  static constexpr std::size_t max_args = 8;
+
+  CommandArgs() = default;
+  // Splits text, normally CommandLine::rest, on whitespace.
+  explicit CommandArgs(std::string_view text);
+  // Arguments that arrived already split (binary_protocol). rest() joins
+  // them with single spaces.
+  explicit CommandArgs(const std::vector<std::string> &args);
+
+  CommandArgs(CommandArgs &&) = default;
+  CommandArgs &operator=(CommandArgs &&) = default;
+
+  std::size_t size() const;
+  bool empty() const;
+  std::string_view operator[](std::size_t i) const;
+  // The text from argument first to the end, with the whitespace between
+  // arguments as typed: what chat commands send. Empty past the last
+  // argument.
+  std::string_view rest(std::size_t first = 0) const;
+
+private:
+  struct span {
+    std::uint32_t offset = 0;
+    std::uint32_t length = 0;
+  };
+
+  char *allocate(std::size_t length);
+  const char *data() const;
+
+  std::array<char, inline_bytes> inline_{};
+  // Only for text longer than inline_bytes.
+  std::unique_ptr<char[]> heap_;
+  std::uint32_t length_ = 0;
+  std::uint32_t count_ = 0;
+  std::array<span, max_args> spans_{};
+};
+
+} // namespace mud
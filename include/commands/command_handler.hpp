@@ -1,36 +1,38 @@
 #pragma once
 
-#include <functional>
-#include <map>
-#include <string>
-#include <vector>
+#include "commands/command_table.hpp"
+#include <string_view>
 
 namespace mud {
 
 class session; // Forward declaration
 
+// The command implementations. They are plain functions of the session
+// they run for, so CommandManager's one table serves every connection.
 class CommandHandler {
 public:
-  CommandHandler(session &s);
-  void handle(const std::string &command,
-              const std::vector<std::string> &args);
+  // Handler for a canonical command name, or nullptr. Used once, to build
+  // the table.
+  static CommandFunction find(std::string_view name);
 
 private:
-  void setup_commands();
-  void look(const std::vector<std::string> &args);
-  void move(int dx, int dy);
-  void move_to(const std::vector<std::string> &args);
-  void say(const std::vector<std::string> &args);
-  void shout(const std::vector<std::string> &args);
-  void whisper(const std::vector<std::string> &args);
-  void quit(const std::vector<std::string> &args);
-  void clear(const std::vector<std::string> &args);
-  void interact(const std::vector<std::string> &args);
-
-  session &session_;
-  std::map<std::string,
-           std::function<void(const std::vector<std::string> &)>>
-      commands_;
+  static void look(session &s, const CommandArgs &args);
+  static void north(session &s, const CommandArgs &args);
+  static void south(session &s, const CommandArgs &args);
+  static void east(session &s, const CommandArgs &args);
+  static void west(session &s, const CommandArgs &args);
+  static void move(session &s, int dx, int dy);
+  static void move_to(session &s, const CommandArgs &args);
+  static void say(session &s, const CommandArgs &args);
+  static void shout(session &s, const CommandArgs &args);
+  static void whisper(session &s, const CommandArgs &args);
+  static void quit(session &s, const CommandArgs &args);
+  static void clear(session &s, const CommandArgs &args);
+  static void interact(session &s, const CommandArgs &args);
+  static void who(session &s, const CommandArgs &args);
+  static void stats(session &s, const CommandArgs &args);
+  // The per-connection part of stats, on the session's strand.
+  static void connection_stats(session &s);
 };
 
 } // namespace mud
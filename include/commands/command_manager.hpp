@@ -1,21 +1,50 @@
 #pragma once
 
-#include <map>
+#include "commands/command_queue.hpp"
+#include "commands/command_table.hpp"
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace mud {
 
+// commands.json, read-only once loaded, so every session and the tick share
+// it without locking. A reload builds a new CommandManager and the server
+// swaps it in whole (see server::reload_commands).
 class CommandManager {
 public:
-  CommandManager(const std::string &command_file_path);
+  // Throws std::runtime_error (or a json error) if the file is malformed,
+  // an alias or id is used twice, or a command names an unknown class.
+  // Classes that previous also had keep their index, so sessions' token
+  // buckets still match after a reload.
+  CommandManager(const std::string &command_file_path,
+                 const CommandManager *previous = nullptr);
+  // Commands point at classes_.
+  CommandManager(const CommandManager &) = delete;
+  CommandManager &operator=(const CommandManager &) = delete;
 
-  std::string get_canonical_command(const std::string &alias) const;
+  // Null if alias is unknown.
+  const Command *find_command(std::string_view alias) const;
+  // What a player typed: an alias or a unique abbreviation of one.
+  AliasMatch match_command(std::string_view text) const;
+  // The aliases an ambiguous abbreviation could mean.
+  std::vector<std::string> complete_command(std::string_view text) const;
+  // Null if no command has this binary protocol id.
+  const Command *find_command(std::uint16_t id) const;
+  const std::vector<CommandClass> &get_command_classes() const;
+  // Commands a session may have waiting for the tick before more are
+  // rejected.
+  std::size_t get_max_queued() const;
 
 private:
-  void load_commands(const std::string &command_file_path);
+  void load_commands(const std::string &command_file_path,
+                     const CommandManager *previous);
 
-  std::map<std::string, std::string> alias_to_command_;
+  CommandTable table_;
+  std::vector<CommandClass> classes_;
+  std::size_t max_queued_ = 32;
 };
 
 } // namespace mud
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "commands/command_table.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mud {
+
+struct QueuedCommand {
+  // Shares ownership of the CommandManager it was found in, so a reload
+  // can replace the table while the command waits.
+  std::shared_ptr<const Command> command;
+  CommandArgs args;
+};
+
+// One session's commands waiting for the tick, and its token buckets.
+// reserve() runs on the session's strand before the command goes into the
+// tick's inbox; everything else belongs to the tick thread (or to the
+// strand, for take_token() on servers without a tick).
+class CommandQueue {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // Counts one more command on its way to the queue. False once
+  // max_queued are waiting; release() undoes it if the command went
+  // nowhere. The limit is passed in each time, so a reloaded one applies
+  // to sessions that are already connected.
+  bool reserve(std::size_t max_queued);
+  void release();
+
+  void push(QueuedCommand &&command);
+
+  enum class pop_result {
+    ready,
+    // The oldest command's bucket is empty. It stays first, so later
+    // commands don't overtake it.
+    throttled,
+    empty,
+  };
+  pop_result pop(clock::time_point now, QueuedCommand &out);
+  // Takes the oldest command whatever its bucket holds. False if there is
+  // none.
+  bool pop_now(QueuedCommand &out);
+
+  // Spends a token of command's class now, if there is one. Buckets start
+  // full the first time a class is used, and take the class's current
+  // limits from the command, so reloaded limits apply at once.
+  bool take_token(const Command &command, clock::time_point now);
+  // Drops every queued command.
+  void clear();
+
+  // Whether the tick is serving this queue; tick thread only.
+  bool active = false;
+
+private:
+  struct bucket {
+    double tokens = 0;
+    // Epoch until the class is first used.
+    clock::time_point refilled;
+  };
+
+  std::vector<bucket> buckets_;
+  std::deque<QueuedCommand> queue_;
+  // Reserved: queued here or still in the tick's inbox.
+  std::atomic<std::size_t> pending_{0};
+};
+
+} // namespace mud
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "commands/alias_trie.hpp"
+#include "commands/command_args.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mud {
+
+class session; // Forward declaration
+
+// A command handler. Handlers keep no state of their own: everything
+// per-connection comes from the session they run for.
+using CommandFunction = void (*)(session &s, const CommandArgs &args);
+
+// A rate limit from the "classes" in commands.json: a token bucket refilled
+// at rate commands per second and holding at most burst of them.
+struct CommandClass {
+  std::string name;
+  double rate = 0;
+  double burst = 0;
+};
+
+struct Command {
+  std::string name;
+  // Binary protocol id, or 0 if the command has none.
+  std::uint16_t id = 0;
+  // Index into CommandManager::get_command_classes(), or -1 for commands
+  // without a limit. Sessions keep a token bucket per index.
+  int command_class = -1;
+  // That class, owned by the same CommandManager.
+  const CommandClass *limit = nullptr;
+  // Null for commands listed in commands.json that nothing implements.
+  CommandFunction handler = nullptr;
+  // False for commands that must be typed out in full ("abbreviate":
+  // false in commands.json), such as QUIT.
+  bool abbreviate = true;
+};
+
+// Immutable alias -> command lookup, shared by every session. Aliases go
+// through a minimal perfect hash (hash and displace): one hash picks a
+// bucket, a second hash seeded with that bucket's displacement picks the
+// only slot the alias can be in, and a single string compare confirms it.
+// What players type is looked up there first; only a miss goes on to an
+// AliasTrie over the aliases that may be abbreviated.
+class CommandTable {
+public:
+  CommandTable() = default;
+  // aliases pairs each alias with an index into commands. Aliases must be
+  // unique.
+  CommandTable(std::vector<Command> commands,
+               const std::vector<std::pair<std::string, std::size_t>> &aliases);
+  // Slots point into commands_, which a move keeps in place.
+  CommandTable(CommandTable &&) = default;
+  CommandTable &operator=(CommandTable &&) = default;
+  CommandTable(const CommandTable &) = delete;
+  CommandTable &operator=(const CommandTable &) = delete;
+
+  // Null if alias is unknown.
+  const Command *find(std::string_view alias) const;
+  const Command *find(std::uint16_t id) const;
+  // An alias, or a unique abbreviation of an alias whose command allows
+  // it.
+  AliasMatch match(std::string_view text) const;
+  std::vector<std::string> completions(std::string_view text) const;
+
+private:
+  struct slot {
+    std::string alias;
+    const Command *command = nullptr;
+  };
+
+  std::vector<Command> commands_;
+  std::vector<std::uint32_t> displacements_;
+  std::vector<slot> slots_;
+  // By binary id; ids are small and dense.
+  std::vector<const Command *> by_id_;
+  AliasTrie trie_;
+};
+
+} // namespace mud
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "utils/color.hpp"
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mud::binary {
+
+// Length-prefixed framing for bots and tools, spoken on the binary
+// listener (server_options::binary_port) instead of telnet text. Every
+// frame is
+//
+//   u32 length | u16 type | body            (big-endian, length excludes itself)
+//
+// Client to server:
+//   login    string name
+//   command  u16 command id | u8 argc | argc x value
+//
+// where a value is u8 tag followed by
+//   string   u16 length | UTF-8 bytes
+//   integer  i32
+//
+// Command ids are the "id" fields in commands.json and run the same
+// CommandHandler commands as the text aliases; integers reach them in
+// decimal.
+//
+// Server to client:
+//   event    u8 utils::color::category | text (rest of the frame)
+//   data     string package | JSON (rest of the frame)
+//
+// Events are the text output without its tag or escape codes; data
+// frames carry the GMCP packages (Room.Info, Char.Position, ...).
+enum class frame_type : std::uint16_t {
+  login = 1,
+  command = 2,
+  event = 0x81,
+  data = 0x82,
+};
+
+enum class value_type : std::uint8_t {
+  string = 1,
+  integer = 2,
+};
+
+constexpr std::size_t header_size = 4;
+constexpr std::size_t max_frame = 4096;
+
+struct request {
+  frame_type type = frame_type::login;
+  std::uint16_t command_id = 0;
+  // The login name, or the command's arguments.
+  std::vector<std::string> args;
+};
+
+// Fixed-capacity receive buffer that splits input into requests, the
+// binary counterpart of line_framer.
+class framer {
+public:
+  framer();
+
+  // Moves any partial frame to the front and returns the free tail.
+  boost::asio::mutable_buffer prepare();
+  void commit(std::size_t bytes);
+
+  enum class result { complete, incomplete, malformed };
+  // Decodes the next buffered frame into out. A malformed frame leaves
+  // the stream out of sync, so the connection should be dropped.
+  result next(request &out);
+  // Everything buffered after the last complete frame.
+  std::string_view pending() const;
+
+private:
+  std::vector<char> buffer_;
+  std::size_t begin_ = 0;
+  std::size_t end_ = 0;
+};
+
+// Builds an event frame from a message made by the utils::color helpers.
+std::string event(std::string_view message);
+std::string event(utils::color::category kind, std::string_view text);
+// Whether frame is a whole event frame.
+bool is_event(std::string_view frame);
+// An event frame with text added to the end of its text.
+std::string append_to_event(std::string_view frame, std::string_view text);
+std::string data(std::string_view package, std::string_view json);
+
+} // namespace mud::binary
@@ -1,10 +1,37 @@
 #pragma once
 #include <string>
 #include <memory>
+#include <utility>
+
+// One line of output, already framed with its trailing newline. It is never
+// modified after construction, so fan-out paths build it once and every
+// recipient's write queue holds a reference to the same buffer.
+using shared_message = std::shared_ptr<const std::string>;
+
+inline shared_message make_message(const std::string &msg) {
+    return std::make_shared<const std::string>(msg + "\n");
+}
+
+// Protocol bytes (telnet negotiation) that must go out exactly as given.
+inline shared_message make_raw_message(std::string bytes) {
+    return std::make_shared<const std::string>(std::move(bytes));
+}
+
+// Output addressed to one player goes in the priority lane; fan-out chat
+// goes in the bulk lane, which a slow client may lose first.
+enum class message_lane { priority = 0, bulk = 1 };
+
+// What a listener speaks: telnet-style text lines, or the length-prefixed
+// frames of binary_protocol.hpp.
+enum class wire_protocol { text, binary };
 
 class chat_participant {
 public:
     virtual ~chat_participant() = default;
-    virtual void deliver(const std::string &msg) = 0;
+    virtual void deliver(shared_message msg, message_lane lane) = 0;
+    void deliver(shared_message msg) {
+        deliver(std::move(msg), message_lane::priority);
+    }
+    void deliver(const std::string &msg) { deliver(make_message(msg)); }
 };
 using chat_participant_ptr = std::shared_ptr<chat_participant>;
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+#if defined(__linux__)
+// Watching files needs inotify. Elsewhere the data is only read at startup.
+#define MUD_HAS_DATA_WATCHER 1
+#endif
+
+namespace mud {
+
+// Watches the data directory and its subdirectories (one level, e.g.
+// maps/) for files being written, created, renamed or deleted. Changes are
+// reported once the directory has been quiet for settle_time, so an
+// editor's write-rename-chmod sequence becomes a single report.
+class data_watcher {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct change {
+    // Relative to the data directory, e.g. "commands.json" or
+    // "maps/town_square.json".
+    std::set<std::string> files;
+    // When the first of them changed.
+    clock::time_point since;
+  };
+
+  static constexpr std::chrono::milliseconds settle_time{200};
+
+  // handler runs on a strand of io_context.
+  data_watcher(boost::asio::io_context &io_context,
+               const std::string &data_path,
+               std::function<void(change)> handler);
+  ~data_watcher();
+  data_watcher(const data_watcher &) = delete;
+  data_watcher &operator=(const data_watcher &) = delete;
+
+  // False if the platform or the directory can't be watched.
+  bool active() const;
+
+private:
+  void watch(const std::string &relative);
+  void read_events();
+  void settle();
+
+  boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+  boost::asio::steady_timer timer_;
+  std::function<void(change)> handler_;
+  std::string data_path_;
+  change pending_;
+#if defined(MUD_HAS_DATA_WATCHER)
+  boost::asio::posix::stream_descriptor descriptor_;
+  // Watch descriptor -> directory relative to data_path_, "" for itself.
+  std::map<int, std::string> directories_;
+  alignas(8) std::array<char, 4096> buffer_;
+#endif
+};
+
+} // namespace mud
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "network/chat_participant.hpp"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mud {
+class shard;
+namespace world {
+class Room;
+}
+
+// Where a published message goes. Topics nest: a logged-in player is
+// subscribed to global, to its room's zone and room, to its own player
+// topic, and to any channels it joined.
+struct topic {
+  enum class kind { global, zone, room, channel, player };
+
+  kind type = kind::global;
+  std::string name;
+
+  static topic global();
+  static topic zone(std::string name);
+  static topic room(std::string id);
+  static topic channel(std::string name);
+  static topic player(std::string name);
+
+  // "global", "zone:<name>", "room:<id>", ... Unique per topic.
+  std::string key() const;
+};
+
+// Publish/subscribe fan-out for chat and world events. Subscriber sets are
+// kept up to date as players log in, move and leave, so publishing costs
+// the topic's subscribers, not the whole server.
+//
+// Each topic's set lives on the shard its key hashes to, except global,
+// which is split by the subscriber's own shard; a global publish posts
+// once to every shard. Every method posts its work to the owning shard(s),
+// so it is safe to call from any strand. Calls for one participant must
+// be ordered.
+class event_bus {
+public:
+  using count_handler = std::function<void(std::size_t)>;
+
+  struct event {
+    topic target;
+    shared_message msg;
+    // Skipped when it is a subscriber.
+    chat_participant_ptr sender = nullptr;
+    message_lane lane = message_lane::bulk;
+    // Called on the owning shard's strand with the number of recipients.
+    // For global topics, once per shard.
+    count_handler delivered = nullptr;
+  };
+
+  // Events collected to be published together: one post per owning shard
+  // instead of one per event.
+  class batch {
+  public:
+    void publish(event e);
+    bool empty() const;
+
+  private:
+    friend class event_bus;
+    std::vector<event> events_;
+  };
+
+  explicit event_bus(std::vector<std::unique_ptr<shard>> &shards);
+
+  void subscribe(const topic &t, chat_participant_ptr participant);
+  // done, if given, is called on the owning shard's strand with whether
+  // participant was subscribed.
+  void unsubscribe(const topic &t, chat_participant_ptr participant,
+                   std::function<void(bool)> done = nullptr);
+  // Moves participant's room subscription, and its zone subscription if
+  // the zone changes. Either room may be null. A reloaded definition of
+  // the same room keeps the room subscription.
+  void move(chat_participant_ptr participant,
+            const std::shared_ptr<world::Room> &from,
+            const std::shared_ptr<world::Room> &to);
+
+  // On the tick thread, events are held until flush() so a tick's output
+  // leaves in one batch; anywhere else they are published right away.
+  void publish(event e);
+  void publish(const topic &t, shared_message msg,
+               chat_participant_ptr sender = nullptr);
+  void publish(batch events);
+  // Publishes what the tick held back. Tick thread only.
+  void flush();
+
+  // Player names subscribed to t. Not for global.
+  void get_subscriber_names(
+      const topic &t, std::function<void(std::vector<std::string>)> handler);
+
+private:
+  shard &owner_of(const topic &t);
+  shard &shard_of(const chat_participant_ptr &participant);
+
+  std::vector<std::unique_ptr<shard>> &shards_;
+  // Tick thread only.
+  batch held_;
+};
+} // namespace mud
@@ -1,28 +1,119 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <cstdint>
+#include <deque>
 #include <string>
 #include <fstream>
-#include <array>
 #include <functional>
+#include <memory>
+#include <vector>
 
 namespace mud
 {
+    // Client side of a relayed file transfer (see file_relay). Owns the
+    // write side of the connection, so chat lines queued with send_line()
+    // are interleaved with chunks instead of landing inside one.
+    //
+    // A file goes out as file_data:<target>:<offset>:<length>:<crc32>
+    // headers, each followed by that many raw bytes. Up to window_chunks
+    // chunks are unacknowledged at a time; the receiver acks the offset up
+    // to which it has verified and written the file and nacks a chunk whose
+    // checksum doesn't match, after which the sender goes back to that
+    // offset. file_end:<target>:<crc32> closes the transfer with a checksum
+    // of the whole file.
+    //
+    // The receiver writes into <name>.part and only renames it once the
+    // whole-file checksum matches. The .part file holds exactly the
+    // acknowledged bytes, so after a dropped connection the next offer of
+    // the same file resumes from its size.
+    //
+    // File reads and writes are async random_access_file operations when
+    // Boost.Asio has them (the MUD_IO_URING build), otherwise iostreams.
+    // Not thread-safe: used from the thread running the socket's io_context.
     class file {
     public:
+        static constexpr std::size_t max_chunk = 32 * 1024;
+        static constexpr std::size_t window_chunks = 8;
+
+        using progress_handler = std::function<void(std::size_t transferred, std::size_t total)>;
+
         file(boost::asio::ip::tcp::socket& socket);
         ~file();
 
-        void send_file(const std::string& file_path, std::function<void(bool)> callback);
-        void receive_file(const std::string& file_name, std::size_t file_size, std::function<void(bool)> callback);
+        // Called as acknowledgements (sending) or verified chunks
+        // (receiving) move the transfer forward.
+        void set_progress_handler(progress_handler handler);
+
+        // Queues a line (without its newline) behind the chunk being written.
+        void send_line(std::string line);
+
+        // Starts sending file_path to target from offset, the point the
+        // receiver asked to resume from. callback runs once file_end is sent.
+        void send_file(const std::string& file_path, const std::string& target, std::size_t offset, std::function<void(bool)> callback);
+        void acknowledged(std::size_t offset);
+        void rejected(std::size_t offset);
+        void cancel_send();
+
+        // Opens <file_name>.part for a transfer from sender and returns the
+        // offset to resume from, or npos if the file can't be written.
+        std::size_t begin_receive(const std::string& sender, const std::string& file_name, std::size_t file_size);
+        // Reads the payload of one file_data chunk (part of it may already
+        // be in buffered), verifies it and writes it at its offset, then
+        // acks or nacks it. callback(false) means the file couldn't be written.
+        void receive_chunk(boost::asio::streambuf& buffered, std::size_t offset, std::size_t size, std::uint32_t checksum, std::function<void(bool)> callback);
+        // Checks the whole-file checksum and renames the .part file into
+        // place. On failure the .part file is kept for the next attempt.
+        bool end_receive(std::uint32_t checksum);
+        void cancel_receive();
+
+        static std::string format_checksum(std::uint32_t checksum);
+        static bool parse_checksum(const std::string& text, std::uint32_t& checksum);
 
     private:
-        void do_write_file_content(std::function<void(bool)> callback);
-        void do_read_file_content(std::size_t remaining_size, std::function<void(bool)> callback);
+        void do_write();
+        void write_chunk();
+        void finish_send(bool ok);
+        void store_chunk(std::size_t offset, std::uint32_t checksum, std::function<void(bool)> callback);
+        void chunk_stored();
 
         boost::asio::ip::tcp::socket& socket_;
+        progress_handler progress_;
+        std::deque<std::string> lines_;
+        bool writing_ = false;
+
+        // Sending
+#if defined(BOOST_ASIO_HAS_FILE)
+        std::unique_ptr<boost::asio::random_access_file> input_file_;
+#else
         std::ifstream input_file_;
-        std::ofstream output_file_;
-        std::array<char, 4096> buffer_;
+#endif
+        bool sending_ = false;
+        std::string target_;
+        std::function<void(bool)> send_callback_;
+        std::size_t input_size_ = 0;
+        std::size_t next_offset_ = 0;
+        std::size_t acked_offset_ = 0;
+        // Running checksum of the bytes below checksum_offset_. Chunks are
+        // first sent in order, so each byte is added exactly once even if
+        // it is sent again after a nack.
+        std::uint32_t input_checksum_ = 0;
+        std::size_t checksum_offset_ = 0;
+        std::string header_;
+        std::vector<char> input_chunk_;
+
+        // Receiving
+#if defined(BOOST_ASIO_HAS_FILE)
+        std::unique_ptr<boost::asio::random_access_file> output_file_;
+#else
+        std::fstream output_file_;
+#endif
+        bool receiving_ = false;
+        std::string sender_;
+        std::string output_name_;
+        std::size_t output_size_ = 0;
+        std::size_t received_offset_ = 0;
+        std::uint32_t output_checksum_ = 0;
+        std::vector<char> output_chunk_;
     };
 } // namespace mud
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace mud {
+class session;
+
+// One offer from a sender to a recipient. Shared by both sessions' relays;
+// each field notes the strand that owns it.
+struct file_transfer {
+  std::string sender_name;
+  std::string target_name;
+  std::string file_name;
+  std::size_t size = 0;
+  std::weak_ptr<session> sender;
+  // Set by the player registry lookup before the recipient sees the offer.
+  std::weak_ptr<session> target;
+  // Sender strand.
+  bool accepted = false;
+  // Set from file_end before the recipient is told.
+  std::string checksum;
+  // Recipient strand; resume_offset is read by the sender after the
+  // answer is posted to it.
+  bool answered = false;
+  std::size_t resume_offset = 0;
+  // Chunk bytes queued at the recipient and not yet written.
+  std::atomic<std::size_t> in_flight{0};
+  std::atomic<bool> sender_waiting{false};
+
+  // Called when a chunk leaves the recipient's queue, from any thread.
+  void release(std::size_t bytes);
+};
+
+// Relays files between logged-in players. Clients address each other by
+// player name and the payload moves as length-prefixed raw chunks:
+//
+//   -> file_offer:<player>:<file name>:<size>
+//   <- file_offer:<file name>:<size>:<sender>           (recipient)
+//   -> file_accept:<sender>[:<offset>] | file_decline:<sender>
+//   <- file_accepted:<player>:<offset> | file_declined:<player>
+//   <- file_begin_transfer:<file name>:<size>:<offset>  (recipient)
+//   -> file_data:<player>:<offset>:<length>:<crc32>\n<length bytes>
+//   <- file_data:<offset>:<length>:<crc32>\n<bytes>     (recipient)
+//   -> file_ack:<sender>:<offset> | file_nack:<sender>:<offset>
+//   <- file_ack:<player>:<offset> | file_nack:<player>:<offset>
+//   -> file_end:<player>:<crc32>
+//   <- file_end:<sender>:<crc32>                        (recipient)
+//   <- file_cancelled:<peer>                            (either side)
+//
+// Offsets, checksums, acknowledgements and resuming are end to end
+// between the two clients (see mud::file); the relay only forwards them
+// and checks that chunks stay inside the offered size.
+//
+// Chunks are read straight into the message that goes out on the
+// recipient's priority lane. Once more than `window` bytes are queued
+// there the sender's reader stops reading until half of them are written,
+// so a slow recipient throttles the sending client through TCP instead of
+// growing the server's queues. Not thread-safe: used on the session's
+// strand, and other sessions reach it through session::post().
+class file_relay {
+public:
+  static constexpr std::size_t max_chunk = 32 * 1024;
+  static constexpr std::size_t window = 128 * 1024;
+
+  file_relay(session &session, boost::asio::any_io_executor executor);
+
+  static bool is_data_header(std::string_view line);
+  // Handles the control lines above; returns false for anything else.
+  bool handle_line(std::string_view line);
+  // Reads the payload announced by a file_data header from the socket and
+  // queues it at the recipient, waiting first if the window is full.
+  boost::asio::awaitable<void> relay_chunk(std::string_view header);
+  // Cancels every transfer in either direction and tells the peers.
+  // Called from session::stop().
+  void cancel_all();
+
+  // Posted by the peer's relay.
+  void offered(std::shared_ptr<file_transfer> transfer);
+  void answered(std::shared_ptr<file_transfer> transfer, bool accepted);
+  void finished(std::shared_ptr<file_transfer> transfer, bool complete);
+  void cancelled(std::shared_ptr<file_transfer> transfer);
+  void reported(std::shared_ptr<file_transfer> transfer, std::string line);
+  void wake();
+
+private:
+  void offer(std::string_view args);
+  void answer(std::string_view args, bool accept);
+  // Forwards a recipient's file_ack / file_nack to the sender.
+  void report(std::string_view args, std::string_view kind);
+  void end(std::string_view args);
+
+  session &session_;
+  // Keyed by recipient name.
+  std::map<std::string, std::shared_ptr<file_transfer>, std::less<>> outgoing_;
+  // Keyed by sender name.
+  std::map<std::string, std::shared_ptr<file_transfer>, std::less<>> incoming_;
+  // Never expires; cancelled by wake() when the window opens again.
+  boost::asio::steady_timer signal_;
+  bool closed_ = false;
+};
+} // namespace mud
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace mud {
+namespace world {
+class Room;
+}
+
+// JSON payloads for the GMCP packages the server sends. Frame them with
+// telnet_protocol::gmcp().
+namespace gmcp {
+// Room.Info: {"id", "name", "description", "width", "height", "exits"}
+std::string room_info(const world::Room &room);
+// Char.Position: {"room", "x", "y"}
+std::string char_position(const world::Room &room, int x, int y);
+// Room.Players: [{"name"}, ...]
+std::string room_players(const std::vector<std::string> &names);
+// Room.AddPlayer: {"name"}
+std::string room_add_player(const std::string &name);
+// Room.RemovePlayer: "name"
+std::string room_remove_player(const std::string &name);
+} // namespace gmcp
+} // namespace mud
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace mud {
+
+// Operation kinds whose handler storage is recycled and counted.
+enum class handler_op {
+  // Cross-strand hand-offs into a session (deliver, send_gmcp, login).
+  deliver,
+  // Work posted to a shard's strand.
+  shard_post,
+  accept,
+  // mud::file reads and writes.
+  file,
+  count_,
+};
+
+// Per-thread free lists for async handler storage. Asio allocates every
+// operation's state (the handler plus its own bookkeeping) through the
+// handler's associated allocator; handler_allocator points that at here,
+// so in steady state operations reuse blocks freed by earlier ones instead
+// of going to the global heap. Blocks freed on another thread join that
+// thread's lists, and surplus moves between threads in batches through
+// a shared pool. Allocation counts are kept per handler_op.
+class handler_memory {
+public:
+  static void *allocate(handler_op op, std::size_t size);
+  static void deallocate(void *p, std::size_t size);
+
+  // Blocks that had to come from the global heap.
+  static std::uint64_t heap_allocations(handler_op op);
+  // Blocks served from a free list.
+  static std::uint64_t recycled(handler_op op);
+  // "deliver: 12 heap / 3400 recycled, ..." for stats output.
+  static std::string report();
+
+private:
+  static std::array<std::atomic<std::uint64_t>,
+                    static_cast<std::size_t>(handler_op::count_)>
+      heap_;
+  static std::array<std::atomic<std::uint64_t>,
+                    static_cast<std::size_t>(handler_op::count_)>
+      recycled_;
+};
+
+template <typename T> class handler_allocator {
+public:
+  using value_type = T;
+
+  explicit handler_allocator(handler_op op) noexcept : op_(op) {}
+  template <typename U>
+  handler_allocator(const handler_allocator<U> &other) noexcept
+      : op_(other.op()) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(handler_memory::allocate(op_, sizeof(T) * n));
+  }
+  void deallocate(T *p, std::size_t n) {
+    handler_memory::deallocate(p, sizeof(T) * n);
+  }
+
+  handler_op op() const noexcept { return op_; }
+
+  // All instances share the same pools.
+  template <typename U>
+  bool operator==(const handler_allocator<U> &) const noexcept {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const handler_allocator<U> &) const noexcept {
+    return false;
+  }
+
+private:
+  handler_op op_;
+};
+
+// Wraps a completion handler so its operation storage comes from
+// handler_memory. Only for handlers without an associated executor of
+// their own (plain lambdas); the wrapper does not forward one.
+template <typename Handler> class recycling_handler {
+public:
+  using allocator_type = handler_allocator<Handler>;
+
+  recycling_handler(handler_op op, Handler handler)
+      : op_(op), handler_(std::move(handler)) {}
+
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(op_);
+  }
+
+  template <typename... Args> void operator()(Args &&...args) {
+    handler_(std::forward<Args>(args)...);
+  }
+
+private:
+  handler_op op_;
+  Handler handler_;
+};
+
+template <typename Handler>
+recycling_handler<std::decay_t<Handler>> recycle(handler_op op,
+                                                 Handler &&handler) {
+  return recycling_handler<std::decay_t<Handler>>(
+      op, std::forward<Handler>(handler));
+}
+} // namespace mud
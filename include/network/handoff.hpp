@@ -0,0 +1,103 @@
+#pragma once
+
+#include "network/chat_participant.hpp"
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+// Passing sockets between processes needs Unix domain sockets and
+// SCM_RIGHTS. Elsewhere the drain still backs a graceful shutdown.
+#define MUD_HAS_HANDOFF 1
+#endif
+
+namespace mud::handoff {
+
+using native_handle = boost::asio::ip::tcp::socket::native_handle_type;
+#if defined(MUD_HAS_HANDOFF)
+constexpr native_handle invalid_handle = -1;
+#else
+constexpr native_handle invalid_handle = native_handle(~0);
+#endif
+
+// What a session needs to carry on in another process. Output is flushed
+// before the socket is detached, so only input and negotiated state move.
+struct session_state {
+  wire_protocol protocol = wire_protocol::text;
+  // Empty while the client is still at the name prompt.
+  std::string name;
+  std::string room;
+  int x = 0;
+  int y = 0;
+  bool telnet_mode = false;
+  bool telnet_active = false;
+  bool gmcp_enabled = false;
+  std::set<std::string> gmcp_modules;
+  // MCCP2 was on. The stream is ended before the hand-off, so the new
+  // process starts a fresh one.
+  bool compress = false;
+  int width = 0;
+  int height = 0;
+  std::string terminal_type;
+  // Received bytes that no line or frame has consumed yet.
+  std::string input;
+};
+
+struct listener {
+  native_handle fd = invalid_handle;
+  wire_protocol protocol = wire_protocol::text;
+};
+
+struct detached_session {
+  native_handle fd = invalid_handle;
+  session_state state;
+};
+
+struct state {
+  std::vector<listener> listeners;
+  std::vector<detached_session> sessions;
+};
+
+// Gathers the listeners and detached sessions of every shard while the
+// server drains, then calls done once with all of them. Thread-safe.
+class collector {
+public:
+  collector(std::size_t shards, std::function<void(state)> done);
+
+  void add_listener(listener l);
+  // A shard calls expect_session() for every session it asks to detach
+  // before its shard_done(); the session answers with add_session().
+  void expect_session();
+  void add_session(detached_session s);
+  void shard_done();
+
+private:
+  void finish(std::unique_lock<std::mutex> &lock);
+
+  std::mutex mutex_;
+  std::size_t shards_left_;
+  std::size_t sessions_expected_ = 0;
+  state state_;
+  std::function<void(state)> done_;
+};
+
+// Sends state over a connected control socket: one SOCK_SEQPACKET record
+// per listener and session, each a JSON object carrying its descriptor as
+// SCM_RIGHTS, then {"type": "end"}. Blocks until everything is sent.
+bool send(native_handle control, const state &s);
+// Connects to the server listening on path and takes everything it hands
+// over. Returns false if no server answered or none of its listeners
+// arrived; descriptors received until then are closed.
+bool receive(const std::string &path, state &out);
+// Closes every descriptor in s.
+void close_all(state &s);
+// dup(), or invalid_handle where descriptors can't be handed off.
+native_handle duplicate(native_handle fd);
+// TCP v4 or v6, from the descriptor's local address.
+boost::asio::ip::tcp protocol_of(native_handle fd);
+
+} // namespace mud::handoff
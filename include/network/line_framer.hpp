@@ -0,0 +1,45 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace mud {
+
+// Fixed-capacity receive buffer that splits input into lines in place.
+// Reads go straight into prepare(); next_line() then hands out every
+// complete line as a view into the buffer, so no per-line copies are made.
+// Views stay valid until the next prepare().
+class line_framer {
+public:
+  explicit line_framer(std::size_t capacity = 4096,
+                       std::size_t max_line_length = 1024);
+
+  // Moves any partial line to the front and returns the free tail.
+  boost::asio::mutable_buffer prepare();
+  void commit(std::size_t bytes);
+
+  // Yields the next complete line without its "\n" or "\r\n". Lines longer
+  // than max_line_length are discarded up to their newline and reported
+  // once through take_overflow().
+  bool next_line(std::string_view &line);
+  bool take_overflow();
+
+  // Hands out up to max_bytes that are buffered after the last line, for
+  // callers that read a raw payload announced by that line. The view stays
+  // valid until the next prepare().
+  std::string_view take(std::size_t max_bytes);
+
+  std::size_t max_line_length() const;
+
+private:
+  std::vector<char> buffer_;
+  std::size_t max_line_length_;
+  std::size_t begin_ = 0;
+  std::size_t scan_ = 0;
+  std::size_t end_ = 0;
+  bool discarding_ = false;
+  bool overflow_ = false;
+};
+} // namespace mud
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <zlib.h>
+
+namespace mud {
+
+// Streaming zlib deflate for MCCP2. One stream per connection, flushed
+// with Z_SYNC_FLUSH after every batch so the client can render it at once.
+class mccp_compressor {
+public:
+  mccp_compressor() = default;
+  ~mccp_compressor();
+  mccp_compressor(const mccp_compressor &) = delete;
+  mccp_compressor &operator=(const mccp_compressor &) = delete;
+
+  bool start();
+  bool active() const;
+
+  // Deflates buffers [first, last) and appends the result to out.
+  bool compress(std::vector<boost::asio::const_buffer>::const_iterator first,
+                std::vector<boost::asio::const_buffer>::const_iterator last,
+                std::vector<char> &out);
+  // Ends the stream and appends its tail to out. The client then reads
+  // plain bytes again until another start().
+  bool finish(std::vector<char> &out);
+
+  std::uint64_t bytes_in() const;
+  std::uint64_t bytes_out() const;
+  std::chrono::nanoseconds cpu_time() const;
+  // bytes_in / bytes_out, or 0 before anything was compressed.
+  double ratio() const;
+
+private:
+  z_stream stream_{};
+  bool active_ = false;
+  std::uint64_t bytes_in_ = 0;
+  std::uint64_t bytes_out_ = 0;
+  std::chrono::nanoseconds cpu_time_{0};
+};
+} // namespace mud
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "network/chat_participant.hpp"
+#include <boost/asio/buffer.hpp>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace mud {
+
+// What a session does with bulk output once its queue is over budget.
+enum class slow_consumer_policy {
+  // Discard new chat.
+  drop_chat,
+  // Fold chat identical to the last queued chat line into that line, as
+  // "line (x3)"; discard anything else.
+  collapse_repeats,
+  // Keep queueing, but disconnect if still over budget after the grace.
+  disconnect,
+};
+
+struct output_budget {
+  std::size_t max_bytes = 256 * 1024;
+  std::size_t max_messages = 1024;
+  slow_consumer_policy policy = slow_consumer_policy::drop_chat;
+  std::chrono::seconds grace{10};
+  // The priority lane is never dropped from, so a client that stops
+  // reading is disconnected once this much of it is waiting, whatever
+  // the policy.
+  std::size_t max_priority_bytes = 1024 * 1024;
+};
+
+// Per-session output queue with two lanes. The priority lane carries
+// output addressed to this player (system, movement, whispers) and is
+// never dropped, only capped; the bulk lane carries fan-out chat and is
+// subject to the slow-consumer policy. Not thread-safe: used on the
+// session's strand.
+class output_queue {
+public:
+  enum class push_result { queued, dropped, collapsed, disconnect };
+
+  // protocol decides how a collapsed repeat is marked.
+  output_queue(const output_budget &budget,
+               wire_protocol protocol = wire_protocol::text);
+
+  push_result push(shared_message msg, message_lane lane,
+                   std::chrono::steady_clock::time_point now =
+                       std::chrono::steady_clock::now());
+
+  bool empty() const;
+  bool writing() const;
+
+  // Fills buffers with queued payloads, priority lane first, up to
+  // max_bytes (at least one message). They stay queued until consume().
+  // Returns the number of bytes gathered.
+  std::size_t gather(std::vector<boost::asio::const_buffer> &buffers,
+                     std::size_t max_bytes);
+  // Releases everything handed out by the last gather().
+  void consume();
+
+  std::size_t queued_bytes() const;
+  std::size_t queued_messages() const;
+  std::uint64_t dropped() const;
+  std::uint64_t collapsed() const;
+
+private:
+  bool over_budget(std::size_t extra_bytes, std::size_t extra_messages) const;
+  // Folds msg into the last bulk message if it repeats it and has not
+  // been handed to a write yet.
+  bool collapse(const shared_message &msg);
+
+  output_budget budget_;
+  wire_protocol protocol_;
+  std::array<std::deque<shared_message>, 2> lanes_;
+  std::array<std::size_t, 2> in_flight_{};
+  std::size_t queued_bytes_ = 0;
+  std::size_t priority_bytes_ = 0;
+  // The last bulk message as it was pushed, and how many times it has
+  // been folded into the queued copy.
+  shared_message last_bulk_;
+  std::size_t repeats_ = 1;
+  std::uint64_t dropped_ = 0;
+  std::uint64_t collapsed_ = 0;
+  bool over_budget_ = false;
+  std::chrono::steady_clock::time_point over_budget_since_;
+};
+} // namespace mud
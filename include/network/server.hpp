@@ -2,47 +2,155 @@
 
 #include "commands/command_manager.hpp"
 #include "network/chat_participant.hpp"
+#include "network/data_watcher.hpp"
+#include "network/event_bus.hpp"
+#include "network/handoff.hpp"
+#include "network/output_queue.hpp"
+#include "network/shard.hpp"
 #include "players/player.hpp"
+#include "world/tick_scheduler.hpp"
+#include "world/timing_wheel.hpp"
 #include "world/world.hpp"
 #include <boost/asio.hpp>
-#include <map>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
-#include <set>
 #include <string>
+#include <vector>
 
 namespace mud {
 class session;
 
 using boost::asio::ip::tcp;
 
+enum class io_mode {
+  // One shared io_context run by a pool of threads.
+  pool,
+  // One single-threaded io_context per thread, each pinned to a core with
+  // its own SO_REUSEPORT acceptor.
+  sharded,
+};
+
+struct server_options {
+  std::size_t threads = 1;
+  io_mode mode = io_mode::pool;
+  // Per-session output queue limits.
+  output_budget output;
+  // Negotiate telnet options (NAWS, TTYPE, MCCP2, GMCP) on connect.
+  bool telnet = true;
+  // Also listen here for bots and tools speaking binary_protocol frames.
+  // 0 disables the binary listener.
+  unsigned short binary_port = 0;
+  // Unix socket for hot restarts. A server started with it first takes
+  // over the listeners and connections of the server listening there, if
+  // any, and then listens there for its own successor.
+  std::string handoff_path;
+  // Game ticks per second. Commands queue up and run on the tick thread
+  // in session order; 0 runs each command as soon as it is read, on its
+  // session's strand.
+  unsigned tick_rate = 20;
+  // Reload commands.json and the maps when they change on disk. Needs
+  // MUD_HAS_DATA_WATCHER.
+  bool reload = true;
+  // How long a shutdown or hand-off waits for a session to flush its
+  // output. A client that stopped reading is closed after it.
+  std::chrono::seconds drain_timeout{5};
+};
+
 class server {
 public:
   server(boost::asio::io_context &io_context, const tcp::endpoint &endpoint,
-         const std::string &data_path);
+         const std::string &data_path, const server_options &options = {});
+  // Runs every shard's io_context and the tick scheduler, and blocks until
+  // all of them return.
   void run();
+  // Makes run() return.
+  void stop();
+  // Stops accepting, flushes every session's output, closes the
+  // connections and stops. For SIGINT / SIGTERM.
+  void shutdown();
 
+  // Subscriptions and the player registry are split across shards, and
+  // each part is owned by its shard's strand. Every method below posts its
+  // work to the owning shard(s), so it is safe to call from any session's
+  // strand.
+  // Subscribes a logged-in session to the global topic and its player
+  // topic; leave() undoes that and its room, and announces the departure.
   void join(chat_participant_ptr participant);
   void leave(chat_participant_ptr participant);
-  void broadcast(const std::string &msg, chat_participant_ptr sender = nullptr);
-  void broadcast_to_room(const std::string &msg,
-                         std::shared_ptr<world::Room> room,
-                         chat_participant_ptr sender);
 
-  std::shared_ptr<Player> add_player(const std::string &name);
+  // Handlers are invoked on the owning shard's strand, not on the caller's.
+  void add_player(std::shared_ptr<Player> player,
+                  std::function<void(bool)> handler);
   void remove_player(const std::string &name);
-  std::shared_ptr<Player> get_player_by_name(const std::string &name);
+  void get_player_by_name(
+      const std::string &name,
+      std::function<void(std::shared_ptr<Player>)> handler);
 
+  // Chat and world events. Player::set_location keeps room and zone
+  // subscriptions up to date.
+  event_bus &get_bus();
   world::World &get_world();
-  const CommandManager &get_command_manager() const;
+  // The current commands. A reload may swap in new ones at any time, so
+  // hold on to the pointer while using a Command it found.
+  std::shared_ptr<const CommandManager> get_command_manager() const;
+  const server_options &get_options() const;
+  // Null when options.tick_rate is 0.
+  world::TickScheduler *get_ticks();
+  // Delayed and recurring world events. Advanced by the tick, so
+  // callbacks run on the tick thread next to the commands; without a tick,
+  // by a timer on shard 0 every default_timer_resolution.
+  world::TimingWheel &get_timers();
+
+  static constexpr std::chrono::milliseconds default_timer_resolution{50};
+
+  // Reactor Boost.Asio was built with ("epoll", "io_uring", "iocp", ...).
+  // Chosen at compile time; see MUD_IO_URING in CMakeLists.txt.
+  static const char *io_backend();
+
+  // Shard that new sessions accepted by acceptor should be placed on.
+  shard &placement_for(shard &acceptor);
 
 private:
-  void do_accept();
+  using control_protocol = boost::asio::generic::seq_packet_protocol;
+  using control_acceptor = boost::asio::basic_socket_acceptor<control_protocol>;
+
+  void take_over(handoff::state inherited);
+  void listen_for_handoff();
+  // Drains into the successor on control, then stops.
+  void hand_off(control_protocol::socket control);
+  // Closes the acceptors and detaches every connection on every shard,
+  // then calls done with them, once, from whichever strand finished last.
+  void drain(std::function<void(handoff::state)> done);
+  // Shard owning a key of the player registry or the room index.
+  shard &owner_of(const std::string &key);
+  // Advances timers_ when there is no tick to do it.
+  void drive_timers();
+  // Re-reads what change touched on reload_pool_, and swaps it in if it
+  // is valid. Logs the outcome either way.
+  void reload(data_watcher::change change);
+  void reload_commands(data_watcher::clock::time_point since);
+  void reload_world(data_watcher::clock::time_point since);
+  // Moves player onto the current definition of its room, or to the
+  // starting room if its room is gone. On the tick, like commands.
+  void relocate(const std::shared_ptr<Player> &player);
 
-  boost::asio::io_context &io_context_;
-  tcp::acceptor acceptor_;
-  std::set<chat_participant_ptr> sessions_;
-  std::map<std::string, std::shared_ptr<Player>> players_;
+  server_options options_;
+  std::vector<std::unique_ptr<shard>> shards_;
+  std::size_t next_placement_ = 0;
+  bool shared_acceptor_ = true;
+  std::unique_ptr<control_acceptor> handoff_acceptor_;
+  std::atomic<bool> draining_{false};
+  std::string data_path_;
   world::World world_;
-  CommandManager command_manager_;
+  std::atomic<std::shared_ptr<const CommandManager>> command_manager_;
+  event_bus bus_;
+  std::unique_ptr<world::TimingWheel> timers_;
+  std::unique_ptr<boost::asio::steady_timer> timer_driver_;
+  std::unique_ptr<world::TickScheduler> ticks_;
+  // Parses reloaded files off the network and tick threads.
+  std::unique_ptr<boost::asio::thread_pool> reload_pool_;
+  std::unique_ptr<data_watcher> watcher_;
 };
 } // namespace mud
@@ -1,18 +1,31 @@
 #pragma once
 
-#include "commands/command_handler.hpp"
+#include "commands/command_queue.hpp"
+#include "commands/command_table.hpp"
+#include "network/binary_protocol.hpp"
 #include "network/chat_participant.hpp"
+#include "network/file_relay.hpp"
+#include "network/handler_memory.hpp"
+#include "network/handoff.hpp"
+#include "network/line_framer.hpp"
+#include "network/mccp.hpp"
+#include "network/output_queue.hpp"
+#include "network/telnet.hpp"
+#include "utils/spsc_queue.hpp"
 #include <boost/asio.hpp>
 #include <atomic>
-#include <deque>
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace mud {
 class server;
+class shard;
 class Player;
 
 using boost::asio::ip::tcp;
@@ -20,31 +33,182 @@ using boost::asio::ip::tcp;
 class session : public chat_participant,
                 public std::enable_shared_from_this<session> {
 public:
-  session(tcp::socket socket, server &server);
+  session(tcp::socket socket, server &server, shard &shard,
+          wire_protocol protocol = wire_protocol::text);
   void start();
-  void deliver(const std::string &msg) override;
+  // Starts a connection handed over by the previous server process in
+  // place of start(): no greeting, and the player is logged back in.
+  void resume(handoff::session_state state);
+  // Stops running input, flushes the queued output (ending MCCP2), then
+  // passes a duplicate of the socket and the session's state to handler
+  // and closes quietly, without a "left the game". A session that is
+  // already closing passes an invalid descriptor. Safe to call from any
+  // strand.
+  void detach(std::function<void(handoff::detached_session)> handler);
+  using chat_participant::deliver;
+  // Binary sessions get each message as an event frame instead.
+  void deliver(shared_message msg, message_lane lane) override;
+  // Queues output already framed for protocol(), so a fan-out converts a
+  // message once rather than once per binary recipient. Safe to call from
+  // any strand.
+  void deliver_frame(shared_message frame, message_lane lane);
+  // Safe to call from any strand, and from commands on the tick thread.
   void stop();
+  bool is_closing() const;
+  // Unique per process, in connection order; the tick runs commands in
+  // this order.
+  std::uint64_t id() const;
 
-  // Getters for CommandHandler
+  // Runs a parsed command. Called by the tick scheduler, or directly by
+  // submit() when the server runs without one.
+  void run_command(const Command &command, const CommandArgs &args);
+  CommandQueue &get_command_queue();
+  // Moves the output a tick left in the outbox to the write queue and wakes
+  // the writer. Safe to call from any strand.
+  void flush_output();
+
+  // Getters for the command handlers
   std::shared_ptr<Player> get_player() const;
   server &get_server();
+  shard &get_shard();
   bool is_logged_in() const;
+  // Only meaningful on the session's strand.
+  double average_messages_per_write() const;
+  const output_queue &get_output_queue() const;
+  const telnet_protocol &get_telnet() const;
+  const mccp_compressor &get_compressor() const;
+  file_relay &get_relay();
+
+  // Runs f on the session's strand, for per-session state owned by other
+  // subsystems (file_relay).
+  template <typename Function> void post(Function &&f) {
+    boost::asio::post(strand_,
+                      recycle(handler_op::deliver, std::forward<Function>(f)));
+  }
+
+  // Fills data with exactly size payload bytes: first whatever the framer
+  // buffered after the current line, then straight from the socket. Only
+  // for the reader coroutine. Returns false if the connection closed.
+  boost::asio::awaitable<bool> read_raw(char *data, std::size_t size);
+  // Whether the client speaks telnet, decided at login. Raw clients get
+  // no input filtering and binary payloads sent to them are not escaped.
+  bool telnet_mode() const;
+  wire_protocol protocol() const;
+
+  // Queues a GMCP message, framed by package() for this session's
+  // protocol, if the client enabled module ("room", "char"). Safe to call
+  // from any strand.
+  void send_gmcp(std::string module, shared_message frame);
+  // Lets shards skip building GMCP payloads for plain telnet clients.
+  // Binary clients get every package.
+  bool gmcp_enabled() const;
+  // Only meaningful on the session's strand.
+  bool gmcp_supports(const std::string &module) const;
+  // Queues msg unless the client enabled GMCP module, which carries the
+  // same information. Safe to call from any strand.
+  void deliver_unless_gmcp(std::string module, std::string msg);
+  // Frames a GMCP package as telnet subnegotiation or a binary data frame.
+  shared_message package(std::string_view name, const std::string &json) const;
+  // Called by Player::set_location, from the tick or the session's strand.
+  void location_changed(bool room_changed);
+
+  // Upper bound on the bytes gathered into one async_write. A single
+  // message larger than this is still written on its own.
+  static constexpr std::size_t max_write_bytes = 64 * 1024;
 
 private:
-  void do_read();
-  void do_write();
-  void handle_initial_input(const std::string &input);
-  void handle_message(const std::string &msg);
-  void process_command(const std::string &input);
+  // The session runs as two coroutines on its strand: reader() owns the
+  // socket's read side and the login handshake, writer() drains the output
+  // queue and sleeps on write_signal_ while it is empty. Each holds a
+  // reference to the session for its whole lifetime, so individual I/O
+  // operations don't copy shared_from_this().
+  boost::asio::awaitable<void> reader();
+  // reader() for the binary listener: decodes binary_protocol requests.
+  boost::asio::awaitable<void> binary_reader();
+  boost::asio::awaitable<void> writer();
+  // Restores state, then runs the reader for this session's protocol.
+  boost::asio::awaitable<void> resume_reader(handoff::session_state state);
+  // Called by the reader once writer() has drained for detach().
+  void finish_detach(std::string_view input);
+  void read_failed(const boost::system::error_code &ec);
+  // Returns once the name is registered, or taken (so the reader can ask
+  // for another), or the connection closed in between.
+  boost::asio::awaitable<void> login(std::string name);
+  boost::asio::awaitable<bool> register_player(std::shared_ptr<Player> player);
+  // Queues msg as it is; deliver() minus the binary conversion.
+  void enqueue(shared_message msg, message_lane lane);
+  // The strand side of enqueue(). Returns false if msg was not queued.
+  bool push_output(shared_message msg, message_lane lane);
+  // Moves everything in outbox_ to the write queue. Strand only; runs
+  // before any other output so a tick's messages keep their order.
+  void drain_outbox();
+  void wake_writer();
+  void handle_telnet();
+  // location_changed() on the session's strand.
+  void send_location(bool room_changed);
+  void compress_output();
+  void handle_message(std::string_view msg);
+  void process_command(std::string_view input);
+  void process_request(const binary::request &request);
+  // Queues a parsed command for the tick, or runs it if there is none.
+  // Over the queue limit, or over the class's rate without a tick to defer
+  // to, or when the tick's inbox is full, the command is rejected.
+  void submit(QueuedCommand command);
 
   tcp::socket socket_;
+  // The strand the socket was accepted onto, with its concrete type so
+  // hand-offs into the session keep their associated allocator (the
+  // socket's type-erased executor drops it).
+  boost::asio::strand<boost::asio::io_context::executor_type> strand_;
   server &server_;
-  boost::asio::streambuf buffer_;
-  std::deque<std::string> write_msgs_;
+  shard &shard_;
+  wire_protocol protocol_;
+  std::uint64_t id_;
+  line_framer framer_;
+  output_queue write_queue_;
+  struct outbound_message {
+    shared_message msg;
+    message_lane lane = message_lane::bulk;
+  };
+  // Output from the tick thread on its way to the strand. Only the first
+  // message after a flush schedules one, so a tick costs each session a
+  // single strand hop however much it says.
+  utils::SpscQueue<outbound_message> outbox_;
+  // Tick output sent straight to the strand, past a full outbox, and not
+  // queued yet. The tick keeps bypassing the outbox until it is back to 0.
+  std::atomic<std::size_t> outbox_overflow_{0};
+  static constexpr std::size_t outbox_capacity = 64;
+  // Never expires; cancelled by deliver() to wake an idle writer().
+  boost::asio::steady_timer write_signal_;
+  // Closes the session if writer() hasn't drained for detach() in time.
+  boost::asio::steady_timer detach_deadline_;
+  std::vector<boost::asio::const_buffer> write_buffers_;
+  telnet_protocol telnet_;
+  mccp_compressor compressor_;
+  // The IAC SB MCCP2 IAC SE payload while it waits in the queue; output
+  // after it in the stream is compressed.
+  shared_message mccp_start_;
+  std::vector<char> compressed_;
+  std::uint64_t writes_ = 0;
+  std::uint64_t messages_written_ = 0;
   std::shared_ptr<Player> player_;
-  bool is_logged_in_ = false;
+  std::atomic<bool> is_logged_in_{false};
   std::atomic<bool> closing_{false};
+  std::atomic<bool> gmcp_enabled_{false};
+  std::atomic<bool> telnet_mode_{false};
+  // Set by detach(); the readers stop running input while it is pending.
+  std::function<void(handoff::detached_session)> detach_handler_;
+  // writer() has flushed everything for detach_handler_.
+  bool drained_ = false;
+  // The tick is still running the commands queued before detach(); the
+  // writer waits for their output before draining.
+  bool finishing_commands_ = false;
+  bool compression_ended_ = false;
+  bool resumed_ = false;
+  // Input the previous process had read but not run yet.
+  std::string resumed_input_;
   std::string remote_endpoint_str_;
-  CommandHandler command_handler_;
+  CommandQueue command_queue_;
+  file_relay relay_;
 };
 } // namespace mud
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "network/chat_participant.hpp"
+#include "network/event_bus.hpp"
+#include "network/handler_memory.hpp"
+#include "network/handoff.hpp"
+#include "players/player.hpp"
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mud {
+class server;
+class session;
+
+using boost::asio::ip::tcp;
+
+// A shard is one reactor: an io_context, the sessions it accepted, and its
+// partitions of the player registry and the event bus's subscriptions. Its state is only ever touched on its
+// own strand, so other shards talk to it by posting work (see post()).
+class shard {
+public:
+  // Pass nullptr to give the shard its own single-threaded io_context.
+  shard(server &server, std::size_t index,
+        boost::asio::io_context *io_context = nullptr);
+
+  std::size_t index() const;
+  boost::asio::io_context &get_io_context();
+
+  template <typename Function> void post(Function &&f) {
+    boost::asio::post(strand_,
+                      recycle(handler_op::shard_post, std::forward<Function>(f)));
+  }
+
+  // Opens an acceptor on endpoint. With reuse_port every shard binds the
+  // same port and the kernel spreads incoming connections between them.
+  // Sessions accepted there speak protocol.
+  void listen(const tcp::endpoint &endpoint, bool reuse_port,
+              wire_protocol protocol = wire_protocol::text);
+
+  // Accepts on a listening socket inherited from the previous process.
+  void adopt(handoff::native_handle fd, wire_protocol protocol);
+
+  // The functions below must run on this shard's strand.
+  // Every open connection on this shard, logged in or not.
+  void add_connection(std::shared_ptr<session> connection);
+  void remove_connection(const std::shared_ptr<session> &connection);
+  // Closes the acceptors and detaches every connection into collector.
+  void detach_all(const std::shared_ptr<handoff::collector> &collector);
+
+  // Subscribers of the topics this shard owns (see event_bus), and of the
+  // global topic for its own sessions. Sessions from any shard may be
+  // listed here. Room subscribers double as the room occupancy index.
+  void subscribe(const topic &t, chat_participant_ptr participant);
+  // Returns whether participant was subscribed.
+  bool unsubscribe(const topic &t, const chat_participant_ptr &participant);
+  // Returns the number of recipients.
+  std::size_t publish(const event_bus::event &e);
+  std::vector<std::string> subscriber_names(const topic &t) const;
+
+  bool add_player(std::shared_ptr<Player> player);
+  void erase_player(const std::string &name);
+  std::shared_ptr<Player> find_player(const std::string &name) const;
+  // Registered players whose room is one of room_ids.
+  std::vector<std::shared_ptr<Player>>
+  players_in(const std::set<std::string> &room_ids) const;
+
+private:
+  struct listener {
+    std::unique_ptr<tcp::acceptor> acceptor;
+    wire_protocol protocol;
+  };
+
+  void start_accepting(std::unique_ptr<tcp::acceptor> acceptor,
+                       wire_protocol protocol);
+  void do_accept(tcp::acceptor &acceptor, wire_protocol protocol);
+  // Sends Room.AddPlayer / Room.RemovePlayer to GMCP and binary clients in
+  // occupants.
+  void announce(const std::set<chat_participant_ptr> &occupants,
+                const chat_participant_ptr &participant, bool entered);
+
+  server &server_;
+  std::size_t index_;
+  std::unique_ptr<boost::asio::io_context> owned_io_context_;
+  boost::asio::io_context &io_context_;
+  boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+  std::vector<listener> listeners_;
+  std::set<std::shared_ptr<session>> connections_;
+  std::map<std::string, std::shared_ptr<Player>> players_;
+  // By topic::key().
+  std::map<std::string, std::set<chat_participant_ptr>> subscribers_;
+};
+} // namespace mud
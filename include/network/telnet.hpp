@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+
+namespace mud {
+
+namespace telnet {
+constexpr unsigned char IAC = 255;
+constexpr unsigned char DONT = 254;
+constexpr unsigned char DO = 253;
+constexpr unsigned char WONT = 252;
+constexpr unsigned char WILL = 251;
+constexpr unsigned char SB = 250;
+constexpr unsigned char SE = 240;
+
+constexpr unsigned char OPT_TTYPE = 24;
+constexpr unsigned char OPT_NAWS = 31;
+constexpr unsigned char OPT_MCCP2 = 86;
+constexpr unsigned char OPT_GMCP = 201;
+
+constexpr unsigned char TTYPE_IS = 0;
+constexpr unsigned char TTYPE_SEND = 1;
+} // namespace telnet
+
+// Server side of the telnet option negotiation. filter() strips commands
+// from inbound bytes in place and queues any replies; the session sends
+// those with take_output(). Not thread-safe: used on the session's strand.
+class telnet_protocol {
+public:
+  // Sent once on connect: WILL MCCP2, WILL GMCP, DO NAWS, DO TTYPE.
+  static std::string offer();
+  // IAC SB MCCP2 IAC SE. Everything sent after it must be compressed.
+  static std::string start_compression();
+  // IAC SB GMCP "<package> <payload>" IAC SE.
+  static std::string gmcp(const std::string &package,
+                          const std::string &payload);
+  // Appends data to out with every IAC byte doubled, so binary payloads
+  // reach a telnet client unchanged.
+  static void escape(std::string_view data, std::string &out);
+
+  // Removes telnet commands from data and returns the number of plain
+  // text bytes left at its front. Sequences may span calls.
+  std::size_t filter(char *data, std::size_t size);
+
+  // Negotiation replies produced by filter(); empty if there are none.
+  std::string take_output();
+  // True once, after the client agreed to MCCP2.
+  bool take_compression_request();
+  // True once, after the client agreed to GMCP.
+  bool take_gmcp_enabled();
+
+  bool gmcp_enabled() const;
+  // True once the client has sent any telnet command. Clients that never
+  // do are treated as raw byte streams after login (see session).
+  bool active() const;
+  // Module names from Core.Supports, compared case-insensitively ("room").
+  bool gmcp_supports(const std::string &module) const;
+  const std::set<std::string> &gmcp_modules() const;
+
+  // Picks up a negotiation finished by a previous server process (see
+  // handoff.hpp). The client has already answered the offer.
+  void restore(bool active, bool gmcp_enabled,
+               std::set<std::string> gmcp_modules, int width, int height,
+               std::string terminal_type);
+
+  int width() const;
+  int height() const;
+  const std::string &terminal_type() const;
+
+private:
+  enum class state { data, iac, option, sb_option, sb_data, sb_iac };
+
+  void handle_option(unsigned char verb, unsigned char option);
+  void handle_subnegotiation();
+  void handle_gmcp(const std::string &message);
+
+  state state_ = state::data;
+  unsigned char verb_ = 0;
+  unsigned char sb_option_ = 0;
+  std::string sb_data_;
+  std::string output_;
+  bool compression_requested_ = false;
+  bool compression_offered_ = true;
+  bool active_ = false;
+  bool gmcp_enabled_ = false;
+  bool gmcp_just_enabled_ = false;
+  std::set<std::string> gmcp_modules_;
+  int width_ = 0;
+  int height_ = 0;
+  std::string terminal_type_;
+};
+} // namespace mud
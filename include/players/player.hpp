@@ -2,6 +2,7 @@
 
 #include "world/room.hpp"
 #include <memory>
+#include <mutex>
 #include <string>
 
 namespace mud {
@@ -9,20 +10,37 @@ class session; // Forward declaration
 
 class Player {
 public:
+  struct Location {
+    std::shared_ptr<world::Room> room;
+    int x = 0;
+    int y = 0;
+  };
+
   Player(const std::string &name);
 
   const std::string &get_name() const;
   void send_message(const std::string &message);
   void set_session(std::weak_ptr<session> session);
+  // Null once the player's connection is gone.
+  std::shared_ptr<session> get_session() const;
 
+  // Also moves the session's room and zone subscriptions on the event
+  // bus. Ignored once the session is closing, as it has already left its
+  // room. The location is locked: commands move the player on the tick
+  // thread while its session reads it.
   void set_location(std::shared_ptr<world::Room> room, int x, int y);
   std::shared_ptr<world::Room> get_room() const;
   int get_x() const;
   int get_y() const;
+  // The room and coordinates read together, so a move (or a reload
+  // relocating the player) in between can't pair one room with another's
+  // coordinates.
+  Location get_location() const;
 
 private:
   std::string name_;
   std::weak_ptr<session> session_;
+  mutable std::mutex location_mutex_;
   std::shared_ptr<world::Room> current_room_;
   int x_ = 0;
   int y_ = 0;
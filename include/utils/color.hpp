@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cctype>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace mud::utils::color {
 
@@ -71,11 +74,103 @@ inline std::string system(const std::string &message) {
 }
 
 inline std::string error(const std::string &message) {
-  return tag("Error", ERROR, message);
+  return tag("Error", ERROR_, message);
 }
 
 inline std::string portal(const std::string &message) {
   return tag("Portal", PORTAL, message);
 }
 
+const std::string CLEAR_SCREEN = "\033[2J\033[H";
+
+// What a message built by the helpers above is, for clients that get
+// structured events instead of colored text (binary_protocol).
+enum class category : std::uint8_t {
+  plain = 0,
+  say,
+  shout,
+  whisper,
+  join,
+  left,
+  event,
+  move,
+  system,
+  error,
+  portal,
+  clear,
+};
+
+struct parsed_message {
+  category kind = category::plain;
+  std::string_view text;
+};
+
+// Undoes tag(), tagWithColor() and color(): returns the category and the
+// message without its tag and escape codes. Anything else is plain and
+// comes back as it is. JOIN and SAY share a color, so an untagged green
+// line counts as join.
+inline parsed_message parse(std::string_view message) {
+  while (!message.empty() && (message.back() == '\n' || message.back() == '\r')) {
+    message.remove_suffix(1);
+  }
+  while (!message.empty() && message.front() == '\n') {
+    message.remove_prefix(1);
+  }
+  if (message == CLEAR_SCREEN) {
+    return {category::clear, {}};
+  }
+  if (message.rfind("\x1b[", 0) != 0) {
+    return {category::plain, message};
+  }
+  auto code_end = message.find('m');
+  if (code_end == std::string_view::npos) {
+    return {category::plain, message};
+  }
+  std::string_view code = message.substr(0, code_end + 1);
+  std::string_view rest = message.substr(code_end + 1);
+  std::string_view reset = RESET;
+
+  if (!rest.empty() && rest.front() == '[') {
+    auto tag_end = rest.find("] ");
+    if (tag_end != std::string_view::npos) {
+      std::string tag_name(rest.substr(1, tag_end - 1));
+      for (auto &c : tag_name) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+      }
+      category kind = tag_name == "say"       ? category::say
+                      : tag_name == "shout"   ? category::shout
+                      : tag_name == "whisper" ? category::whisper
+                      : tag_name == "event"   ? category::event
+                      : tag_name == "move"    ? category::move
+                      : tag_name == "system"  ? category::system
+                      : tag_name == "error"   ? category::error
+                      : tag_name == "portal"  ? category::portal
+                                              : category::plain;
+      if (kind != category::plain) {
+        rest.remove_prefix(tag_end + 2);
+        if (rest.rfind(reset, 0) == 0) {
+          rest.remove_prefix(reset.size()); // tag()
+        } else if (rest.size() >= reset.size() &&
+                   rest.substr(rest.size() - reset.size()) == reset) {
+          rest.remove_suffix(reset.size()); // tagWithColor()
+        }
+        return {kind, rest};
+      }
+    }
+  }
+
+  if (rest.size() < reset.size() ||
+      rest.substr(rest.size() - reset.size()) != reset) {
+    return {category::plain, message};
+  }
+  rest.remove_suffix(reset.size());
+  category kind = code == JOIN     ? category::join
+                  : code == LEFT   ? category::left
+                  : code == SYSTEM ? category::system
+                  : code == ERROR_ ? category::error
+                  : code == MOVE   ? category::move
+                                   : category::plain;
+  return {kind, kind == category::plain ? message : rest};
+}
+
 } // namespace mud::utils::color
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace mud::utils {
+
+// Process-wide counters. Updated with relaxed atomics from any thread;
+// read them for reporting only.
+class Metrics {
+public:
+    static Metrics& instance() {
+        static Metrics instance;
+        return instance;
+    }
+
+    // Input path (session::process_command)
+    std::atomic<std::uint64_t> commands{0};
+    // Per-session command queues (CommandQueue). commands_queued is the
+    // number waiting right now; a throttle is one session held back by its
+    // token bucket for one tick.
+    std::atomic<std::uint64_t> commands_queued{0};
+    std::atomic<std::uint64_t> command_queue_peak{0};
+    std::atomic<std::uint64_t> command_throttles{0};
+    std::atomic<std::uint64_t> commands_rejected{0};
+
+    // Global operator new calls; only counted in MUD_COUNT_ALLOCATIONS builds.
+    std::atomic<std::uint64_t> allocations{0};
+
+    // Output path (session::do_write)
+    std::atomic<std::uint64_t> writes{0};
+    std::atomic<std::uint64_t> messages_written{0};
+    std::atomic<std::uint64_t> bytes_written{0};
+
+    // Slow consumers (output_queue)
+    std::atomic<std::uint64_t> messages_dropped{0};
+    std::atomic<std::uint64_t> messages_collapsed{0};
+    std::atomic<std::uint64_t> slow_consumer_disconnects{0};
+
+    // Player-to-player file transfers (file_relay)
+    std::atomic<std::uint64_t> files_relayed{0};
+    std::atomic<std::uint64_t> file_bytes_relayed{0};
+
+    // MCCP2 (session::compress_output)
+    std::atomic<std::uint64_t> compress_bytes_in{0};
+    std::atomic<std::uint64_t> compress_bytes_out{0};
+    std::atomic<std::uint64_t> compress_ns{0};
+
+    // Game loop (world::TickScheduler). Phases are commands, world systems
+    // and the output flush.
+    std::atomic<std::uint64_t> ticks{0};
+    std::atomic<std::uint64_t> tick_overruns{0};
+    std::atomic<std::uint64_t> tick_ns{0};
+    std::atomic<std::uint64_t> tick_max_ns{0};
+    std::atomic<std::uint64_t> tick_command_ns{0};
+    std::atomic<std::uint64_t> tick_system_ns{0};
+    std::atomic<std::uint64_t> tick_flush_ns{0};
+
+    // World timers (world::TimingWheel)
+    std::atomic<std::uint64_t> timers_pending{0};
+    std::atomic<std::uint64_t> timers_fired{0};
+
+    // Data reloads (server::reload). The latency runs from the first
+    // changed file to the new data being in use.
+    std::atomic<std::uint64_t> reloads{0};
+    std::atomic<std::uint64_t> reload_failures{0};
+    std::atomic<std::uint64_t> reload_last_ns{0};
+
+    double average_messages_per_write() const;
+    double allocations_per_command() const;
+    std::string report() const;
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+private:
+    Metrics() = default;
+};
+
+} // namespace mud::utils
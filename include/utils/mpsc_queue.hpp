@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+namespace mud::utils {
+
+// Bounded lock-free queue for many producers and one consumer (Vyukov's
+// array queue). Each cell carries a sequence number that says whose turn
+// it is, so producers only contend on the tail index and the consumer
+// never touches it. Capacity is rounded up to a power of two.
+template <typename T> class MpscQueue {
+public:
+  explicit MpscQueue(std::size_t capacity) {
+    std::size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_ = std::make_unique<cell[]>(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  // Any thread. Returns false, leaving value alone, when the queue is full.
+  bool try_push(T &&value) {
+    std::size_t pos = tail_.load(std::memory_order_relaxed);
+    cell *c;
+    for (;;) {
+      c = &cells_[pos & mask_];
+      std::size_t sequence = c->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::intptr_t>(sequence) -
+                  static_cast<std::intptr_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    c->value = std::move(value);
+    c->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Passes up to max items to f(T &&), oldest first, and
+  // returns how many. Stops early at a cell a producer has claimed but not
+  // filled yet; it is picked up by the next drain.
+  template <typename Function>
+  std::size_t drain(Function &&f,
+                    std::size_t max = std::numeric_limits<std::size_t>::max()) {
+    std::size_t drained = 0;
+    while (drained < max) {
+      cell &c = cells_[head_ & mask_];
+      if (c.sequence.load(std::memory_order_acquire) != head_ + 1) {
+        break;
+      }
+      T value = std::move(c.value);
+      c.value = T();
+      c.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+      ++head_;
+      f(std::move(value));
+      ++drained;
+    }
+    return drained;
+  }
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+private:
+  struct cell {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<cell[]> cells_;
+  std::size_t mask_ = 0;
+  alignas(64) std::atomic<std::size_t> tail_{0};
+  alignas(64) std::size_t head_ = 0;
+};
+
+} // namespace mud::utils
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace mud::utils {
+
+// Bounded lock-free ring for one producer and one consumer, with wake-up
+// coalescing: only the first push after the consumer went to sleep()
+// reports wake, so the producer schedules the consumer once per batch
+// instead of once per item. Capacity is rounded up to a power of two.
+template <typename T> class SpscQueue {
+public:
+  explicit SpscQueue(std::size_t capacity) {
+    std::size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    slots_ = std::make_unique<T[]>(size);
+  }
+
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  enum class push_result {
+    queued,
+    // Queued, and the consumer is asleep: schedule it.
+    wake,
+    // Nothing queued; value is left alone.
+    full,
+  };
+
+  // Producer only.
+  push_result try_push(T &&value) {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) > mask_) {
+      return push_result::full;
+    }
+    slots_[tail & mask_] = std::move(value);
+    // seq_cst against sleep(): either it sees this item or we see it asleep.
+    tail_.store(tail + 1, std::memory_order_seq_cst);
+    if (asleep_.load(std::memory_order_seq_cst) &&
+        asleep_.exchange(false, std::memory_order_seq_cst)) {
+      return push_result::wake;
+    }
+    return push_result::queued;
+  }
+
+  // Consumer only. Passes every queued item to f(T &&), oldest first, and
+  // returns how many.
+  template <typename Function> std::size_t drain(Function &&f) {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    std::size_t tail = tail_.load(std::memory_order_acquire);
+    for (std::size_t i = head; i != tail; ++i) {
+      T value = std::move(slots_[i & mask_]);
+      slots_[i & mask_] = T();
+      f(std::move(value));
+    }
+    head_.store(tail, std::memory_order_release);
+    return tail - head;
+  }
+
+  // Consumer only, after draining. Returns true if the consumer may stop:
+  // the next push wakes it, or one already has. False if items arrived in
+  // between that no wake-up will come for, so the caller must drain again.
+  bool sleep() {
+    asleep_.store(true, std::memory_order_seq_cst);
+    if (tail_.load(std::memory_order_seq_cst) ==
+        head_.load(std::memory_order_relaxed)) {
+      return true;
+    }
+    // A producer that saw us asleep has claimed the wake-up already.
+    return !asleep_.exchange(false, std::memory_order_seq_cst);
+  }
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+private:
+  std::unique_ptr<T[]> slots_;
+  std::size_t mask_ = 0;
+  alignas(64) std::atomic<std::size_t> head_{0};
+  alignas(64) std::atomic<std::size_t> tail_{0};
+  // Starts asleep, so the first push wakes the consumer.
+  alignas(64) std::atomic<bool> asleep_{true};
+};
+
+} // namespace mud::utils
@@ -32,17 +32,24 @@ struct Tile {
 class Room {
 public:
   Room(const std::string &id, const std::string &name,
-       const std::string &description, int width, int height);
+       const std::string &description, int width, int height,
+       const std::string &zone = "");
 
   const std::string &get_id() const;
   const std::string &get_name() const;
   const std::string &get_description() const;
+  // Group of rooms sharing zone-wide events; empty if the map names none.
+  const std::string &get_zone() const;
   int get_width() const;
   int get_height() const;
   const Tile &get_tile(int x, int y) const;
 
-  void link(const std::string &direction, std::shared_ptr<Room> room);
-  std::shared_ptr<Room> get_exit(const std::string &direction) const;
+  // Exits name their target by id, so a room never holds on to another
+  // and each can be replaced on its own when the maps are reloaded.
+  void link(const std::string &direction, const std::string &room_id);
+  // Empty if there is no exit that way.
+  const std::string &get_exit(const std::string &direction) const;
+  const std::map<std::string, std::string> &get_exits() const;
 
   void add_object(int x, int y, const Object &object);
   void add_portal(const Portal &portal);
@@ -51,9 +58,10 @@ private:
   std::string id_;
   std::string name_;
   std::string description_;
+  std::string zone_;
   int width_;
   int height_;
-  std::map<std::string, std::shared_ptr<Room>> exits_;
+  std::map<std::string, std::string> exits_;
   std::vector<std::vector<Tile>> tiles_;
 };
 
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "commands/command_queue.hpp"
+#include "utils/mpsc_queue.hpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mud {
+class session;
+
+namespace world {
+
+// The world clock. Sessions parse their input on their own strands and
+// submit() the commands to a lock-free inbox; every tick moves them into
+// the sessions' CommandQueues and runs them on the scheduler's thread, then
+// runs the world systems, then hands each session that got output during
+// the tick its batch in one strand hop. Commands therefore no longer run
+// in network arrival order, and once a player has logged in its state is
+// only changed here.
+//
+// Sessions with queued commands are served round-robin in session order,
+// one command each per pass, so a long paste waits behind everyone else's
+// input instead of in front of it. A command whose class has run out of
+// tokens stays queued for a later tick.
+class TickScheduler {
+public:
+  // rate is in ticks per second.
+  explicit TickScheduler(unsigned rate);
+
+  // Runs the clock on the calling thread until stop().
+  void run();
+  void stop();
+
+  // Queues a command for the next tick. Thread-safe and lock-free; the
+  // tick drains the inbox on its own clock, so producers never wake it.
+  // Returns false, leaving command alone, when the inbox is full.
+  bool submit(std::shared_ptr<session> s, QueuedCommand &&command);
+
+  // Runs every command s has queued or in the inbox in the next tick,
+  // without waiting for tokens, and calls done after that tick's flush.
+  // For a hand-off, so commands already accepted are not lost.
+  // Thread-safe; s must have stopped submitting.
+  void finish(std::shared_ptr<session> s, std::function<void()> done);
+
+  // Commands every session together may submit in one tick.
+  static constexpr std::size_t inbox_capacity = 16384;
+
+  // World systems (NPCs, combat, regeneration) run every tick after the
+  // commands, in the order added. Add them before run().
+  void add_system(std::string name,
+                  std::function<void(std::uint64_t tick)> system);
+
+  // Whether the calling thread is inside a tick's command or system phase.
+  static bool in_tick();
+  // Called by session::enqueue in a tick when s's outbox wakes: s is
+  // flushed once, after the systems.
+  void defer_flush(std::shared_ptr<session> s);
+
+  std::chrono::nanoseconds period() const;
+
+private:
+  struct submitted {
+    std::shared_ptr<session> target;
+    QueuedCommand command;
+  };
+
+  struct finishing {
+    std::shared_ptr<session> target;
+    std::function<void()> done;
+  };
+
+  struct system {
+    std::string name;
+    std::function<void(std::uint64_t)> run;
+  };
+
+  void schedule();
+  void tick();
+  void run_commands();
+  // Empties the queues of the sessions in finishing_.
+  void finish_commands(QueuedCommand &next);
+
+  std::chrono::nanoseconds period_;
+  boost::asio::io_context io_context_;
+  boost::asio::steady_timer timer_;
+  std::chrono::steady_clock::time_point deadline_;
+  std::uint64_t ticks_ = 0;
+  utils::MpscQueue<submitted> inbox_;
+  // Sessions with queued commands, in session order.
+  std::vector<std::shared_ptr<session>> active_;
+  std::vector<system> systems_;
+  std::vector<std::shared_ptr<session>> dirty_;
+  // Tick thread only.
+  std::vector<finishing> finishing_;
+  std::vector<std::function<void()>> finished_;
+};
+
+} // namespace world
+} // namespace mud
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace mud {
+namespace world {
+
+class TimerHandle;
+
+// Delayed and recurring world events (respawns, decay, idle timeouts,
+// combat rounds) without a steady_timer each. Time is counted in ticks of
+// resolution; the server advances the wheel once per game tick, and every
+// timer due in the same tick fires in that one pass.
+//
+// Four levels of 64 slots cover 2^24 ticks (about 9 days at 20 ticks per
+// second); longer timers go round the top level again. Timers are kept in
+// intrusive lists, so schedule and cancel are O(1) whatever the number of
+// timers; longer ones move down a level once per 64^level ticks.
+//
+// Thread-safe. Callbacks run on the thread calling advance(), without the
+// wheel's lock held, so they may schedule and cancel timers themselves.
+class TimingWheel {
+public:
+  using clock = std::chrono::steady_clock;
+  using callback = std::function<void()>;
+
+  explicit TimingWheel(clock::duration resolution);
+  ~TimingWheel();
+  TimingWheel(const TimingWheel &) = delete;
+  TimingWheel &operator=(const TimingWheel &) = delete;
+
+  // Runs fn once, in the first tick at least delay from now.
+  TimerHandle schedule(clock::duration delay, callback fn);
+  // Runs fn every interval (rounded to whole ticks) until cancelled.
+  TimerHandle schedule_every(clock::duration interval, callback fn);
+
+  // Fires everything due by now. Returns the number of callbacks run.
+  std::size_t advance(clock::time_point now);
+
+  std::size_t size() const;
+  clock::duration resolution() const;
+
+  struct state;
+
+private:
+  TimerHandle add(clock::duration delay, clock::duration interval,
+                  callback fn);
+
+  std::shared_ptr<state> state_;
+};
+
+// Refers to one scheduled timer. Copyable, and safe to use after the timer
+// fired, after whatever scheduled it was destroyed, and after the wheel
+// itself is gone: every call then does nothing.
+class TimerHandle {
+public:
+  TimerHandle() = default;
+
+  // Stops the timer from firing (again). Returns whether it was pending.
+  bool cancel();
+  bool pending() const;
+
+private:
+  friend class TimingWheel;
+  TimerHandle(std::weak_ptr<TimingWheel::state> state, std::uint32_t index,
+              std::uint32_t generation);
+
+  std::weak_ptr<TimingWheel::state> state_;
+  std::uint32_t index_ = 0;
+  std::uint32_t generation_ = 0;
+};
+
+} // namespace world
+} // namespace mud
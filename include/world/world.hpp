@@ -3,22 +3,43 @@
 #include "world/room.hpp"
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace mud {
 namespace world {
 
 class World {
 public:
+  // Every map in a directory, parsed and checked but not in use yet.
+  struct Snapshot {
+    std::map<std::string, std::shared_ptr<Room>> rooms;
+    // Each room's map file as parsed, to tell which rooms a reload changed.
+    std::map<std::string, std::string> sources;
+  };
+
   World(const std::string &maps_directory);
 
+  // Throws std::runtime_error (or a json error) naming the file if a map
+  // is malformed, two maps share an id, or an exit or portal leads to a
+  // room that doesn't exist.
+  static Snapshot load(const std::string &maps_directory);
+
   void add_room(const std::string &id, std::shared_ptr<Room> room);
   std::shared_ptr<Room> get_room(const std::string &id) const;
 
-private:
-  void load_world_from_files(const std::string &maps_directory);
+  // Swaps in a reloaded set of maps. Rooms whose map is unchanged keep
+  // their Room, so players in them are not disturbed. Returns the ids of
+  // the rooms that changed or are gone; the caller moves their occupants.
+  std::vector<std::string> replace(Snapshot next);
 
+private:
+  // Rooms are read from every strand and the tick, and replaced by a
+  // reload.
+  mutable std::mutex mutex_;
   std::map<std::string, std::shared_ptr<Room>> rooms_;
+  std::map<std::string, std::string> sources_;
 };
 
 } // namespace world
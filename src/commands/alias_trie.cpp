@@ -0,0 +1,139 @@
+#include "commands/alias_trie.hpp"
+#include <algorithm>
+
+namespace mud {
+
+namespace {
+// False if text ends partway through a UTF-8 sequence.
+bool ends_on_character(std::string_view text) {
+  std::size_t lead = text.size();
+  while (lead > 0 &&
+         (static_cast<unsigned char>(text[lead - 1]) & 0xC0) == 0x80) {
+    --lead;
+  }
+  if (lead == 0) {
+    return text.empty();
+  }
+  auto c = static_cast<unsigned char>(text[lead - 1]);
+  std::size_t length = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+  return text.size() - (lead - 1) == length;
+}
+} // namespace
+
+AliasTrie::AliasTrie(
+    std::vector<std::pair<std::string, const Command *>> aliases) {
+  std::sort(aliases.begin(), aliases.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+  nodes_.emplace_back();
+  build(0, aliases, 0, aliases.size(), 0);
+}
+
+// aliases[begin, end) all share their first depth bytes, the path to
+// index. Sorted, so an alias that ends here comes first and the rest are
+// grouped by their next byte.
+void AliasTrie::build(std::uint32_t index, const alias_list &aliases,
+                      std::size_t begin, std::size_t end, std::size_t depth) {
+  const Command *only = begin < end ? aliases[begin].second : nullptr;
+  for (std::size_t i = begin; i < end; ++i) {
+    if (aliases[i].second != only) {
+      only = nullptr;
+      break;
+    }
+  }
+  nodes_[index].only = only;
+  if (begin < end && aliases[begin].first.size() == depth) {
+    nodes_[index].exact = aliases[begin].second;
+    ++begin;
+  }
+
+  // All of this node's edges go in before any child adds its own, so they
+  // stay contiguous.
+  std::vector<std::pair<std::size_t, std::size_t>> groups;
+  for (std::size_t i = begin; i < end;) {
+    auto byte = static_cast<unsigned char>(aliases[i].first[depth]);
+    std::size_t j = i + 1;
+    while (j < end && static_cast<unsigned char>(aliases[j].first[depth]) ==
+                          byte) {
+      ++j;
+    }
+    groups.emplace_back(i, j);
+    i = j;
+  }
+  nodes_[index].first_edge = static_cast<std::uint32_t>(edges_.size());
+  nodes_[index].edge_count = static_cast<std::uint32_t>(groups.size());
+  for (const auto &[first, last] : groups) {
+    edges_.push_back({static_cast<unsigned char>(aliases[first].first[depth]),
+                      static_cast<std::uint32_t>(nodes_.size())});
+    nodes_.emplace_back();
+  }
+  for (std::size_t g = 0; g < groups.size(); ++g) {
+    build(edges_[nodes_[index].first_edge + g].child, aliases, groups[g].first,
+          groups[g].second, depth + 1);
+  }
+}
+
+std::int64_t AliasTrie::walk(std::string_view text) const {
+  if (nodes_.empty()) {
+    return -1;
+  }
+  std::uint32_t index = 0;
+  for (unsigned char c : text) {
+    const auto &n = nodes_[index];
+    auto first = edges_.begin() + n.first_edge;
+    auto last = first + n.edge_count;
+    auto it = std::lower_bound(
+        first, last, c, [](const edge &e, unsigned char b) { return e.byte < b; });
+    if (it == last || it->byte != c) {
+      return -1;
+    }
+    index = it->child;
+  }
+  return index;
+}
+
+AliasMatch AliasTrie::match(std::string_view text) const {
+  if (text.empty()) {
+    return {};
+  }
+  auto index = walk(text);
+  if (index < 0) {
+    return {};
+  }
+  const auto &n = nodes_[static_cast<std::size_t>(index)];
+  if (n.exact) {
+    return {AliasMatch::kind::exact, n.exact};
+  }
+  if (!ends_on_character(text)) {
+    return {};
+  }
+  if (n.only) {
+    return {AliasMatch::kind::prefix, n.only};
+  }
+  return {AliasMatch::kind::ambiguous, nullptr};
+}
+
+std::vector<std::string> AliasTrie::completions(std::string_view text) const {
+  std::vector<std::string> out;
+  auto index = walk(text);
+  if (index < 0) {
+    return out;
+  }
+  std::string prefix(text);
+  collect(static_cast<std::uint32_t>(index), prefix, out);
+  return out;
+}
+
+void AliasTrie::collect(std::uint32_t index, std::string &prefix,
+                        std::vector<std::string> &out) const {
+  const auto &n = nodes_[index];
+  if (n.exact) {
+    out.push_back(prefix);
+  }
+  for (std::uint32_t e = n.first_edge; e < n.first_edge + n.edge_count; ++e) {
+    prefix.push_back(static_cast<char>(edges_[e].byte));
+    collect(edges_[e].child, prefix, out);
+    prefix.pop_back();
+  }
+}
+
+} // namespace mud
@@ -0,0 +1,102 @@
+#include "commands/command_args.hpp"
+#include <cstring>
+
+namespace mud {
+
+namespace {
+// The same set as std::isspace in the "C" locale, without the locale
+// lookup.
+bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+         c == '\r';
+}
+
+std::string_view trim(std::string_view text) {
+  std::size_t begin = 0;
+  while (begin < text.size() && is_space(text[begin])) {
+    ++begin;
+  }
+  std::size_t end = text.size();
+  while (end > begin && is_space(text[end - 1])) {
+    --end;
+  }
+  return text.substr(begin, end - begin);
+}
+} // namespace
+
+CommandLine split_command(std::string_view line) {
+  line = trim(line);
+  std::size_t end = 0;
+  while (end < line.size() && !is_space(line[end])) {
+    ++end;
+  }
+  return {line.substr(0, end), trim(line.substr(end))};
+}
+
+CommandArgs::CommandArgs(std::string_view text) {
+  text = trim(text);
+  char *buffer = allocate(text.size());
+  std::memcpy(buffer, text.data(), text.size());
+  std::size_t i = 0;
+  while (i < text.size() && count_ < max_args) {
+    std::size_t begin = i;
+    while (i < text.size() && !is_space(text[i])) {
+      ++i;
+    }
+    spans_[count_++] = {static_cast<std::uint32_t>(begin),
+                        static_cast<std::uint32_t>(i - begin)};
+    while (i < text.size() && is_space(text[i])) {
+      ++i;
+    }
+  }
+}
+
+CommandArgs::CommandArgs(const std::vector<std::string> &args) {
+  std::size_t length = 0;
+  for (const auto &arg : args) {
+    length += arg.size() + 1;
+  }
+  char *buffer = allocate(length > 0 ? length - 1 : 0);
+  std::size_t offset = 0;
+  for (const auto &arg : args) {
+    if (offset > 0) {
+      buffer[offset++] = ' ';
+    }
+    std::memcpy(buffer + offset, arg.data(), arg.size());
+    if (count_ < max_args) {
+      spans_[count_++] = {static_cast<std::uint32_t>(offset),
+                          static_cast<std::uint32_t>(arg.size())};
+    }
+    offset += arg.size();
+  }
+}
+
+char *CommandArgs::allocate(std::size_t length) {
+  length_ = static_cast<std::uint32_t>(length);
+  if (length <= inline_bytes) {
+    return inline_.data();
+  }
+  heap_ = std::make_unique<char[]>(length);
+  return heap_.get();
+}
+
+const char *CommandArgs::data() const {
+  return heap_ ? heap_.get() : inline_.data();
+}
+
+std::size_t CommandArgs::size() const { return count_; }
+
+bool CommandArgs::empty() const { return count_ == 0; }
+
+std::string_view CommandArgs::operator[](std::size_t i) const {
+  return {data() + spans_[i].offset, spans_[i].length};
+}
+
+std::string_view CommandArgs::rest(std::size_t first) const {
+  if (first >= count_) {
+    return {};
+  }
+  return {data() + spans_[first].offset, length_ - spans_[first].offset};
+}
+
+} // namespace mud
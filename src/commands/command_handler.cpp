@@ -1,106 +1,129 @@
 #include "commands/command_handler.hpp"
+#include "network/handler_memory.hpp"
 #include "network/session.hpp"
 #include "network/server.hpp"
 #include "players/player.hpp"
 #include "utils/color.hpp"
 #include "utils/logger.hpp"
+#include "utils/metrics.hpp"
 #include "world/room.hpp"
+#include <iomanip>
+#include <sstream>
 
 namespace mud {
 
 // Helper function from session.cpp
 void look_at_tile(session *s);
 
-CommandHandler::CommandHandler(session &s) : session_(s) { setup_commands(); }
+namespace {
+struct named_handler {
+  const char *name;
+  CommandFunction function;
+};
+} // namespace
 
-void CommandHandler::handle(const std::string &command,
-                            const std::vector<std::string> &args) {
-  auto it = commands_.find(command);
-  if (it != commands_.end()) {
-    it->second(args);
-  } else {
-    session_.deliver("Command not implemented: " + command);
+CommandFunction CommandHandler::find(std::string_view name) {
+  static const named_handler handlers[] = {
+      {"QUIT", &CommandHandler::quit},
+      {"LOOK", &CommandHandler::look},
+      {"NORTH", &CommandHandler::north},
+      {"SOUTH", &CommandHandler::south},
+      {"EAST", &CommandHandler::east},
+      {"WEST", &CommandHandler::west},
+      {"MOVE", &CommandHandler::move_to},
+      {"SAY", &CommandHandler::say},
+      {"SHOUT", &CommandHandler::shout},
+      {"WHISPER", &CommandHandler::whisper},
+      {"CLEAR", &CommandHandler::clear},
+      {"INTERACT", &CommandHandler::interact},
+      {"WHO", &CommandHandler::who},
+      {"STATS", &CommandHandler::stats},
+  };
+  for (const auto &h : handlers) {
+    if (name == h.name) {
+      return h.function;
+    }
   }
+  return nullptr;
 }
 
-void CommandHandler::setup_commands() {
-  commands_["QUIT"] =
-      std::bind(&CommandHandler::quit, this, std::placeholders::_1);
-  commands_["LOOK"] =
-      std::bind(&CommandHandler::look, this, std::placeholders::_1);
-  commands_["NORTH"] = [this](const auto &args) { move(0, -1); };
-  commands_["SOUTH"] = [this](const auto &args) { move(0, 1); };
-  commands_["EAST"] = [this](const auto &args) { move(1, 0); };
-  commands_["WEST"] = [this](const auto &args) { move(-1, 0); };
-  commands_["MOVE"] =
-      std::bind(&CommandHandler::move_to, this, std::placeholders::_1);
-  commands_["SAY"] =
-      std::bind(&CommandHandler::say, this, std::placeholders::_1);
-  commands_["SHOUT"] =
-      std::bind(&CommandHandler::shout, this, std::placeholders::_1);
-  commands_["WHISPER"] =
-      std::bind(&CommandHandler::whisper, this, std::placeholders::_1);
-  commands_["CLEAR"] =
-      std::bind(&CommandHandler::clear, this, std::placeholders::_1);
-  commands_["INTERACT"] =
-      std::bind(&CommandHandler::interact, this, std::placeholders::_1);
+void CommandHandler::quit(session &s, const CommandArgs &args) {
+  s.stop();
 }
 
-void CommandHandler::quit(const std::vector<std::string> &args) {
-  session_.stop();
-}
-
-void CommandHandler::look(const std::vector<std::string> &args) {
-  auto player = session_.get_player();
-  if (!player || !player->get_room()) {
-    session_.deliver(utils::color::system("You are lost in the void."));
+void CommandHandler::look(session &s, const CommandArgs &args) {
+  auto player = s.get_player();
+  auto [room, x, y] = player ? player->get_location() : Player::Location{};
+  if (!room) {
+    s.deliver(utils::color::system("You are lost in the void."));
     return;
   }
-  auto room = player->get_room();
-  session_.deliver(
+  s.deliver(
       "========================================");
-  session_.deliver(
-      room->get_name() + " (" + std::to_string(player->get_x()) + ", " +
-      std::to_string(player->get_y()) + ")");
-  session_.deliver(room->get_description());
-  look_at_tile(&session_);
-  session_.deliver(
+  s.deliver(
+      room->get_name() + " (" + std::to_string(x) + ", " +
+      std::to_string(y) + ")");
+  s.deliver(room->get_description());
+  look_at_tile(&s);
+  s.deliver(
       "========================================");
 }
 
-void CommandHandler::move(int dx, int dy) {
-  auto player = session_.get_player();
-  if (!player || !player->get_room()) {
-    session_.deliver(utils::color::system("You can't move."));
+void CommandHandler::north(session &s, const CommandArgs &args) {
+  move(s, 0, -1);
+}
+
+void CommandHandler::south(session &s, const CommandArgs &args) {
+  move(s, 0, 1);
+}
+
+void CommandHandler::east(session &s, const CommandArgs &args) {
+  move(s, 1, 0);
+}
+
+void CommandHandler::west(session &s, const CommandArgs &args) {
+  move(s, -1, 0);
+}
+
+void CommandHandler::move(session &s, int dx, int dy) {
+  auto player = s.get_player();
+  auto [room, x, y] = player ? player->get_location() : Player::Location{};
+  if (!room) {
+    s.deliver(utils::color::system("You can't move."));
     return;
   }
-  auto room = player->get_room();
-  int new_x = player->get_x() + dx;
-  int new_y = player->get_y() + dy;
+  int new_x = x + dx;
+  int new_y = y + dy;
 
   if (new_x >= 0 && new_x < room->get_width() && new_y >= 0 &&
       new_y < room->get_height()) {
     player->set_location(room, new_x, new_y);
-    session_.deliver(utils::color::tag(
-        "move", utils::color::MOVE,
-        "You moved to (" + std::to_string(new_x) + ", " +
-            std::to_string(new_y) + ")."));
-    look_at_tile(&session_);
+    // GMCP Char and binary clients already got Char.Position.
+    s.deliver_unless_gmcp(
+        "char", utils::color::tag("move", utils::color::MOVE,
+                                  "You moved to (" + std::to_string(new_x) +
+                                      ", " + std::to_string(new_y) + ")."));
+    look_at_tile(&s);
   } else {
-    session_.deliver(utils::color::system("You can't go that way."));
+    s.deliver(utils::color::system("You can't go that way."));
   }
 }
 
-void CommandHandler::move_to(const std::vector<std::string> &args) {
+void CommandHandler::move_to(session &s, const CommandArgs &args) {
   if (args.empty()) {
-    session_.deliver(
+    s.deliver(
         utils::color::system("Move to where? (e.g., /m 5,5)"));
     return;
   }
-  std::string coords = args[0];
+  // Binary clients send x and y as two integer arguments.
+  std::string coords(args[0]);
+  if (args.size() >= 2) {
+    coords += ",";
+    coords += args[1];
+  }
   size_t comma_pos = coords.find(',');
   if (comma_pos == std::string::npos) {
-    session_.deliver(
+    s.deliver(
         utils::color::system("Invalid format. Use x,y (e.g., /m 5,5)"));
     return;
   }
@@ -108,155 +131,211 @@ void CommandHandler::move_to(const std::vector<std::string> &args) {
     int x = std::stoi(coords.substr(0, comma_pos));
     int y = std::stoi(coords.substr(comma_pos + 1));
 
-    auto player = session_.get_player();
+    auto player = s.get_player();
     auto room = player->get_room();
     if (x >= 0 && x < room->get_width() && y >= 0 && y < room->get_height()) {
       player->set_location(room, x, y);
-      session_.deliver(utils::color::move(
-          "You moved to (" + std::to_string(x) + ", " +
-              std::to_string(y) + ")."));
-      look_at_tile(&session_);
+      s.deliver_unless_gmcp(
+          "char", utils::color::move("You moved to (" + std::to_string(x) +
+                                     ", " + std::to_string(y) + ")."));
+      look_at_tile(&s);
     } else {
-      session_.deliver(utils::color::system("You can't move there."));
+      s.deliver(utils::color::system("You can't move there."));
     }
   } catch (const std::exception &) {
-    session_.deliver(utils::color::system("Invalid coordinates."));
+    s.deliver(utils::color::system("Invalid coordinates."));
   }
 }
 
-void CommandHandler::say(const std::vector<std::string> &args) {
-  auto player = session_.get_player();
+void CommandHandler::say(session &s, const CommandArgs &args) {
+  auto player = s.get_player();
   if (!player || !player->get_room()) {
-    session_.deliver(
+    s.deliver(
         utils::color::system("You are not in a room to speak."));
     return;
   }
   if (args.empty()) {
-    session_.deliver(utils::color::system("What do you want to say?"));
+    s.deliver(utils::color::system("What do you want to say?"));
     return;
   }
 
-  std::string message;
-  for (size_t i = 0; i < args.size(); ++i) {
-    message += args[i] + (i == args.size() - 1 ? "" : " ");
-  }
-  std::string formatted_message = utils::color::say(player->get_name() + ": " + message);
+  std::string message(args.rest());
+  auto formatted_message =
+      make_message(utils::color::say(player->get_name() + ": " + message));
   utils::Logger::instance().log("say: " + player->get_name() + ": " + message);
-  session_.deliver(formatted_message);
-  session_.get_server().broadcast_to_room(formatted_message, player->get_room(),
-                                          session_.shared_from_this());
+  s.deliver(formatted_message);
+  s.get_server().get_bus().publish(
+      topic::room(player->get_room()->get_id()), formatted_message,
+      s.shared_from_this());
 }
 
-void CommandHandler::shout(const std::vector<std::string> &args) {
-  auto player = session_.get_player();
+void CommandHandler::shout(session &s, const CommandArgs &args) {
+  auto player = s.get_player();
   if (!player) return;
   if (args.empty()) {
-    session_.deliver(utils::color::system("What do you want to shout?"));
+    s.deliver(utils::color::system("What do you want to shout?"));
     return;
   }
-  std::string message;
-  for (size_t i = 0; i < args.size(); ++i) {
-    message += args[i] + (i == args.size() - 1 ? "" : " ");
-  }
+  std::string message(args.rest());
   std::string formatted_message = utils::color::shout(
       player->get_name() + ": " + message);
   utils::Logger::instance().log("shout: " + player->get_name() + ": " + message);
-  session_.get_server().broadcast(formatted_message);
+  s.get_server().get_bus().publish(topic::global(),
+                                   make_message(formatted_message));
 }
 
-void CommandHandler::whisper(const std::vector<std::string> &args) {
-  auto player = session_.get_player();
+void CommandHandler::whisper(session &s, const CommandArgs &args) {
+  auto player = s.get_player();
   if (!player)
     return;
   if (args.size() < 2) {
-    session_.deliver(utils::color::system(
+    s.deliver(utils::color::system(
         "Who do you want to whisper to and what? (e.g., /w <player> <msg>)"));
     return;
   }
 
-  std::string target_name = args[0];
-
-  std::string message;
-  for (size_t i = 1; i < args.size(); ++i) {
-    message += args[i] + (i == args.size() - 1 ? "" : " ");
-  }
-
-  auto target_player = session_.get_server().get_player_by_name(target_name);
-
-  if (!target_player) {
-    session_.deliver(utils::color::system("Player not found: " + target_name));
-    return;
-  }
+  std::string target_name(args[0]);
+  std::string message(args.rest(1));
 
   std::string to_target_msg =
       utils::color::whisper(player->get_name() + ": " + message);
-  target_player->send_message(to_target_msg);
-
   std::string to_self_msg =
       utils::color::whisper("To " + target_name + ": " + message);
-  session_.deliver(to_self_msg);
+
+  // The count comes back on the topic's owner shard; deliver() hops onto
+  // our strand itself.
+  auto self = s.shared_from_this();
+  event_bus::event e{topic::player(target_name), make_message(to_target_msg)};
+  e.lane = message_lane::priority;
+  e.delivered = [self, target_name, to_self_msg](std::size_t delivered) {
+    if (delivered == 0) {
+      self->deliver(utils::color::system("Player not found: " + target_name));
+      return;
+    }
+    self->deliver(to_self_msg);
+  };
+  s.get_server().get_bus().publish(std::move(e));
 }
 
-void CommandHandler::clear(const std::vector<std::string> &args) {
+void CommandHandler::clear(session &s, const CommandArgs &args) {
   // ANSI escape code to clear screen and move cursor to top-left
-  session_.deliver("\033[2J\033[H");
+  s.deliver(utils::color::CLEAR_SCREEN);
 }
 
-void CommandHandler::interact(const std::vector<std::string> &args) {
-  auto player = session_.get_player();
-  if (!player || !player->get_room()) {
-    session_.deliver(utils::color::system("You are not in a room to interact."));
+void CommandHandler::interact(session &s, const CommandArgs &args) {
+  auto player = s.get_player();
+  auto [room, x, y] = player ? player->get_location() : Player::Location{};
+  if (!room) {
+    s.deliver(utils::color::system("You are not in a room to interact."));
     return;
   }
-  
-  auto room = player->get_room();
-  int x = player->get_x();
-  int y = player->get_y();
+
   const auto &tile = room->get_tile(x, y);
 
   bool did_interact = false;
 
   if (tile.objects.empty() && !tile.portal) {
-    session_.deliver(utils::color::system("There is nothing to interact with here."));
+    s.deliver(utils::color::system("There is nothing to interact with here."));
     return;
   }
 
   for (const auto &obj : tile.objects) {
-    session_.deliver(utils::color::event("You interact with " + obj.name + "."));
+    s.deliver(utils::color::event("You interact with " + obj.name + "."));
     if (obj.type == "npc") {
-      session_.deliver(utils::color::event(obj.name + " says: Hello there!"));
+      s.deliver(utils::color::event(obj.name + " says: Hello there!"));
       // Add NPC interaction logic here
     } else if (obj.type == "item") {
-      session_.deliver(utils::color::event("You pick up the " + obj.name + "."));
+      s.deliver(utils::color::event("You pick up the " + obj.name + "."));
       // Add item pickup logic here
     } else {
-      session_.deliver(utils::color::event("You examine the " + obj.name + ": " + obj.description));
+      s.deliver(utils::color::event("You examine the " + obj.name + ": " + obj.description));
     }
     did_interact = true;
     // Add more interaction logic here
   }
 
   if (tile.portal) {
-    // session_.deliver(utils::color::portal("You use the portal."));
+    // s.deliver(utils::color::portal("You use the portal."));
 
     // player location to portal target
-    auto target_room = session_.get_server().get_world().get_room(tile.portal->target_map);
+    auto target_room = s.get_server().get_world().get_room(tile.portal->target_map);
     if (target_room) {
         player->set_location(target_room, tile.portal->target_x, tile.portal->target_y);
-        session_.deliver("\n" + utils::color::system("You arrive at " + target_room->get_name() + "." + 
+        s.deliver("\n" + utils::color::system("You arrive at " + target_room->get_name() + "." + 
             " (" + std::to_string(tile.portal->target_x) + ", " + std::to_string(tile.portal->target_y) + ")"));
-        // look_at_tile(&session_);
+        // look_at_tile(&s);
         // use look command to show room info
-        handle({"LOOK"}, {});
+        look(s, {});
     } else {
-        session_.deliver(utils::color::system("The portal seems to be malfunctioning."));
+        s.deliver(utils::color::system("The portal seems to be malfunctioning."));
     }
     
     did_interact = true;
   }
 
   if (!did_interact) {
-    session_.deliver(utils::color::system("There is nothing to interact with here."));
+    s.deliver(utils::color::system("There is nothing to interact with here."));
+  }
+}
+
+void CommandHandler::who(session &s, const CommandArgs &args) {
+  auto player = s.get_player();
+  if (!player || !player->get_room()) {
+    s.deliver(utils::color::system("You are lost in the void."));
+    return;
+  }
+  auto self = s.shared_from_this();
+  s.get_server().get_bus().get_subscriber_names(
+      topic::room(player->get_room()->get_id()),
+      [self](std::vector<std::string> names) {
+        std::string list;
+        for (size_t i = 0; i < names.size(); ++i) {
+          list += names[i] + (i == names.size() - 1 ? "" : ", ");
+        }
+        self->deliver(utils::color::system(
+            "Players here (" + std::to_string(names.size()) + "): " + list));
+      });
+}
+
+void CommandHandler::stats(session &s, const CommandArgs &args) {
+  s.deliver(
+      utils::color::system("Server (" + std::string(server::io_backend()) +
+                           ") " + utils::Metrics::instance().report()));
+  s.deliver(
+      utils::color::system("Handler memory " + handler_memory::report()));
+  // The connection's own counters belong to its strand, and commands run
+  // on the tick thread.
+  s.post([self = s.shared_from_this()] { connection_stats(*self); });
+}
+
+void CommandHandler::connection_stats(session &s) {
+  const auto &queue = s.get_output_queue();
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(2)
+     << "Your connection messages/write: "
+     << s.average_messages_per_write()
+     << ", queued: " << queue.queued_messages() << " ("
+     << queue.queued_bytes() << " bytes)"
+     << ", dropped: " << queue.dropped()
+     << ", collapsed: " << queue.collapsed();
+  s.deliver(utils::color::system(ss.str()));
+
+  const auto &compressor = s.get_compressor();
+  if (compressor.active()) {
+    std::ostringstream mccp;
+    mccp << std::fixed << std::setprecision(2) << "MCCP2: "
+         << compressor.bytes_in() << " -> " << compressor.bytes_out()
+         << " bytes (" << compressor.ratio() << "x, "
+         << compressor.cpu_time().count() / 1000000.0 << " ms)";
+    s.deliver(utils::color::system(mccp.str()));
+  }
+  const auto &telnet = s.get_telnet();
+  if (!telnet.terminal_type().empty() || telnet.width() > 0) {
+    s.deliver(utils::color::system(
+        "Terminal: " +
+        (telnet.terminal_type().empty() ? "unknown" : telnet.terminal_type()) +
+        " " + std::to_string(telnet.width()) + "x" +
+        std::to_string(telnet.height())));
   }
 }
 } // namespace mud
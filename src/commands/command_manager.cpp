@@ -1,34 +1,115 @@
 #include "commands/command_manager.hpp"
+#include "commands/command_handler.hpp"
 #include <nlohmann/json.hpp>
 #include <fstream>
+#include <map>
+#include <stdexcept>
+#include <utility>
 
 namespace mud {
 
 using json = nlohmann::json;
 
-CommandManager::CommandManager(const std::string &command_file_path) {
-  load_commands(command_file_path);
+CommandManager::CommandManager(const std::string &command_file_path,
+                               const CommandManager *previous) {
+  load_commands(command_file_path, previous);
 }
 
-void CommandManager::load_commands(const std::string &command_file_path) {
+void CommandManager::load_commands(const std::string &command_file_path,
+                                   const CommandManager *previous) {
   std::ifstream f(command_file_path);
+  if (!f) {
+    throw std::runtime_error("Cannot open " + command_file_path);
+  }
   json data = json::parse(f);
 
+  max_queued_ = data.value("max_queued", max_queued_);
+  std::map<std::string, int> class_index;
+  if (previous) {
+    // Kept in place even if the file dropped them; nothing refers to
+    // those any more.
+    for (const auto &c : previous->classes_) {
+      class_index[c.name] = static_cast<int>(classes_.size());
+      classes_.push_back(c);
+    }
+  }
+  if (data.contains("classes")) {
+    for (const auto &[name, limit] : data["classes"].items()) {
+      CommandClass c{name, limit.value("rate", 1.0), limit.value("burst", 1.0)};
+      // A bucket that never refills, or never holds a whole token, would
+      // hold every queued command forever.
+      if (!(c.rate > 0) || !(c.burst >= 1)) {
+        throw std::runtime_error("Class " + name +
+                                 " needs rate > 0 and burst >= 1");
+      }
+      auto [it, added] =
+          class_index.emplace(name, static_cast<int>(classes_.size()));
+      if (added) {
+        classes_.push_back(c);
+      } else {
+        classes_[it->second] = c;
+      }
+    }
+  }
+
+  std::vector<Command> commands;
+  std::map<std::string, std::size_t> alias_index;
+  std::map<std::uint16_t, std::string> id_owner;
   for (const auto &command_data : data["commands"]) {
-    std::string canonical_name = command_data["name"];
-    for (const auto &alias : command_data["aliases"]) {
-      alias_to_command_[alias] = canonical_name;
+    Command command;
+    command.name = command_data["name"];
+    command.id = command_data.value("id", std::uint16_t(0));
+    if (command.id != 0 && !id_owner.emplace(command.id, command.name).second) {
+      throw std::runtime_error(command.name + " and " + id_owner[command.id] +
+                               " both have id " + std::to_string(command.id));
+    }
+    if (command_data.contains("class")) {
+      auto name = command_data["class"].get<std::string>();
+      auto it = class_index.find(name);
+      if (it == class_index.end()) {
+        throw std::runtime_error(command.name + " has unknown class " + name);
+      }
+      command.command_class = it->second;
+      command.limit = &classes_[it->second];
     }
+    command.handler = CommandHandler::find(command.name);
+    command.abbreviate = command_data.value("abbreviate", true);
+    for (const auto &alias_data : command_data["aliases"]) {
+      auto alias = alias_data.get<std::string>();
+      auto [it, added] = alias_index.emplace(alias, commands.size());
+      if (!added) {
+        throw std::runtime_error("Alias " + alias + " is used by " +
+                                 command.name + " and " +
+                                 commands[it->second].name);
+      }
+    }
+    commands.push_back(std::move(command));
   }
+  table_ = CommandTable(std::move(commands),
+                        {alias_index.begin(), alias_index.end()});
 }
 
-std::string
-CommandManager::get_canonical_command(const std::string &alias) const {
-  auto it = alias_to_command_.find(alias);
-  if (it != alias_to_command_.end()) {
-    return it->second;
-  }
-  return ""; // Not found
+const Command *CommandManager::find_command(std::string_view alias) const {
+  return table_.find(alias);
 }
 
+AliasMatch CommandManager::match_command(std::string_view text) const {
+  return table_.match(text);
+}
+
+std::vector<std::string>
+CommandManager::complete_command(std::string_view text) const {
+  return table_.completions(text);
+}
+
+const Command *CommandManager::find_command(std::uint16_t id) const {
+  return table_.find(id);
+}
+
+const std::vector<CommandClass> &CommandManager::get_command_classes() const {
+  return classes_;
+}
+
+std::size_t CommandManager::get_max_queued() const { return max_queued_; }
+
 } // namespace mud
@@ -0,0 +1,88 @@
+#include "commands/command_queue.hpp"
+#include "utils/metrics.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace mud {
+
+bool CommandQueue::reserve(std::size_t max_queued) {
+  std::size_t depth = pending_.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (depth > max_queued) {
+    pending_.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  auto &metrics = utils::Metrics::instance();
+  metrics.commands_queued.fetch_add(1, std::memory_order_relaxed);
+  auto deepest = metrics.command_queue_peak.load(std::memory_order_relaxed);
+  while (depth > deepest && !metrics.command_queue_peak.compare_exchange_weak(
+                                deepest, depth, std::memory_order_relaxed)) {
+  }
+  return true;
+}
+
+void CommandQueue::release() {
+  pending_.fetch_sub(1, std::memory_order_relaxed);
+  utils::Metrics::instance().commands_queued.fetch_sub(
+      1, std::memory_order_relaxed);
+}
+
+void CommandQueue::push(QueuedCommand &&command) {
+  queue_.push_back(std::move(command));
+}
+
+CommandQueue::pop_result CommandQueue::pop(clock::time_point now,
+                                           QueuedCommand &out) {
+  if (queue_.empty()) {
+    return pop_result::empty;
+  }
+  if (!take_token(*queue_.front().command, now)) {
+    return pop_result::throttled;
+  }
+  out = std::move(queue_.front());
+  queue_.pop_front();
+  release();
+  return pop_result::ready;
+}
+
+bool CommandQueue::pop_now(QueuedCommand &out) {
+  if (queue_.empty()) {
+    return false;
+  }
+  out = std::move(queue_.front());
+  queue_.pop_front();
+  release();
+  return true;
+}
+
+bool CommandQueue::take_token(const Command &command, clock::time_point now) {
+  if (command.command_class < 0 || !command.limit) {
+    return true;
+  }
+  const auto &limit = *command.limit;
+  auto index = static_cast<std::size_t>(command.command_class);
+  if (index >= buckets_.size()) {
+    buckets_.resize(index + 1);
+  }
+  auto &b = buckets_[index];
+  if (b.refilled == clock::time_point{}) {
+    b.tokens = limit.burst;
+  } else {
+    std::chrono::duration<double> elapsed = now - b.refilled;
+    b.tokens = std::min(limit.burst, b.tokens + elapsed.count() * limit.rate);
+  }
+  b.refilled = now;
+  if (b.tokens < 1.0) {
+    return false;
+  }
+  b.tokens -= 1.0;
+  return true;
+}
+
+void CommandQueue::clear() {
+  while (!queue_.empty()) {
+    queue_.pop_front();
+    release();
+  }
+}
+
+} // namespace mud
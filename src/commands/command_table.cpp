@@ -0,0 +1,140 @@
+#include "commands/command_table.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace mud {
+
+namespace {
+// FNV-1a with a murmur3 finaliser, so different seeds give unrelated
+// hashes of the same key.
+std::uint32_t hash(std::string_view key, std::uint32_t seed) {
+  std::uint32_t h = 2166136261u ^ seed;
+  for (unsigned char c : key) {
+    h ^= c;
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+// Seeds tried per bucket before the table is rebuilt with more slots.
+constexpr std::uint32_t max_displacement = 1u << 16;
+} // namespace
+
+CommandTable::CommandTable(
+    std::vector<Command> commands,
+    const std::vector<std::pair<std::string, std::size_t>> &aliases)
+    : commands_(std::move(commands)) {
+  for (const auto &command : commands_) {
+    if (command.id == 0) {
+      continue;
+    }
+    if (command.id >= by_id_.size()) {
+      by_id_.resize(command.id + 1u, nullptr);
+    }
+    by_id_[command.id] = &command;
+  }
+  std::vector<std::pair<std::string, const Command *>> entries;
+  entries.reserve(aliases.size());
+  for (const auto &[alias, command] : aliases) {
+    if (command >= commands_.size()) {
+      throw std::out_of_range("Alias " + alias + " names no command");
+    }
+    if (commands_[command].abbreviate) {
+      entries.emplace_back(alias, &commands_[command]);
+    }
+  }
+  trie_ = AliasTrie(std::move(entries));
+  if (aliases.empty()) {
+    return;
+  }
+
+  std::size_t bucket_count = std::max<std::size_t>(aliases.size() / 2, 1);
+  std::vector<std::vector<std::size_t>> buckets(bucket_count);
+  for (std::size_t i = 0; i < aliases.size(); ++i) {
+    buckets[hash(aliases[i].first, 0) % bucket_count].push_back(i);
+  }
+  // Fullest buckets first, while most slots are still free.
+  std::vector<std::size_t> order(bucket_count);
+  for (std::size_t b = 0; b < bucket_count; ++b) {
+    order[b] = b;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&buckets](std::size_t a, std::size_t b) {
+                     return buckets[a].size() > buckets[b].size();
+                   });
+
+  for (std::size_t slot_count = aliases.size();;
+       slot_count += slot_count / 4 + 1) {
+    displacements_.assign(bucket_count, 0);
+    slots_.assign(slot_count, {});
+    std::vector<bool> taken(slot_count, false);
+    std::vector<std::size_t> placed;
+    bool complete = true;
+    for (std::size_t b : order) {
+      const auto &keys = buckets[b];
+      if (keys.empty()) {
+        break;
+      }
+      std::uint32_t seed = 1;
+      for (; seed < max_displacement; ++seed) {
+        placed.clear();
+        for (std::size_t key : keys) {
+          std::size_t s = hash(aliases[key].first, seed) % slot_count;
+          if (taken[s] ||
+              std::find(placed.begin(), placed.end(), s) != placed.end()) {
+            break;
+          }
+          placed.push_back(s);
+        }
+        if (placed.size() == keys.size()) {
+          break;
+        }
+      }
+      if (seed == max_displacement) {
+        complete = false;
+        break;
+      }
+      displacements_[b] = seed;
+      for (std::size_t i = 0; i < keys.size(); ++i) {
+        const auto &[alias, command] = aliases[keys[i]];
+        taken[placed[i]] = true;
+        slots_[placed[i]] = {alias, &commands_[command]};
+      }
+    }
+    if (complete) {
+      return;
+    }
+  }
+}
+
+const Command *CommandTable::find(std::string_view alias) const {
+  if (slots_.empty()) {
+    return nullptr;
+  }
+  std::uint32_t seed = displacements_[hash(alias, 0) % displacements_.size()];
+  const auto &s = slots_[hash(alias, seed) % slots_.size()];
+  return s.command && s.alias == alias ? s.command : nullptr;
+}
+
+const Command *CommandTable::find(std::uint16_t id) const {
+  return id < by_id_.size() ? by_id_[id] : nullptr;
+}
+
+AliasMatch CommandTable::match(std::string_view text) const {
+  if (const auto *command = find(text)) {
+    return {AliasMatch::kind::exact, command};
+  }
+  return trie_.match(text);
+}
+
+std::vector<std::string>
+CommandTable::completions(std::string_view text) const {
+  return trie_.completions(text);
+}
+
+} // namespace mud
@@ -1,13 +1,20 @@
 #include "network/server.hpp"
 #include <boost/asio.hpp>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <string>
+#include <thread>
+#if defined(_WIN32)
 #include <windows.h>
+#endif
 
 using boost::asio::ip::tcp;
 
 void enable_ansi_escape_codes() {
+#if defined(_WIN32)
   HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
   if (hOut == INVALID_HANDLE_VALUE) {
     return;
@@ -20,24 +27,91 @@ void enable_ansi_escape_codes() {
   if (!SetConsoleMode(hOut, dwMode)) {
     return;
   }
+#endif
 }
 
 int main(int argc, char *argv[]) {
   enable_ansi_escape_codes();
   try {
-    if (argc != 2) {
-      std::cerr << "Usage: mud_server <port>\n";
+    if (argc < 2) {
+      std::cerr << "Usage: mud_server <port> [threads] [--sharded]\n"
+                   "         [--slow-consumer=drop|collapse|disconnect]\n"
+                   "         [--output-budget=<bytes>] [--output-messages=<n>]\n"
+                   "         [--output-grace=<seconds>]\n"
+                   "         [--priority-budget=<bytes>] [--no-telnet]\n"
+                   "         [--binary-port=<port>] [--handoff=<unix socket>]\n"
+                   "         [--tick-rate=<ticks per second, 0 for none>]\n"
+                   "         [--no-reload] [--drain-timeout=<seconds>]\n";
       return 1;
     }
 
+    mud::server_options options;
+    options.threads = std::thread::hardware_concurrency();
+    for (int i = 2; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg == "--sharded") {
+        options.mode = mud::io_mode::sharded;
+      } else if (arg == "--no-telnet") {
+        options.telnet = false;
+      } else if (arg == "--no-reload") {
+        options.reload = false;
+      } else if (arg == "--slow-consumer=drop") {
+        options.output.policy = mud::slow_consumer_policy::drop_chat;
+      } else if (arg == "--slow-consumer=collapse") {
+        options.output.policy = mud::slow_consumer_policy::collapse_repeats;
+      } else if (arg == "--slow-consumer=disconnect") {
+        options.output.policy = mud::slow_consumer_policy::disconnect;
+      } else if (arg.rfind("--binary-port=", 0) == 0) {
+        options.binary_port = static_cast<unsigned short>(
+            std::strtoul(arg.c_str() + std::strlen("--binary-port="), nullptr, 10));
+      } else if (arg.rfind("--tick-rate=", 0) == 0) {
+        options.tick_rate = static_cast<unsigned>(
+            std::strtoul(arg.c_str() + std::strlen("--tick-rate="), nullptr, 10));
+      } else if (arg.rfind("--handoff=", 0) == 0) {
+        options.handoff_path = arg.substr(std::strlen("--handoff="));
+      } else if (arg.rfind("--output-budget=", 0) == 0) {
+        options.output.max_bytes =
+            std::strtoul(arg.c_str() + std::strlen("--output-budget="), nullptr, 10);
+      } else if (arg.rfind("--drain-timeout=", 0) == 0) {
+        options.drain_timeout = std::chrono::seconds(
+            std::strtoul(arg.c_str() + std::strlen("--drain-timeout="), nullptr, 10));
+      } else if (arg.rfind("--output-messages=", 0) == 0) {
+        options.output.max_messages =
+            std::strtoul(arg.c_str() + std::strlen("--output-messages="), nullptr, 10);
+      } else if (arg.rfind("--output-grace=", 0) == 0) {
+        options.output.grace = std::chrono::seconds(
+            std::strtoul(arg.c_str() + std::strlen("--output-grace="), nullptr, 10));
+      } else if (arg.rfind("--priority-budget=", 0) == 0) {
+        options.output.max_priority_bytes =
+            std::strtoul(arg.c_str() + std::strlen("--priority-budget="), nullptr, 10);
+      } else {
+        options.threads = std::strtoul(argv[i], nullptr, 10);
+      }
+    }
+
     std::filesystem::path exe_path(argv[0]);
     std::filesystem::path data_path = exe_path.parent_path() / "data";
 
     boost::asio::io_context io_context;
     tcp::endpoint endpoint(tcp::v4(), std::atoi(argv[1]));
-    mud::server s(io_context, endpoint, data_path.string());
-    std::cout << "\033[1;32mServer started " << endpoint.address().to_string() << ":" << endpoint.port() << "\033[0m" << std::endl;
+    mud::server s(io_context, endpoint, data_path.string(), options);
+    std::cout << "\033[1;32mServer started " << endpoint.address().to_string() << ":" << endpoint.port()
+              << " (" << options.threads
+              << (options.mode == mud::io_mode::sharded ? " shards" : " threads")
+              << ", " << mud::server::io_backend() << ")\033[0m" << std::endl;
+    if (options.binary_port != 0) {
+      std::cout << "\033[1;32mBinary protocol on port " << options.binary_port
+                << "\033[0m" << std::endl;
+    }
+    // Flush every session and close it before exiting.
+    boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
+    signals.async_wait([&s](const boost::system::error_code &ec, int) {
+      if (!ec) {
+        s.shutdown();
+      }
+    });
     s.run();
+    std::cout << "Server stopped" << std::endl;
   } catch (const std::exception &e) {
     std::cerr << "Exception: " << e.what() << "\n";
   }
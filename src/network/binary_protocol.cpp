@@ -0,0 +1,195 @@
+#include "network/binary_protocol.hpp"
+#include <cstring>
+#include <utility>
+
+namespace mud::binary {
+
+namespace {
+// Bounds-checked big-endian reads over one frame body.
+class reader {
+public:
+  explicit reader(std::string_view body) : body_(body) {}
+
+  bool u8(std::uint8_t &value) {
+    if (body_.size() < 1) {
+      return false;
+    }
+    value = static_cast<std::uint8_t>(body_[0]);
+    body_.remove_prefix(1);
+    return true;
+  }
+
+  bool u16(std::uint16_t &value) {
+    std::uint8_t high = 0, low = 0;
+    if (!u8(high) || !u8(low)) {
+      return false;
+    }
+    value = static_cast<std::uint16_t>(high << 8 | low);
+    return true;
+  }
+
+  bool u32(std::uint32_t &value) {
+    std::uint16_t high = 0, low = 0;
+    if (!u16(high) || !u16(low)) {
+      return false;
+    }
+    value = static_cast<std::uint32_t>(high) << 16 | low;
+    return true;
+  }
+
+  bool string(std::string &value) {
+    std::uint16_t length = 0;
+    if (!u16(length) || body_.size() < length) {
+      return false;
+    }
+    value.assign(body_.data(), length);
+    body_.remove_prefix(length);
+    return true;
+  }
+
+  bool value(std::string &value) {
+    std::uint8_t tag = 0;
+    if (!u8(tag)) {
+      return false;
+    }
+    switch (static_cast<value_type>(tag)) {
+    case value_type::string:
+      return string(value);
+    case value_type::integer: {
+      std::uint32_t bits = 0;
+      if (!u32(bits)) {
+        return false;
+      }
+      value = std::to_string(static_cast<std::int32_t>(bits));
+      return true;
+    }
+    }
+    return false;
+  }
+
+  bool done() const { return body_.empty(); }
+
+private:
+  std::string_view body_;
+};
+
+void put_u16(std::string &out, std::uint16_t value) {
+  out.push_back(static_cast<char>(value >> 8));
+  out.push_back(static_cast<char>(value & 0xFF));
+}
+
+void put_u32(std::string &out, std::uint32_t value) {
+  put_u16(out, static_cast<std::uint16_t>(value >> 16));
+  put_u16(out, static_cast<std::uint16_t>(value & 0xFFFF));
+}
+
+// Starts a frame of type with room for body_size more bytes; the length
+// covers the type and the body.
+std::string begin_frame(frame_type type, std::size_t body_size) {
+  std::string frame;
+  frame.reserve(header_size + 2 + body_size);
+  put_u32(frame, static_cast<std::uint32_t>(2 + body_size));
+  put_u16(frame, static_cast<std::uint16_t>(type));
+  return frame;
+}
+} // namespace
+
+framer::framer() : buffer_(header_size + max_frame) {}
+
+boost::asio::mutable_buffer framer::prepare() {
+  if (begin_ > 0) {
+    std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+  }
+  return boost::asio::buffer(buffer_.data() + end_, buffer_.size() - end_);
+}
+
+void framer::commit(std::size_t bytes) { end_ += bytes; }
+
+framer::result framer::next(request &out) {
+  std::uint32_t length = 0;
+  if (!reader({buffer_.data() + begin_, end_ - begin_}).u32(length)) {
+    return result::incomplete;
+  }
+  if (length < 2 || length > max_frame) {
+    return result::malformed;
+  }
+  if (end_ - begin_ < header_size + length) {
+    return result::incomplete;
+  }
+  reader body({buffer_.data() + begin_ + header_size, length});
+  begin_ += header_size + length;
+
+  std::uint16_t type = 0;
+  body.u16(type);
+  out.type = static_cast<frame_type>(type);
+  out.command_id = 0;
+  out.args.clear();
+  switch (out.type) {
+  case frame_type::login:
+    out.args.emplace_back();
+    if (!body.string(out.args.back())) {
+      return result::malformed;
+    }
+    break;
+  case frame_type::command: {
+    std::uint8_t argc = 0;
+    if (!body.u16(out.command_id) || !body.u8(argc)) {
+      return result::malformed;
+    }
+    out.args.resize(argc);
+    for (auto &arg : out.args) {
+      if (!body.value(arg)) {
+        return result::malformed;
+      }
+    }
+    break;
+  }
+  default:
+    return result::malformed;
+  }
+  return body.done() ? result::complete : result::malformed;
+}
+
+std::string_view framer::pending() const {
+  return {buffer_.data() + begin_, end_ - begin_};
+}
+
+std::string event(std::string_view message) {
+  auto parsed = utils::color::parse(message);
+  return event(parsed.kind, parsed.text);
+}
+
+std::string event(utils::color::category kind, std::string_view text) {
+  std::string frame = begin_frame(frame_type::event, 1 + text.size());
+  frame.push_back(static_cast<char>(kind));
+  frame.append(text);
+  return frame;
+}
+
+bool is_event(std::string_view frame) {
+  return frame.size() >= header_size + 3 &&
+         static_cast<unsigned char>(frame[header_size]) == 0 &&
+         static_cast<unsigned char>(frame[header_size + 1]) ==
+             static_cast<unsigned char>(frame_type::event);
+}
+
+std::string append_to_event(std::string_view frame, std::string_view text) {
+  std::string body(frame.substr(header_size + 2));
+  body.append(text);
+  std::string extended = begin_frame(frame_type::event, body.size());
+  extended.append(body);
+  return extended;
+}
+
+std::string data(std::string_view package, std::string_view json) {
+  std::string frame =
+      begin_frame(frame_type::data, 2 + package.size() + json.size());
+  put_u16(frame, static_cast<std::uint16_t>(package.size()));
+  frame.append(package);
+  frame.append(json);
+  return frame;
+}
+
+} // namespace mud::binary
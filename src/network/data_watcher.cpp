@@ -0,0 +1,129 @@
+#include "network/data_watcher.hpp"
+#include "utils/logger.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <utility>
+#if defined(MUD_HAS_DATA_WATCHER)
+#include <sys/inotify.h>
+#endif
+
+namespace mud {
+
+#if defined(MUD_HAS_DATA_WATCHER)
+namespace {
+constexpr std::uint32_t watched_events = IN_CLOSE_WRITE | IN_CREATE |
+                                         IN_DELETE | IN_MOVED_FROM |
+                                         IN_MOVED_TO;
+} // namespace
+#endif
+
+data_watcher::data_watcher(boost::asio::io_context &io_context,
+                           const std::string &data_path,
+                           std::function<void(change)> handler)
+    : strand_(boost::asio::make_strand(io_context)), timer_(strand_),
+      handler_(std::move(handler)), data_path_(data_path)
+#if defined(MUD_HAS_DATA_WATCHER)
+      ,
+      descriptor_(strand_)
+#endif
+{
+#if defined(MUD_HAS_DATA_WATCHER)
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    utils::Logger::instance().log("Cannot watch " + data_path_ +
+                                  "; reloading is off");
+    return;
+  }
+  descriptor_.assign(fd);
+  watch("");
+  std::error_code ec;
+  for (const auto &entry :
+       std::filesystem::directory_iterator(data_path_, ec)) {
+    if (entry.is_directory(ec)) {
+      watch(entry.path().filename().string());
+    }
+  }
+  read_events();
+#endif
+}
+
+data_watcher::~data_watcher() {
+#if defined(MUD_HAS_DATA_WATCHER)
+  boost::system::error_code ignored;
+  descriptor_.close(ignored);
+#endif
+}
+
+bool data_watcher::active() const {
+#if defined(MUD_HAS_DATA_WATCHER)
+  return !directories_.empty();
+#else
+  return false;
+#endif
+}
+
+void data_watcher::watch(const std::string &relative) {
+#if defined(MUD_HAS_DATA_WATCHER)
+  auto path = relative.empty() ? data_path_ : data_path_ + "/" + relative;
+  int wd = inotify_add_watch(descriptor_.native_handle(), path.c_str(),
+                             watched_events);
+  if (wd < 0) {
+    utils::Logger::instance().log("Cannot watch " + path);
+    return;
+  }
+  directories_[wd] = relative;
+#endif
+}
+
+void data_watcher::read_events() {
+#if defined(MUD_HAS_DATA_WATCHER)
+  descriptor_.async_read_some(
+      boost::asio::buffer(buffer_),
+      [this](const boost::system::error_code &ec, std::size_t length) {
+        if (ec) {
+          return;
+        }
+        // The kernel only hands out whole events.
+        std::size_t offset = 0;
+        while (offset + sizeof(inotify_event) <= length) {
+          const auto *event =
+              reinterpret_cast<const inotify_event *>(buffer_.data() + offset);
+          offset += sizeof(inotify_event) + event->len;
+          auto directory = directories_.find(event->wd);
+          if (directory == directories_.end() || event->len == 0) {
+            continue;
+          }
+          std::string name(event->name);
+          if ((event->mask & IN_ISDIR) && directory->second.empty()) {
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+              watch(name);
+            }
+            continue;
+          }
+          if (pending_.files.empty()) {
+            pending_.since = clock::now();
+          }
+          pending_.files.insert(directory->second.empty()
+                                    ? name
+                                    : directory->second + "/" + name);
+        }
+        if (!pending_.files.empty()) {
+          settle();
+        }
+        read_events();
+      });
+#endif
+}
+
+void data_watcher::settle() {
+  // Each event pushes the report back, until the files stop changing.
+  timer_.expires_after(settle_time);
+  timer_.async_wait([this](const boost::system::error_code &ec) {
+    if (ec || pending_.files.empty()) {
+      return;
+    }
+    handler_(std::exchange(pending_, {}));
+  });
+}
+
+} // namespace mud
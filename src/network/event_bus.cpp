@@ -0,0 +1,157 @@
+#include "network/event_bus.hpp"
+#include "network/session.hpp"
+#include "network/shard.hpp"
+#include "world/room.hpp"
+#include "world/tick_scheduler.hpp"
+#include <utility>
+
+namespace mud {
+
+topic topic::global() { return {kind::global, {}}; }
+
+topic topic::zone(std::string name) { return {kind::zone, std::move(name)}; }
+
+topic topic::room(std::string id) { return {kind::room, std::move(id)}; }
+
+topic topic::channel(std::string name) {
+  return {kind::channel, std::move(name)};
+}
+
+topic topic::player(std::string name) {
+  return {kind::player, std::move(name)};
+}
+
+std::string topic::key() const {
+  switch (type) {
+  case kind::global:
+    return "global";
+  case kind::zone:
+    return "zone:" + name;
+  case kind::room:
+    return "room:" + name;
+  case kind::channel:
+    return "channel:" + name;
+  case kind::player:
+    return "player:" + name;
+  }
+  return name;
+}
+
+void event_bus::batch::publish(event e) { events_.push_back(std::move(e)); }
+
+bool event_bus::batch::empty() const { return events_.empty(); }
+
+event_bus::event_bus(std::vector<std::unique_ptr<shard>> &shards)
+    : shards_(shards) {}
+
+void event_bus::subscribe(const topic &t, chat_participant_ptr participant) {
+  shard &owner = t.type == topic::kind::global ? shard_of(participant)
+                                               : owner_of(t);
+  owner.post([&owner, t, participant] { owner.subscribe(t, participant); });
+}
+
+void event_bus::unsubscribe(const topic &t, chat_participant_ptr participant,
+                            std::function<void(bool)> done) {
+  shard &owner = t.type == topic::kind::global ? shard_of(participant)
+                                               : owner_of(t);
+  owner.post([&owner, t, participant, done] {
+    bool subscribed = owner.unsubscribe(t, participant);
+    if (done) {
+      done(subscribed);
+    }
+  });
+}
+
+void event_bus::move(chat_participant_ptr participant,
+                     const std::shared_ptr<world::Room> &from,
+                     const std::shared_ptr<world::Room> &to) {
+  if (from == to) {
+    return;
+  }
+  const std::string no_zone;
+  const auto &from_zone = from ? from->get_zone() : no_zone;
+  const auto &to_zone = to ? to->get_zone() : no_zone;
+  bool same_room = from && to && from->get_id() == to->get_id();
+  if (from) {
+    if (!same_room) {
+      unsubscribe(topic::room(from->get_id()), participant);
+    }
+    if (!from_zone.empty() && from_zone != to_zone) {
+      unsubscribe(topic::zone(from_zone), participant);
+    }
+  }
+  if (to) {
+    if (!same_room) {
+      subscribe(topic::room(to->get_id()), participant);
+    }
+    if (!to_zone.empty() && to_zone != from_zone) {
+      subscribe(topic::zone(to_zone), participant);
+    }
+  }
+}
+
+void event_bus::publish(event e) {
+  if (world::TickScheduler::in_tick()) {
+    held_.publish(std::move(e));
+    return;
+  }
+  batch single;
+  single.publish(std::move(e));
+  publish(std::move(single));
+}
+
+void event_bus::publish(const topic &t, shared_message msg,
+                        chat_participant_ptr sender) {
+  publish(event{t, std::move(msg), std::move(sender)});
+}
+
+void event_bus::publish(batch events) {
+  // Kept in publish order per shard. Every shard and every recipient
+  // shares each event's framed buffer.
+  std::vector<std::vector<event>> per_shard(shards_.size());
+  for (auto &e : events.events_) {
+    if (e.target.type == topic::kind::global) {
+      for (auto &events_for_shard : per_shard) {
+        events_for_shard.push_back(e);
+      }
+    } else {
+      per_shard[owner_of(e.target).index()].push_back(std::move(e));
+    }
+  }
+  for (std::size_t i = 0; i < per_shard.size(); ++i) {
+    if (per_shard[i].empty()) {
+      continue;
+    }
+    shard &target = *shards_[i];
+    target.post([&target, events = std::move(per_shard[i])] {
+      for (auto &e : events) {
+        std::size_t delivered = target.publish(e);
+        if (e.delivered) {
+          e.delivered(delivered);
+        }
+      }
+    });
+  }
+}
+
+void event_bus::flush() {
+  if (!held_.empty()) {
+    publish(std::exchange(held_, {}));
+  }
+}
+
+void event_bus::get_subscriber_names(
+    const topic &t, std::function<void(std::vector<std::string>)> handler) {
+  shard &owner = owner_of(t);
+  owner.post([&owner, t, handler] { handler(owner.subscriber_names(t)); });
+}
+
+shard &event_bus::owner_of(const topic &t) {
+  return *shards_[std::hash<std::string>{}(t.key()) % shards_.size()];
+}
+
+shard &event_bus::shard_of(const chat_participant_ptr &participant) {
+  auto s = std::dynamic_pointer_cast<mud::session>(participant);
+  return s ? s->get_shard() : *shards_.front();
+}
+} // namespace mud
@@ -1,99 +1,427 @@
 #include "network/file.hpp"
+#include "network/handler_memory.hpp"
+#include <zlib.h>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <filesystem>
 #include <iomanip>
 #include <iostream>
-
+#include <sstream>
 
 namespace mud {
+
+namespace {
+std::uint32_t update_checksum(std::uint32_t checksum, const char *data,
+                              std::size_t size) {
+  return static_cast<std::uint32_t>(
+      ::crc32(checksum, reinterpret_cast<const Bytef *>(data),
+              static_cast<uInt>(size)));
+}
+
+// Checksum of the first size bytes, for resuming part way into a file.
+#if defined(BOOST_ASIO_HAS_FILE)
+bool checksum_prefix(boost::asio::random_access_file &file, std::size_t size,
+                     std::uint32_t &checksum) {
+  std::array<char, 64 * 1024> buffer;
+  checksum = 0;
+  for (std::size_t offset = 0; offset < size;) {
+    std::size_t length = std::min(buffer.size(), size - offset);
+    boost::system::error_code ec;
+    boost::asio::read_at(file, offset, boost::asio::buffer(buffer.data(), length), ec);
+    if (ec) {
+      return false;
+    }
+    checksum = update_checksum(checksum, buffer.data(), length);
+    offset += length;
+  }
+  return true;
+}
+#else
+bool checksum_prefix(std::istream &in, std::size_t size,
+                     std::uint32_t &checksum) {
+  std::array<char, 64 * 1024> buffer;
+  checksum = 0;
+  in.seekg(0, std::ios_base::beg);
+  for (std::size_t offset = 0; offset < size;) {
+    std::size_t length = std::min(buffer.size(), size - offset);
+    in.read(buffer.data(), length);
+    if (static_cast<std::size_t>(in.gcount()) != length) {
+      return false;
+    }
+    checksum = update_checksum(checksum, buffer.data(), length);
+    offset += length;
+  }
+  return true;
+}
+#endif
+} // namespace
+
 file::file(boost::asio::ip::tcp::socket &socket) : socket_(socket) {}
 
 file::~file() {}
 
-void file::send_file(const std::string &file_path,
-                     std::function<void(bool)> callback) {
+void file::set_progress_handler(progress_handler handler) {
+  progress_ = std::move(handler);
+}
+
+void file::send_line(std::string line) {
+  line.push_back('\n');
+  lines_.push_back(std::move(line));
+  do_write();
+}
+
+void file::do_write() {
+  if (writing_) {
+    return;
+  }
+  if (!lines_.empty()) {
+    writing_ = true;
+    boost::asio::async_write(
+        socket_, boost::asio::buffer(lines_.front()),
+        recycle(handler_op::file,
+                [this](const boost::system::error_code &error,
+                       std::size_t /*bytes_transferred*/) {
+                  writing_ = false;
+                  if (error) {
+                    std::cerr << "Send error: " << error.message() << std::endl;
+                    lines_.clear();
+                    finish_send(false);
+                    return;
+                  }
+                  lines_.pop_front();
+                  do_write();
+                }));
+    return;
+  }
+  if (!sending_) {
+    return;
+  }
+  if (next_offset_ < input_size_ &&
+      next_offset_ - acked_offset_ < window_chunks * max_chunk) {
+    write_chunk();
+  } else if (acked_offset_ == input_size_) {
+    sending_ = false;
+    send_line("file_end:" + target_ + ":" + format_checksum(input_checksum_));
+    finish_send(true);
+  }
+}
+
+void file::write_chunk() {
+  std::size_t offset = next_offset_;
+  std::size_t length = std::min(max_chunk, input_size_ - offset);
+  next_offset_ = offset + length;
+  input_chunk_.resize(length);
+  writing_ = true;
+
+  auto send = [this, offset, length] {
+    if (offset == checksum_offset_) {
+      input_checksum_ =
+          update_checksum(input_checksum_, input_chunk_.data(), length);
+      checksum_offset_ += length;
+    }
+    header_ = "file_data:" + target_ + ":" + std::to_string(offset) + ":" +
+              std::to_string(length) + ":" +
+              format_checksum(update_checksum(0, input_chunk_.data(), length)) +
+              "\n";
+    std::array<boost::asio::const_buffer, 2> buffers{
+        boost::asio::buffer(header_), boost::asio::buffer(input_chunk_)};
+    boost::asio::async_write(
+        socket_, buffers,
+        recycle(handler_op::file,
+                [this](const boost::system::error_code &error,
+                       std::size_t /*bytes_transferred*/) {
+                  writing_ = false;
+                  if (error) {
+                    std::cerr << "Send file content error: " << error.message()
+                              << std::endl;
+                    finish_send(false);
+                    return;
+                  }
+                  do_write();
+                }));
+  };
+
+#if defined(BOOST_ASIO_HAS_FILE)
+  boost::asio::async_read_at(
+      *input_file_, offset, boost::asio::buffer(input_chunk_),
+      recycle(handler_op::file,
+              [this, send](const boost::system::error_code &error,
+                           std::size_t /*bytes_read*/) {
+                if (error) {
+                  writing_ = false;
+                  std::cerr << "Read file content error: " << error.message()
+                            << std::endl;
+                  finish_send(false);
+                  return;
+                }
+                send();
+              }));
+#else
+  input_file_.seekg(offset, std::ios_base::beg);
+  input_file_.read(input_chunk_.data(), length);
+  if (static_cast<std::size_t>(input_file_.gcount()) != length) {
+    writing_ = false;
+    std::cerr << "Read file content error: unexpected end of file"
+              << std::endl;
+    finish_send(false);
+    return;
+  }
+  send();
+#endif
+}
+
+void file::send_file(const std::string &file_path, const std::string &target,
+                     std::size_t offset, std::function<void(bool)> callback) {
+  if (sending_) {
+    callback(false);
+    return;
+  }
+#if defined(BOOST_ASIO_HAS_FILE)
+  boost::system::error_code ec;
+  input_file_ =
+      std::make_unique<boost::asio::random_access_file>(socket_.get_executor());
+  input_file_->open(file_path, boost::asio::random_access_file::read_only, ec);
+  if (ec) {
+    std::cerr << "Failed to open file: " << file_path << std::endl;
+    callback(false);
+    return;
+  }
+  input_size_ = static_cast<std::size_t>(input_file_->size());
+  bool resumable =
+      offset <= input_size_ && checksum_prefix(*input_file_, offset, input_checksum_);
+#else
+  input_file_.close();
+  input_file_.clear();
   input_file_.open(file_path, std::ios_base::binary | std::ios_base::ate);
   if (!input_file_.is_open()) {
     std::cerr << "Failed to open file: " << file_path << std::endl;
     callback(false);
     return;
   }
+  input_size_ = static_cast<std::size_t>(input_file_.tellg());
+  bool resumable =
+      offset <= input_size_ && checksum_prefix(input_file_, offset, input_checksum_);
+#endif
+  if (!resumable) {
+    std::cerr << "Cannot resume " << file_path << " at " << offset << std::endl;
+    callback(false);
+    return;
+  }
+
+  target_ = target;
+  send_callback_ = std::move(callback);
+  next_offset_ = acked_offset_ = checksum_offset_ = offset;
+  sending_ = true;
+  do_write();
+}
 
-  std::streamsize file_size = input_file_.tellg();
-  input_file_.seekg(0, std::ios_base::beg);
+void file::acknowledged(std::size_t offset) {
+  if (!sending_ || offset <= acked_offset_ || offset > input_size_) {
+    return;
+  }
+  acked_offset_ = offset;
+  if (progress_) {
+    progress_(acked_offset_, input_size_);
+  }
+  do_write();
+}
 
-  std::string header =
-      "file:" + file_path + ":" + std::to_string(file_size) + "\n";
-  boost::asio::async_write(
-      socket_, boost::asio::buffer(header),
-      [this, callback](const boost::system::error_code &error,
-                       std::size_t /*bytes_transferred*/) {
-        if (!error) {
-          do_write_file_content(callback);
-        } else {
-          std::cerr << "Send file header error: " << error.message()
-                    << std::endl;
-          callback(false);
-        }
-      });
-}
-
-void file::receive_file(const std::string &file_name, std::size_t file_size,
-                        std::function<void(bool)> callback) {
-  output_file_.open(file_name, std::ios_base::binary);
-  if (!output_file_.is_open()) {
-    std::cerr << "Failed to open file for writing: " << file_name << std::endl;
-    callback(false);
+void file::rejected(std::size_t offset) {
+  if (!sending_ || offset < acked_offset_ || offset >= next_offset_) {
     return;
   }
-  do_read_file_content(file_size, callback);
+  // Go back N: the receiver drops everything after the bad chunk.
+  next_offset_ = offset;
+  do_write();
 }
 
-void file::do_write_file_content(std::function<void(bool)> callback) {
-  input_file_.read(buffer_.data(), buffer_.size());
-  std::size_t bytes_read = input_file_.gcount();
+void file::cancel_send() {
+  if (sending_) {
+    finish_send(false);
+  }
+}
 
-  if (bytes_read > 0) {
-    boost::asio::async_write(
-        socket_, boost::asio::buffer(buffer_.data(), bytes_read),
-        [this, callback](const boost::system::error_code &error,
-                         std::size_t /*bytes_transferred*/) {
-          if (!error) {
-            do_write_file_content(callback);
-          } else {
-            std::cerr << "Send file content error: " << error.message()
-                      << std::endl;
-            callback(false);
-          }
-        });
-  } else {
-    callback(true);
+void file::finish_send(bool ok) {
+  sending_ = false;
+#if defined(BOOST_ASIO_HAS_FILE)
+  input_file_.reset();
+#else
+  input_file_.close();
+#endif
+  auto callback = std::move(send_callback_);
+  send_callback_ = nullptr;
+  if (callback) {
+    callback(ok);
   }
 }
 
-void file::do_read_file_content(std::size_t remaining_size,
-                                std::function<void(bool)> callback) {
-  if (remaining_size == 0) {
+std::size_t file::begin_receive(const std::string &sender,
+                                const std::string &file_name,
+                                std::size_t file_size) {
+  cancel_receive();
+  std::string part = file_name + ".part";
+
+  // Keep what an earlier attempt verified, unless it can't be a prefix.
+  std::error_code fs_ec;
+  std::size_t existing = 0;
+  if (std::filesystem::exists(part, fs_ec)) {
+    existing = static_cast<std::size_t>(std::filesystem::file_size(part, fs_ec));
+    if (fs_ec || existing > file_size) {
+      existing = 0;
+    }
+    std::filesystem::resize_file(part, existing, fs_ec);
+  }
+
+#if defined(BOOST_ASIO_HAS_FILE)
+  boost::system::error_code ec;
+  output_file_ =
+      std::make_unique<boost::asio::random_access_file>(socket_.get_executor());
+  output_file_->open(part,
+                     boost::asio::random_access_file::read_write |
+                         boost::asio::random_access_file::create,
+                     ec);
+  if (ec || !checksum_prefix(*output_file_, existing, output_checksum_)) {
+    std::cerr << "Failed to open file for writing: " << part << std::endl;
+    output_file_.reset();
+    return std::string::npos;
+  }
+#else
+  if (existing == 0) {
+    std::ofstream create(part, std::ios_base::binary | std::ios_base::trunc);
+  }
+  output_file_.close();
+  output_file_.clear();
+  output_file_.open(part, std::ios_base::binary | std::ios_base::in |
+                              std::ios_base::out);
+  if (!output_file_.is_open() ||
+      !checksum_prefix(output_file_, existing, output_checksum_)) {
+    std::cerr << "Failed to open file for writing: " << part << std::endl;
+    output_file_.close();
+    return std::string::npos;
+  }
+#endif
+  sender_ = sender;
+  output_name_ = file_name;
+  output_size_ = file_size;
+  received_offset_ = existing;
+  receiving_ = true;
+  return existing;
+}
+
+void file::receive_chunk(boost::asio::streambuf &buffered, std::size_t offset,
+                         std::size_t size, std::uint32_t checksum,
+                         std::function<void(bool)> callback) {
+  output_chunk_.resize(size);
+  std::size_t from_buffer = boost::asio::buffer_copy(
+      boost::asio::buffer(output_chunk_), buffered.data());
+  buffered.consume(from_buffer);
+  if (from_buffer == size) {
+    store_chunk(offset, checksum, callback);
+    return;
+  }
+  boost::asio::async_read(
+      socket_,
+      boost::asio::buffer(output_chunk_.data() + from_buffer, size - from_buffer),
+      recycle(handler_op::file,
+              [this, offset, checksum,
+               callback](const boost::system::error_code &error,
+                         std::size_t /*bytes_transferred*/) {
+                if (!error) {
+                  store_chunk(offset, checksum, callback);
+                } else {
+                  std::cerr << "Receive file content error: " << error.message()
+                            << std::endl;
+                  callback(false);
+                }
+              }));
+}
+
+void file::store_chunk(std::size_t offset, std::uint32_t checksum,
+                       std::function<void(bool)> callback) {
+  if (!receiving_ || offset != received_offset_) {
+    // No transfer to write to, or the rest of a window sent behind a chunk
+    // we nacked: the sender will send it again.
+    callback(true);
+    return;
+  }
+  if (update_checksum(0, output_chunk_.data(), output_chunk_.size()) !=
+      checksum) {
+    send_line("file_nack:" + sender_ + ":" + std::to_string(received_offset_));
     callback(true);
     return;
   }
+#if defined(BOOST_ASIO_HAS_FILE)
+  boost::asio::async_write_at(
+      *output_file_, offset, boost::asio::buffer(output_chunk_),
+      recycle(handler_op::file,
+              [this, callback](const boost::system::error_code &error,
+                               std::size_t /*bytes_written*/) {
+                if (error) {
+                  std::cerr << "Write file content error: " << error.message()
+                            << std::endl;
+                  callback(false);
+                  return;
+                }
+                chunk_stored();
+                callback(true);
+              }));
+#else
+  output_file_.seekp(offset, std::ios_base::beg);
+  output_file_.write(output_chunk_.data(), output_chunk_.size());
+  output_file_.flush();
+  if (!output_file_) {
+    callback(false);
+    return;
+  }
+  chunk_stored();
+  callback(true);
+#endif
+}
+
+void file::chunk_stored() {
+  output_checksum_ = update_checksum(output_checksum_, output_chunk_.data(),
+                                     output_chunk_.size());
+  received_offset_ += output_chunk_.size();
+  send_line("file_ack:" + sender_ + ":" + std::to_string(received_offset_));
+  if (progress_) {
+    progress_(received_offset_, output_size_);
+  }
+}
+
+bool file::end_receive(std::uint32_t checksum) {
+  if (!receiving_) {
+    return false;
+  }
+  bool complete =
+      received_offset_ == output_size_ && output_checksum_ == checksum;
+  cancel_receive();
+  if (!complete) {
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(output_name_ + ".part", output_name_, ec);
+  return !ec;
+}
+
+void file::cancel_receive() {
+  receiving_ = false;
+#if defined(BOOST_ASIO_HAS_FILE)
+  output_file_.reset();
+#else
+  output_file_.close();
+#endif
+}
+
+std::string file::format_checksum(std::uint32_t checksum) {
+  std::ostringstream ss;
+  ss << std::hex << std::setw(8) << std::setfill('0') << checksum;
+  return ss.str();
+}
 
-  socket_.async_read_some(
-      boost::asio::buffer(buffer_),
-      [this, remaining_size, callback](const boost::system::error_code &error,
-                                       std::size_t bytes_transferred) {
-        if (!error) {
-          output_file_.write(buffer_.data(), bytes_transferred);
-
-          std::cout << "\rDownloading... " << std::fixed << std::setprecision(2)
-                    << (double)(remaining_size - bytes_transferred) /
-                           remaining_size * 100
-                    << "%" << std::flush;
-
-          do_read_file_content(remaining_size - bytes_transferred, callback);
-        } else {
-          std::cerr << "Receive file content error: " << error.message()
-                    << std::endl;
-          callback(false);
-        }
-      });
+bool file::parse_checksum(const std::string &text, std::uint32_t &checksum) {
+  auto [end, ec] =
+      std::from_chars(text.data(), text.data() + text.size(), checksum, 16);
+  return ec == std::errc() && end == text.data() + text.size();
 }
 } // namespace mud
@@ -0,0 +1,410 @@
+#include "network/file_relay.hpp"
+#include "network/server.hpp"
+#include "network/session.hpp"
+#include "network/telnet.hpp"
+#include "players/player.hpp"
+#include "utils/color.hpp"
+#include "utils/logger.hpp"
+#include "utils/metrics.hpp"
+#include <charconv>
+#include <utility>
+
+namespace mud {
+
+namespace {
+constexpr std::string_view offer_prefix = "file_offer:";
+constexpr std::string_view accept_prefix = "file_accept:";
+constexpr std::string_view decline_prefix = "file_decline:";
+constexpr std::string_view data_prefix = "file_data:";
+constexpr std::string_view end_prefix = "file_end:";
+constexpr std::string_view ack_prefix = "file_ack:";
+constexpr std::string_view nack_prefix = "file_nack:";
+
+// Splits "head:tail" at the last ':'. Player names can't contain one, but
+// file names may, so fields are always peeled off from the right.
+bool split_last(std::string_view in, std::string_view &head,
+                std::string_view &tail) {
+  auto colon = in.rfind(':');
+  if (colon == std::string_view::npos) {
+    return false;
+  }
+  head = in.substr(0, colon);
+  tail = in.substr(colon + 1);
+  return true;
+}
+
+bool parse_size(std::string_view text, std::size_t &value) {
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return ec == std::errc() && end == text.data() + text.size();
+}
+
+// CRC-32 as written by mud::file: eight hex digits. Relayed, not checked.
+bool is_checksum(std::string_view text) {
+  return text.size() == 8 &&
+         text.find_first_not_of("0123456789abcdefABCDEF") ==
+             std::string_view::npos;
+}
+} // namespace
+
+void file_transfer::release(std::size_t bytes) {
+  std::size_t left = in_flight.fetch_sub(bytes) - bytes;
+  if (left <= file_relay::window / 2 && sender_waiting.exchange(false)) {
+    if (auto s = sender.lock()) {
+      s->post([s] { s->get_relay().wake(); });
+    }
+  }
+}
+
+file_relay::file_relay(session &session, boost::asio::any_io_executor executor)
+    : session_(session),
+      signal_(std::move(executor), boost::asio::steady_timer::time_point::max()) {}
+
+bool file_relay::is_data_header(std::string_view line) {
+  return line.starts_with(data_prefix);
+}
+
+bool file_relay::handle_line(std::string_view line) {
+  if (line.starts_with(offer_prefix)) {
+    offer(line.substr(offer_prefix.size()));
+  } else if (line.starts_with(accept_prefix)) {
+    answer(line.substr(accept_prefix.size()), true);
+  } else if (line.starts_with(decline_prefix)) {
+    answer(line.substr(decline_prefix.size()), false);
+  } else if (line.starts_with(end_prefix)) {
+    end(line.substr(end_prefix.size()));
+  } else if (line.starts_with(ack_prefix)) {
+    report(line.substr(ack_prefix.size()), "file_ack:");
+  } else if (line.starts_with(nack_prefix)) {
+    report(line.substr(nack_prefix.size()), "file_nack:");
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void file_relay::offer(std::string_view args) {
+  std::string_view rest, size_text, target, name;
+  std::size_t size = 0;
+  if (!split_last(args, rest, size_text) || !parse_size(size_text, size) ||
+      !split_last(rest, target, name) || target.empty()) {
+    session_.deliver(utils::color::system(
+        "Usage: file_offer:<player>:<file name>:<size>"));
+    return;
+  }
+  // Only the base name is forwarded, so an offer can't make the recipient
+  // write outside its download directory.
+  name = name.substr(name.find_last_of("/\\") + 1);
+  if (name.empty() || name == "." || name == "..") {
+    session_.deliver(utils::color::system("Invalid file name."));
+    return;
+  }
+  const auto &sender_name = session_.get_player()->get_name();
+  if (target == sender_name) {
+    session_.deliver(utils::color::system("You can't send a file to yourself."));
+    return;
+  }
+  if (outgoing_.find(target) != outgoing_.end()) {
+    session_.deliver(utils::color::system("A file transfer to " +
+                                          std::string(target) +
+                                          " is already pending."));
+    return;
+  }
+
+  auto transfer = std::make_shared<file_transfer>();
+  transfer->sender_name = sender_name;
+  transfer->target_name = std::string(target);
+  transfer->file_name = std::string(name);
+  transfer->size = size;
+  transfer->sender = session_.shared_from_this();
+  outgoing_.emplace(transfer->target_name, transfer);
+
+  auto self = session_.shared_from_this();
+  session_.get_server().get_player_by_name(
+      transfer->target_name,
+      [self, transfer](std::shared_ptr<Player> player) {
+        auto target = player ? player->get_session() : nullptr;
+        if (!target) {
+          self->post([self, transfer] {
+            self->get_relay().answered(transfer, false);
+          });
+          return;
+        }
+        transfer->target = target;
+        target->post([target, transfer] {
+          target->get_relay().offered(transfer);
+        });
+      });
+}
+
+void file_relay::offered(std::shared_ptr<file_transfer> transfer) {
+  if (closed_ || session_.protocol() == wire_protocol::binary ||
+      incoming_.find(transfer->sender_name) != incoming_.end()) {
+    // Gone, unable to receive files, or still answering an earlier offer
+    // from the same player.
+    if (auto sender = transfer->sender.lock()) {
+      sender->post([sender, transfer] {
+        sender->get_relay().answered(transfer, false);
+      });
+    }
+    return;
+  }
+  incoming_.emplace(transfer->sender_name, transfer);
+  session_.deliver("file_offer:" + transfer->file_name + ":" +
+                   std::to_string(transfer->size) + ":" +
+                   transfer->sender_name);
+}
+
+void file_relay::answer(std::string_view args, bool accept) {
+  // file_accept:<sender>[:<offset>] resumes a transfer at offset.
+  std::string_view sender_name = args;
+  std::string_view head, offset_text;
+  std::size_t offset = 0;
+  if (accept && split_last(args, head, offset_text)) {
+    if (!parse_size(offset_text, offset)) {
+      session_.deliver(
+          utils::color::system("Usage: file_accept:<player>[:<offset>]"));
+      return;
+    }
+    sender_name = head;
+  }
+  auto it = incoming_.find(sender_name);
+  if (it == incoming_.end() || it->second->answered) {
+    session_.deliver(utils::color::system("No file offer from " +
+                                          std::string(sender_name) + "."));
+    return;
+  }
+  auto transfer = it->second;
+  auto sender = transfer->sender.lock();
+  if (!sender) {
+    incoming_.erase(it);
+    session_.deliver("file_cancelled:" + transfer->sender_name);
+    return;
+  }
+  if (offset > transfer->size) {
+    session_.deliver(utils::color::system("Resume offset is past the end of " +
+                                          transfer->file_name + "."));
+    return;
+  }
+  transfer->answered = true;
+  transfer->resume_offset = offset;
+  if (accept) {
+    session_.deliver("file_begin_transfer:" + transfer->file_name + ":" +
+                     std::to_string(transfer->size) + ":" +
+                     std::to_string(offset));
+  } else {
+    incoming_.erase(it);
+  }
+  sender->post([sender, transfer, accept] {
+    sender->get_relay().answered(transfer, accept);
+  });
+}
+
+void file_relay::answered(std::shared_ptr<file_transfer> transfer,
+                          bool accepted) {
+  auto it = outgoing_.find(transfer->target_name);
+  if (it == outgoing_.end() || it->second != transfer) {
+    // Cancelled before the answer arrived; don't leave the recipient
+    // waiting for chunks.
+    auto recipient = transfer->target.lock();
+    if (accepted && recipient) {
+      recipient->post([recipient, transfer] {
+        recipient->get_relay().finished(transfer, false);
+      });
+    }
+    return;
+  }
+  if (accepted) {
+    transfer->accepted = true;
+    session_.deliver("file_accepted:" + transfer->target_name + ":" +
+                     std::to_string(transfer->resume_offset));
+  } else {
+    outgoing_.erase(it);
+    session_.deliver("file_declined:" + transfer->target_name);
+  }
+}
+
+boost::asio::awaitable<void> file_relay::relay_chunk(std::string_view header) {
+  // file_data:<player>:<offset>:<length>:<checksum>
+  std::string_view rest, target_view, offset_text, length_text, checksum;
+  std::size_t offset = 0;
+  std::size_t length = 0;
+  if (!split_last(header.substr(data_prefix.size()), rest, checksum) ||
+      !split_last(rest, rest, length_text) ||
+      !split_last(rest, target_view, offset_text) || !is_checksum(checksum) ||
+      !parse_size(offset_text, offset) || !parse_size(length_text, length) ||
+      length == 0 || length > max_chunk) {
+    // Without a trustworthy length there is no telling where the payload
+    // ends, so the stream can't be resynchronised.
+    utils::Logger::instance().log("Malformed file_data header from " +
+                                  session_.get_player()->get_name());
+    session_.stop();
+    co_return;
+  }
+  std::string target(target_view);
+
+  // The chunk is read straight into the message the recipient will get.
+  std::string frame = "file_data:" + std::to_string(offset) + ":" +
+                      std::to_string(length) + ":" + std::string(checksum) +
+                      "\n";
+  std::size_t payload_offset = frame.size();
+  frame.resize(payload_offset + length);
+  if (!co_await session_.read_raw(frame.data() + payload_offset, length)) {
+    co_return;
+  }
+
+  auto it = outgoing_.find(target);
+  if (it == outgoing_.end() || !it->second->accepted) {
+    session_.deliver(utils::color::system("No accepted file transfer to " +
+                                          target + "."));
+    co_return;
+  }
+  auto transfer = it->second;
+  auto recipient = transfer->target.lock();
+  if (!recipient) {
+    // Its cancel_all() is already on the way to us.
+    co_return;
+  }
+  if (offset + length > transfer->size) {
+    session_.deliver(utils::color::system("File data to " + target +
+                                          " exceeds the offered size."));
+    co_return;
+  }
+
+  if (recipient->telnet_mode()) {
+    std::string escaped = frame.substr(0, payload_offset);
+    telnet_protocol::escape(
+        std::string_view(frame).substr(payload_offset), escaped);
+    frame = std::move(escaped);
+  }
+  transfer->in_flight.fetch_add(length);
+  recipient->deliver(shared_message(new std::string(std::move(frame)),
+                                    [transfer, length](const std::string *p) {
+                                      delete p;
+                                      transfer->release(length);
+                                    }));
+  utils::Metrics::instance().file_bytes_relayed.fetch_add(
+      length, std::memory_order_relaxed);
+
+  boost::system::error_code ec;
+  while (transfer->in_flight.load() > window && !closed_ &&
+         outgoing_.find(target) != outgoing_.end()) {
+    transfer->sender_waiting = true;
+    // Re-check after publishing the flag, or a release() in between
+    // would find nobody waiting and never wake us.
+    if (transfer->in_flight.load() <= window) {
+      transfer->sender_waiting = false;
+      break;
+    }
+    co_await signal_.async_wait(
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+  }
+}
+
+void file_relay::wake() { signal_.cancel(); }
+
+void file_relay::report(std::string_view args, std::string_view kind) {
+  // file_ack:<sender>:<offset> / file_nack:<sender>:<offset>
+  std::string_view sender_name, offset_text;
+  std::size_t offset = 0;
+  if (!split_last(args, sender_name, offset_text) ||
+      !parse_size(offset_text, offset)) {
+    return;
+  }
+  auto it = incoming_.find(sender_name);
+  if (it == incoming_.end() || !it->second->answered) {
+    return;
+  }
+  auto transfer = it->second;
+  if (auto sender = transfer->sender.lock()) {
+    sender->post([sender, transfer,
+                  line = std::string(kind) + transfer->target_name + ":" +
+                         std::to_string(offset)]() mutable {
+      sender->get_relay().reported(transfer, std::move(line));
+    });
+  }
+}
+
+void file_relay::reported(std::shared_ptr<file_transfer> transfer,
+                          std::string line) {
+  auto it = outgoing_.find(transfer->target_name);
+  if (it != outgoing_.end() && it->second == transfer) {
+    session_.deliver(std::move(line));
+  }
+}
+
+void file_relay::end(std::string_view args) {
+  // file_end:<player>:<checksum of the whole file>
+  std::string_view target, checksum;
+  if (!split_last(args, target, checksum) || !is_checksum(checksum)) {
+    target = args;
+    checksum = {};
+  }
+  auto it = outgoing_.find(target);
+  if (it == outgoing_.end() || !it->second->accepted) {
+    session_.deliver(utils::color::system("No accepted file transfer to " +
+                                          std::string(target) + "."));
+    return;
+  }
+  auto transfer = it->second;
+  outgoing_.erase(it);
+  transfer->checksum = std::string(checksum);
+  utils::Metrics::instance().files_relayed.fetch_add(
+      1, std::memory_order_relaxed);
+  // Posted behind the chunks on the recipient's strand, so file_end is
+  // queued after the last of them. Whether the file arrived intact is
+  // for the recipient to check against the checksum.
+  if (auto recipient = transfer->target.lock()) {
+    recipient->post([recipient, transfer] {
+      recipient->get_relay().finished(transfer, true);
+    });
+  }
+}
+
+void file_relay::finished(std::shared_ptr<file_transfer> transfer,
+                          bool complete) {
+  auto it = incoming_.find(transfer->sender_name);
+  if (it == incoming_.end() || it->second != transfer) {
+    return;
+  }
+  incoming_.erase(it);
+  if (!complete) {
+    session_.deliver("file_cancelled:" + transfer->sender_name);
+  } else if (transfer->checksum.empty()) {
+    session_.deliver("file_end:" + transfer->sender_name);
+  } else {
+    session_.deliver("file_end:" + transfer->sender_name + ":" +
+                     transfer->checksum);
+  }
+}
+
+void file_relay::cancelled(std::shared_ptr<file_transfer> transfer) {
+  auto it = outgoing_.find(transfer->target_name);
+  if (it == outgoing_.end() || it->second != transfer) {
+    return;
+  }
+  outgoing_.erase(it);
+  session_.deliver("file_cancelled:" + transfer->target_name);
+  signal_.cancel();
+}
+
+void file_relay::cancel_all() {
+  closed_ = true;
+  for (auto &[name, transfer] : outgoing_) {
+    if (auto recipient = transfer->target.lock()) {
+      recipient->post([recipient, transfer] {
+        recipient->get_relay().finished(transfer, false);
+      });
+    }
+  }
+  for (auto &[name, transfer] : incoming_) {
+    if (auto sender = transfer->sender.lock()) {
+      sender->post([sender, transfer] {
+        sender->get_relay().cancelled(transfer);
+      });
+    }
+  }
+  outgoing_.clear();
+  incoming_.clear();
+  signal_.cancel();
+}
+} // namespace mud
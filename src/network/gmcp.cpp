@@ -0,0 +1,50 @@
+#include "network/gmcp.hpp"
+#include "world/room.hpp"
+#include <nlohmann/json.hpp>
+
+namespace mud {
+namespace gmcp {
+
+namespace {
+// Names are checked at login and the rest comes from the data files, but
+// a stray byte must not throw on an io thread.
+std::string dump(const nlohmann::json &j) {
+  return j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+} // namespace
+
+std::string room_info(const world::Room &room) {
+  nlohmann::json exits = nlohmann::json::object();
+  for (const auto &[direction, target] : room.get_exits()) {
+    exits[direction] = target;
+  }
+  return dump({{"id", room.get_id()},
+               {"name", room.get_name()},
+               {"description", room.get_description()},
+               {"width", room.get_width()},
+               {"height", room.get_height()},
+               {"exits", exits}});
+}
+
+std::string char_position(const world::Room &room, int x, int y) {
+  return dump({{"room", room.get_id()}, {"x", x}, {"y", y}});
+}
+
+std::string room_players(const std::vector<std::string> &names) {
+  nlohmann::json players = nlohmann::json::array();
+  for (const auto &name : names) {
+    players.push_back({{"name", name}});
+  }
+  return dump(players);
+}
+
+std::string room_add_player(const std::string &name) {
+  return dump({{"name", name}});
+}
+
+std::string room_remove_player(const std::string &name) {
+  return dump(nlohmann::json(name));
+}
+
+} // namespace gmcp
+} // namespace mud
@@ -0,0 +1,171 @@
+#include "network/handler_memory.hpp"
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <vector>
+
+namespace mud {
+
+namespace {
+// Handler storage is small: a lambda with a couple of shared_ptrs plus
+// Asio's op header. Larger requests go straight to the heap.
+constexpr std::array<std::size_t, 4> block_sizes = {64, 128, 256, 512};
+// Blocks kept per size per thread. Past that, half of them move to the
+// shared pool so a thread that only frees (say, the one running a shard
+// strand) hands blocks back to threads that only allocate.
+constexpr std::size_t max_cached = 128;
+constexpr std::size_t batch_size = max_cached / 2;
+// Batches kept in the shared pool per size; the rest are released.
+constexpr std::size_t max_shared_batches = 64;
+
+const char *op_names[] = {"deliver", "shard post", "accept", "file"};
+
+int size_class(std::size_t size) {
+  for (std::size_t i = 0; i < block_sizes.size(); ++i) {
+    if (size <= block_sizes[i]) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+struct free_block {
+  free_block *next;
+};
+
+void release_chain(free_block *head) {
+  while (head) {
+    auto *next = head->next;
+    ::operator delete(head);
+    head = next;
+  }
+}
+
+// Batches of batch_size blocks, exchanged with thread caches under a lock
+// taken once per batch rather than once per block.
+struct shared_pool {
+  std::mutex mutex;
+  std::array<std::vector<free_block *>, block_sizes.size()> batches;
+
+  free_block *take(int cls) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &list = batches[cls];
+    if (list.empty()) {
+      return nullptr;
+    }
+    auto *head = list.back();
+    list.pop_back();
+    return head;
+  }
+
+  void give(int cls, free_block *head) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto &list = batches[cls];
+      if (list.size() < max_shared_batches) {
+        list.push_back(head);
+        return;
+      }
+    }
+    release_chain(head);
+  }
+};
+
+shared_pool &pool() {
+  // Leaked on purpose: thread caches may flush into it during exit.
+  static auto *instance = new shared_pool;
+  return *instance;
+}
+
+struct thread_cache {
+  std::array<free_block *, block_sizes.size()> heads{};
+  std::array<std::size_t, block_sizes.size()> counts{};
+
+  ~thread_cache() {
+    for (auto *head : heads) {
+      release_chain(head);
+    }
+  }
+};
+
+thread_cache &local_cache() {
+  thread_local thread_cache cache;
+  return cache;
+}
+
+std::size_t index_of(handler_op op) { return static_cast<std::size_t>(op); }
+} // namespace
+
+std::array<std::atomic<std::uint64_t>,
+           static_cast<std::size_t>(handler_op::count_)>
+    handler_memory::heap_{};
+std::array<std::atomic<std::uint64_t>,
+           static_cast<std::size_t>(handler_op::count_)>
+    handler_memory::recycled_{};
+
+void *handler_memory::allocate(handler_op op, std::size_t size) {
+  int cls = size_class(size);
+  if (cls >= 0) {
+    auto &cache = local_cache();
+    if (!cache.heads[cls]) {
+      if ((cache.heads[cls] = pool().take(cls))) {
+        cache.counts[cls] = batch_size;
+      }
+    }
+    if (auto *block = cache.heads[cls]) {
+      cache.heads[cls] = block->next;
+      --cache.counts[cls];
+      recycled_[index_of(op)].fetch_add(1, std::memory_order_relaxed);
+      return block;
+    }
+    size = block_sizes[cls];
+  }
+  heap_[index_of(op)].fetch_add(1, std::memory_order_relaxed);
+  return ::operator new(size);
+}
+
+void handler_memory::deallocate(void *p, std::size_t size) {
+  int cls = size_class(size);
+  if (cls >= 0) {
+    auto &cache = local_cache();
+    auto *block = static_cast<free_block *>(p);
+    block->next = cache.heads[cls];
+    cache.heads[cls] = block;
+    if (++cache.counts[cls] == max_cached) {
+      // Split off the first batch_size blocks for the shared pool.
+      auto *last = cache.heads[cls];
+      for (std::size_t i = 1; i < batch_size; ++i) {
+        last = last->next;
+      }
+      auto *batch = cache.heads[cls];
+      cache.heads[cls] = last->next;
+      last->next = nullptr;
+      cache.counts[cls] -= batch_size;
+      pool().give(cls, batch);
+    }
+    return;
+  }
+  ::operator delete(p);
+}
+
+std::uint64_t handler_memory::heap_allocations(handler_op op) {
+  return heap_[index_of(op)].load(std::memory_order_relaxed);
+}
+
+std::uint64_t handler_memory::recycled(handler_op op) {
+  return recycled_[index_of(op)].load(std::memory_order_relaxed);
+}
+
+std::string handler_memory::report() {
+  std::ostringstream ss;
+  for (std::size_t i = 0; i < index_of(handler_op::count_); ++i) {
+    if (i > 0) {
+      ss << ", ";
+    }
+    auto op = static_cast<handler_op>(i);
+    ss << op_names[i] << ": " << heap_allocations(op) << " heap / "
+       << recycled(op) << " recycled";
+  }
+  return ss.str();
+}
+} // namespace mud
@@ -0,0 +1,288 @@
+#include "network/handoff.hpp"
+#include <nlohmann/json.hpp>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#if defined(MUD_HAS_HANDOFF)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace mud::handoff {
+
+using json = nlohmann::json;
+
+collector::collector(std::size_t shards, std::function<void(state)> done)
+    : shards_left_(shards), done_(std::move(done)) {}
+
+void collector::add_listener(listener l) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  state_.listeners.push_back(l);
+}
+
+void collector::expect_session() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++sessions_expected_;
+}
+
+void collector::add_session(detached_session s) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  --sessions_expected_;
+  if (s.fd != invalid_handle) {
+    state_.sessions.push_back(std::move(s));
+  }
+  finish(lock);
+}
+
+void collector::shard_done() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  --shards_left_;
+  finish(lock);
+}
+
+void collector::finish(std::unique_lock<std::mutex> &lock) {
+  if (shards_left_ > 0 || sessions_expected_ > 0 || !done_) {
+    return;
+  }
+  auto done = std::move(done_);
+  state s = std::move(state_);
+  lock.unlock();
+  done(std::move(s));
+}
+
+namespace {
+const char *protocol_name(wire_protocol protocol) {
+  return protocol == wire_protocol::binary ? "binary" : "text";
+}
+
+wire_protocol parse_protocol(const std::string &name) {
+  return name == "binary" ? wire_protocol::binary : wire_protocol::text;
+}
+
+// Received bytes (input, a TTYPE reply, a name) may be anything, and JSON
+// strings must be UTF-8.
+std::string to_hex(const std::string &bytes) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(bytes.size() * 2);
+  for (unsigned char c : bytes) {
+    hex.push_back(digits[c >> 4]);
+    hex.push_back(digits[c & 0xF]);
+  }
+  return hex;
+}
+
+std::string from_hex(const std::string &hex) {
+  auto value = [](char c) {
+    return c <= '9' ? c - '0' : c - 'a' + 10;
+  };
+  std::string bytes;
+  bytes.reserve(hex.size() / 2);
+  for (std::size_t i = 0; i + 1 < hex.size(); i += 2) {
+    bytes.push_back(static_cast<char>(value(hex[i]) << 4 | value(hex[i + 1])));
+  }
+  return bytes;
+}
+
+json to_json(const session_state &s) {
+  return {{"type", "session"},
+          {"protocol", protocol_name(s.protocol)},
+          {"name", to_hex(s.name)},
+          {"room", s.room},
+          {"x", s.x},
+          {"y", s.y},
+          {"telnet_mode", s.telnet_mode},
+          {"telnet_active", s.telnet_active},
+          {"gmcp_enabled", s.gmcp_enabled},
+          {"gmcp_modules", s.gmcp_modules},
+          {"compress", s.compress},
+          {"width", s.width},
+          {"height", s.height},
+          {"terminal_type", to_hex(s.terminal_type)},
+          {"input", to_hex(s.input)}};
+}
+
+session_state from_json(const json &j) {
+  session_state s;
+  s.protocol = parse_protocol(j.value("protocol", "text"));
+  s.name = from_hex(j.value("name", ""));
+  s.room = j.value("room", "");
+  s.x = j.value("x", 0);
+  s.y = j.value("y", 0);
+  s.telnet_mode = j.value("telnet_mode", false);
+  s.telnet_active = j.value("telnet_active", false);
+  s.gmcp_enabled = j.value("gmcp_enabled", false);
+  s.gmcp_modules = j.value("gmcp_modules", std::set<std::string>{});
+  s.compress = j.value("compress", false);
+  s.width = j.value("width", 0);
+  s.height = j.value("height", 0);
+  s.terminal_type = from_hex(j.value("terminal_type", ""));
+  s.input = from_hex(j.value("input", ""));
+  return s;
+}
+
+#if defined(MUD_HAS_HANDOFF)
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+bool send_record(native_handle control, const json &record, native_handle fd) {
+  // Everything client-supplied is hex already; a stray byte elsewhere must
+  // not abort the hand-off halfway.
+  std::string text =
+      record.dump(-1, ' ', false, json::error_handler_t::replace);
+  iovec iov{text.data(), text.size()};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  alignas(cmsghdr) char control_data[CMSG_SPACE(sizeof(int))];
+  if (fd != invalid_handle) {
+    msg.msg_control = control_data;
+    msg.msg_controllen = sizeof(control_data);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  return ::sendmsg(control, &msg, MSG_NOSIGNAL) ==
+         static_cast<ssize_t>(text.size());
+}
+
+// Returns false once the connection is closed or broken.
+bool receive_record(native_handle control, json &record, native_handle &fd) {
+  // Larger than any record: pending input is at most one frame buffer.
+  std::vector<char> buffer(64 * 1024);
+  iovec iov{buffer.data(), buffer.size()};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  alignas(cmsghdr) char control_data[CMSG_SPACE(sizeof(int))];
+  msg.msg_control = control_data;
+  msg.msg_controllen = sizeof(control_data);
+
+  ssize_t length = ::recvmsg(control, &msg, 0);
+  if (length <= 0) {
+    return false;
+  }
+  fd = invalid_handle;
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  record = json::parse(buffer.data(), buffer.data() + length, nullptr, false);
+  return !record.is_discarded();
+}
+#endif
+} // namespace
+
+bool send(native_handle control, const state &s) {
+#if defined(MUD_HAS_HANDOFF)
+  for (const auto &l : s.listeners) {
+    if (!send_record(control,
+                     {{"type", "listener"}, {"protocol", protocol_name(l.protocol)}},
+                     l.fd)) {
+      return false;
+    }
+  }
+  for (const auto &session : s.sessions) {
+    if (!send_record(control, to_json(session.state), session.fd)) {
+      return false;
+    }
+  }
+  return send_record(control, {{"type", "end"}}, invalid_handle);
+#else
+  return false;
+#endif
+}
+
+bool receive(const std::string &path, state &out) {
+#if defined(MUD_HAS_HANDOFF)
+  sockaddr_un address{};
+  if (path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Hand-off path too long: " << path << std::endl;
+    return false;
+  }
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  native_handle control = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (control < 0) {
+    return false;
+  }
+  if (::connect(control, reinterpret_cast<sockaddr *>(&address),
+                sizeof(address)) != 0) {
+    // Nobody to take over from.
+    ::close(control);
+    return false;
+  }
+
+  json record;
+  native_handle fd = invalid_handle;
+  bool ended = false;
+  while (!ended && receive_record(control, record, fd)) {
+    auto type = record.value("type", "");
+    if (type == "listener" && fd != invalid_handle) {
+      out.listeners.push_back(
+          {fd, parse_protocol(record.value("protocol", "text"))});
+    } else if (type == "session" && fd != invalid_handle) {
+      out.sessions.push_back({fd, from_json(record)});
+    } else if (type == "end") {
+      ended = true;
+    } else if (fd != invalid_handle) {
+      ::close(fd);
+    }
+  }
+  ::close(control);
+  if (!ended) {
+    std::cerr << "Hand-off from " << path << " ended early" << std::endl;
+  }
+  if (out.listeners.empty()) {
+    close_all(out);
+    return false;
+  }
+  // Sessions that did arrive are still connected; keep them even if the
+  // old server died half way.
+  return true;
+#else
+  return false;
+#endif
+}
+
+void close_all(state &s) {
+#if defined(MUD_HAS_HANDOFF)
+  for (auto &l : s.listeners) {
+    ::close(l.fd);
+  }
+  for (auto &session : s.sessions) {
+    ::close(session.fd);
+  }
+#endif
+  s.listeners.clear();
+  s.sessions.clear();
+}
+
+native_handle duplicate(native_handle fd) {
+#if defined(MUD_HAS_HANDOFF)
+  return ::dup(fd);
+#else
+  return invalid_handle;
+#endif
+}
+
+boost::asio::ip::tcp protocol_of(native_handle fd) {
+#if defined(MUD_HAS_HANDOFF)
+  sockaddr_storage address{};
+  socklen_t length = sizeof(address);
+  if (::getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) == 0 &&
+      address.ss_family == AF_INET6) {
+    return boost::asio::ip::tcp::v6();
+  }
+#endif
+  return boost::asio::ip::tcp::v4();
+}
+
+} // namespace mud::handoff
@@ -0,0 +1,84 @@
+#include "network/line_framer.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace mud {
+
+line_framer::line_framer(std::size_t capacity, std::size_t max_line_length)
+    : buffer_(std::max(capacity, max_line_length + 2)),
+      max_line_length_(max_line_length) {}
+
+boost::asio::mutable_buffer line_framer::prepare() {
+  if (begin_ > 0) {
+    std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+    scan_ -= begin_;
+    end_ -= begin_;
+    begin_ = 0;
+  }
+  return boost::asio::buffer(buffer_.data() + end_, buffer_.size() - end_);
+}
+
+void line_framer::commit(std::size_t bytes) { end_ += bytes; }
+
+bool line_framer::next_line(std::string_view &line) {
+  while (true) {
+    const char *first = buffer_.data() + scan_;
+    const char *last = buffer_.data() + end_;
+    const char *newline = std::find(first, last, '\n');
+
+    if (newline == last) {
+      scan_ = end_;
+      // A trailing '\r' may be the first half of a "\r\n" split across
+      // reads, so it doesn't count towards the line.
+      std::size_t partial = end_ - begin_;
+      if (partial > 0 && buffer_[end_ - 1] == '\r') {
+        --partial;
+      }
+      if (discarding_ || partial > max_line_length_) {
+        // Never buffer more than one line's worth of a runaway line.
+        if (!discarding_) {
+          overflow_ = true;
+        }
+        discarding_ = true;
+        begin_ = scan_ = end_;
+      }
+      return false;
+    }
+
+    std::size_t line_begin = begin_;
+    std::size_t line_end = static_cast<std::size_t>(newline - buffer_.data());
+    begin_ = scan_ = line_end + 1;
+
+    if (discarding_) {
+      // Tail of a line that was already reported as too long.
+      discarding_ = false;
+      continue;
+    }
+    if (line_end > line_begin && buffer_[line_end - 1] == '\r') {
+      --line_end;
+    }
+    if (line_end - line_begin > max_line_length_) {
+      overflow_ = true;
+      continue;
+    }
+    line = std::string_view(buffer_.data() + line_begin, line_end - line_begin);
+    return true;
+  }
+}
+
+bool line_framer::take_overflow() {
+  bool overflow = overflow_;
+  overflow_ = false;
+  return overflow;
+}
+
+std::string_view line_framer::take(std::size_t max_bytes) {
+  std::size_t bytes = std::min(max_bytes, end_ - begin_);
+  std::string_view taken(buffer_.data() + begin_, bytes);
+  begin_ += bytes;
+  scan_ = std::max(scan_, begin_);
+  return taken;
+}
+
+std::size_t line_framer::max_line_length() const { return max_line_length_; }
+} // namespace mud
@@ -0,0 +1,87 @@
+#include "network/mccp.hpp"
+#include <iterator>
+
+namespace mud {
+
+mccp_compressor::~mccp_compressor() {
+  if (active_) {
+    deflateEnd(&stream_);
+  }
+}
+
+bool mccp_compressor::start() {
+  if (active_) {
+    return true;
+  }
+  active_ = deflateInit(&stream_, Z_DEFAULT_COMPRESSION) == Z_OK;
+  return active_;
+}
+
+bool mccp_compressor::active() const { return active_; }
+
+bool mccp_compressor::compress(
+    std::vector<boost::asio::const_buffer>::const_iterator first,
+    std::vector<boost::asio::const_buffer>::const_iterator last,
+    std::vector<char> &out) {
+  auto started = std::chrono::steady_clock::now();
+  std::size_t begin = out.size();
+
+  for (auto it = first; it != last; ++it) {
+    stream_.next_in =
+        static_cast<Bytef *>(const_cast<void *>(it->data()));
+    stream_.avail_in = static_cast<uInt>(it->size());
+    bytes_in_ += it->size();
+    int flush = std::next(it) == last ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    do {
+      std::size_t used = out.size();
+      out.resize(used + deflateBound(&stream_, stream_.avail_in) + 16);
+      stream_.next_out = reinterpret_cast<Bytef *>(out.data() + used);
+      stream_.avail_out = static_cast<uInt>(out.size() - used);
+      if (deflate(&stream_, flush) == Z_STREAM_ERROR) {
+        out.resize(used);
+        return false;
+      }
+      out.resize(out.size() - stream_.avail_out);
+    } while (stream_.avail_out == 0);
+  }
+
+  bytes_out_ += out.size() - begin;
+  cpu_time_ += std::chrono::steady_clock::now() - started;
+  return true;
+}
+
+bool mccp_compressor::finish(std::vector<char> &out) {
+  if (!active_) {
+    return true;
+  }
+  std::size_t begin = out.size();
+  stream_.next_in = nullptr;
+  stream_.avail_in = 0;
+  int result = Z_OK;
+  do {
+    std::size_t used = out.size();
+    out.resize(used + 64);
+    stream_.next_out = reinterpret_cast<Bytef *>(out.data() + used);
+    stream_.avail_out = static_cast<uInt>(out.size() - used);
+    result = deflate(&stream_, Z_FINISH);
+    out.resize(out.size() - stream_.avail_out);
+  } while (result == Z_OK);
+  bytes_out_ += out.size() - begin;
+  deflateEnd(&stream_);
+  stream_ = z_stream{};
+  active_ = false;
+  return result == Z_STREAM_END;
+}
+
+std::uint64_t mccp_compressor::bytes_in() const { return bytes_in_; }
+
+std::uint64_t mccp_compressor::bytes_out() const { return bytes_out_; }
+
+std::chrono::nanoseconds mccp_compressor::cpu_time() const {
+  return cpu_time_;
+}
+
+double mccp_compressor::ratio() const {
+  return bytes_out_ == 0 ? 0.0 : static_cast<double>(bytes_in_) / bytes_out_;
+}
+} // namespace mud
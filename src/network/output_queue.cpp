@@ -0,0 +1,160 @@
+#include "network/output_queue.hpp"
+#include "network/binary_protocol.hpp"
+#include <string>
+#include <utility>
+
+namespace mud {
+
+namespace {
+// msg with " (xcount)" added to its text, or null if msg is not a line
+// of text (telnet negotiation, GMCP, binary data frames).
+shared_message mark_repeat(const std::string &msg, std::size_t count,
+                           wire_protocol protocol) {
+  std::string suffix = " (x" + std::to_string(count) + ")";
+  if (protocol == wire_protocol::binary) {
+    return binary::is_event(msg)
+               ? make_raw_message(binary::append_to_event(msg, suffix))
+               : nullptr;
+  }
+  if (msg.empty() || msg.back() != '\n') {
+    return nullptr;
+  }
+  std::size_t end = msg.size() - 1;
+  if (end > 0 && msg[end - 1] == '\r') {
+    --end;
+  }
+  std::string marked = msg;
+  marked.insert(end, suffix);
+  return make_raw_message(std::move(marked));
+}
+} // namespace
+
+output_queue::output_queue(const output_budget &budget, wire_protocol protocol)
+    : budget_(budget), protocol_(protocol) {}
+
+output_queue::push_result
+output_queue::push(shared_message msg, message_lane lane,
+                   std::chrono::steady_clock::time_point now) {
+  if (lane == message_lane::priority &&
+      priority_bytes_ + msg->size() > budget_.max_priority_bytes) {
+    return push_result::disconnect;
+  }
+  if (!over_budget(msg->size(), 1)) {
+    over_budget_ = false;
+  } else {
+    if (!over_budget_) {
+      over_budget_ = true;
+      over_budget_since_ = now;
+    }
+    if (budget_.policy == slow_consumer_policy::disconnect &&
+        now - over_budget_since_ >= budget_.grace) {
+      return push_result::disconnect;
+    }
+    if (lane == message_lane::bulk) {
+      auto &bulk = lanes_[static_cast<std::size_t>(message_lane::bulk)];
+      switch (budget_.policy) {
+      case slow_consumer_policy::collapse_repeats:
+        if (collapse(msg)) {
+          ++collapsed_;
+          return push_result::collapsed;
+        }
+        ++dropped_;
+        return push_result::dropped;
+      case slow_consumer_policy::drop_chat:
+        ++dropped_;
+        return push_result::dropped;
+      case slow_consumer_policy::disconnect:
+        break;
+      }
+    }
+  }
+
+  queued_bytes_ += msg->size();
+  if (lane == message_lane::priority) {
+    priority_bytes_ += msg->size();
+  } else {
+    last_bulk_ = msg;
+    repeats_ = 1;
+  }
+  lanes_[static_cast<std::size_t>(lane)].push_back(std::move(msg));
+  return push_result::queued;
+}
+
+bool output_queue::collapse(const shared_message &msg) {
+  constexpr auto lane = static_cast<std::size_t>(message_lane::bulk);
+  auto &bulk = lanes_[lane];
+  if (bulk.size() <= in_flight_[lane] || !last_bulk_ ||
+      *last_bulk_ != *msg) {
+    return false;
+  }
+  auto marked = mark_repeat(*last_bulk_, repeats_ + 1, protocol_);
+  if (!marked) {
+    return false;
+  }
+  ++repeats_;
+  queued_bytes_ += marked->size();
+  queued_bytes_ -= bulk.back()->size();
+  bulk.back() = std::move(marked);
+  return true;
+}
+
+bool output_queue::empty() const {
+  return lanes_[0].empty() && lanes_[1].empty();
+}
+
+bool output_queue::writing() const {
+  return in_flight_[0] != 0 || in_flight_[1] != 0;
+}
+
+std::size_t
+output_queue::gather(std::vector<boost::asio::const_buffer> &buffers,
+                     std::size_t max_bytes) {
+  buffers.clear();
+  std::size_t bytes = 0;
+  for (std::size_t lane = 0; lane < lanes_.size(); ++lane) {
+    in_flight_[lane] = 0;
+    for (const auto &msg : lanes_[lane]) {
+      if (!buffers.empty() && bytes + msg->size() > max_bytes) {
+        return bytes;
+      }
+      buffers.push_back(boost::asio::buffer(*msg));
+      bytes += msg->size();
+      ++in_flight_[lane];
+    }
+  }
+  return bytes;
+}
+
+void output_queue::consume() {
+  for (std::size_t lane = 0; lane < lanes_.size(); ++lane) {
+    auto &queue = lanes_[lane];
+    for (std::size_t i = 0; i < in_flight_[lane]; ++i) {
+      queued_bytes_ -= queue.front()->size();
+      if (lane == static_cast<std::size_t>(message_lane::priority)) {
+        priority_bytes_ -= queue.front()->size();
+      }
+      queue.pop_front();
+    }
+    in_flight_[lane] = 0;
+  }
+  if (!over_budget(0, 0)) {
+    over_budget_ = false;
+  }
+}
+
+std::size_t output_queue::queued_bytes() const { return queued_bytes_; }
+
+std::size_t output_queue::queued_messages() const {
+  return lanes_[0].size() + lanes_[1].size();
+}
+
+std::uint64_t output_queue::dropped() const { return dropped_; }
+
+std::uint64_t output_queue::collapsed() const { return collapsed_; }
+
+bool output_queue::over_budget(std::size_t extra_bytes,
+                               std::size_t extra_messages) const {
+  return queued_bytes_ + extra_bytes > budget_.max_bytes ||
+         queued_messages() + extra_messages > budget_.max_messages;
+}
+} // namespace mud
@@ -2,95 +2,477 @@
 #include "network/session.hpp"
 #include "utils/color.hpp"
 #include "utils/logger.hpp"
+#include "utils/metrics.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 #include <utility>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace mud {
+
+namespace {
+void pin_current_thread(std::size_t core) {
+  std::size_t cores = std::thread::hardware_concurrency();
+  if (cores == 0) {
+    return;
+  }
+  core %= cores;
+#if defined(_WIN32)
+  SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (core % 64));
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+} // namespace
+
+const char *server::io_backend() {
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+  return "io_uring";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+  return "iocp";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+  return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+  return "kqueue";
+#else
+  return "select";
+#endif
+}
+
 server::server(boost::asio::io_context &io_context, const tcp::endpoint &endpoint,
-               const std::string &data_path)
-    : io_context_(io_context), acceptor_(io_context, endpoint),
+               const std::string &data_path, const server_options &options)
+    : options_(options), data_path_(data_path),
       world_(data_path + "/maps"),
-      command_manager_(data_path + "/commands.json") {
-  do_accept();
-}
+      command_manager_(
+          std::make_shared<const CommandManager>(data_path + "/commands.json")),
+      bus_(shards_) {
+  if (options_.threads == 0) {
+    options_.threads = 1;
+  }
+  if (options_.tick_rate > 0) {
+    ticks_ = std::make_unique<world::TickScheduler>(options_.tick_rate);
+    timers_ = std::make_unique<world::TimingWheel>(ticks_->period());
+    ticks_->add_system("timers", [this](std::uint64_t) {
+      timers_->advance(std::chrono::steady_clock::now());
+    });
+    // Last, so it also sends what the other systems published.
+    ticks_->add_system("events", [this](std::uint64_t) { bus_.flush(); });
+  } else {
+    timers_ = std::make_unique<world::TimingWheel>(default_timer_resolution);
+  }
+  auto listen = [this, &endpoint](shard &s, bool reuse_port) {
+    s.listen(endpoint, reuse_port);
+    if (options_.binary_port != 0) {
+      s.listen(tcp::endpoint(endpoint.address(), options_.binary_port),
+               reuse_port, wire_protocol::binary);
+    }
+  };
 
-void server::run() { io_context_.run(); }
+  // Shard 0 runs on the caller's io_context; in sharded mode the rest own
+  // theirs.
+  shards_.push_back(std::make_unique<shard>(*this, 0, &io_context));
+  if (options_.mode == io_mode::sharded) {
+    for (std::size_t i = 1; i < options_.threads; ++i) {
+      shards_.push_back(std::make_unique<shard>(*this, i));
+    }
+  }
 
-void server::join(chat_participant_ptr participant) {
-    sessions_.insert(participant);
+  // The maps and commands are loaded by now, so the old process only
+  // stops serving for the hand-off itself.
+  handoff::state inherited;
+  if (!options_.handoff_path.empty() &&
+      handoff::receive(options_.handoff_path, inherited)) {
+    take_over(std::move(inherited));
+  } else if (options_.mode == io_mode::pool) {
+    listen(*shards_[0], false);
+  } else {
+#if defined(SO_REUSEPORT)
+    shared_acceptor_ = false;
+    for (auto &s : shards_) {
+      listen(*s, true);
+    }
+#else
+    listen(*shards_[0], false);
+#endif
+  }
+  if (!options_.handoff_path.empty()) {
+    listen_for_handoff();
+  }
+  if (!ticks_) {
+    timer_driver_ = std::make_unique<boost::asio::steady_timer>(
+        shards_[0]->get_io_context());
+    drive_timers();
+  }
+#if defined(MUD_HAS_DATA_WATCHER)
+  if (options_.reload) {
+    reload_pool_ = std::make_unique<boost::asio::thread_pool>(1);
+    watcher_ = std::make_unique<data_watcher>(
+        shards_[0]->get_io_context(), data_path_,
+        [this](data_watcher::change change) { reload(std::move(change)); });
+  }
+#endif
 }
 
-void server::leave(chat_participant_ptr participant) {
-    auto session_ptr = std::dynamic_pointer_cast<mud::session>(participant);
-    if (session_ptr && session_ptr->get_player()) {
-        std::string username = session_ptr->get_player()->get_name();
-        // std::string msg = "\033[90m" + username + " has left the game.\033[0m";
-        std::string msg = utils::color::left(username + " has left the game.");
-        utils::Logger::instance().log(username + " has left the game.");
-        remove_player(username);
-        broadcast(msg, participant);
+void server::drive_timers() {
+  timer_driver_->expires_after(timers_->resolution());
+  timer_driver_->async_wait([this](const boost::system::error_code &ec) {
+    if (!ec) {
+      timers_->advance(std::chrono::steady_clock::now());
+      drive_timers();
     }
-    sessions_.erase(participant);
+  });
 }
 
-void server::broadcast(const std::string &msg, chat_participant_ptr sender) {
-    for (auto &participant : sessions_) {
-        auto s = std::dynamic_pointer_cast<mud::session>(participant);
-        if (s && s->is_logged_in() && participant != sender) {
-            s->deliver(msg);
+void server::reload(data_watcher::change change) {
+  bool commands = false;
+  bool maps = false;
+  for (const auto &file : change.files) {
+    std::filesystem::path path(file);
+    if (path.extension() != ".json") {
+      continue;
+    }
+    if (file == "commands.json") {
+      commands = true;
+    } else if (path.parent_path() == "maps") {
+      maps = true;
+    }
+  }
+  auto since = change.since;
+  boost::asio::post(*reload_pool_, [this, commands, maps, since] {
+    if (commands) {
+      reload_commands(since);
+    }
+    if (maps) {
+      reload_world(since);
+    }
+  });
+}
+
+namespace {
+// Counts a successful reload, and returns its latency for the log.
+std::string record_reload(data_watcher::clock::time_point since) {
+  auto elapsed = data_watcher::clock::now() - since;
+  auto &metrics = utils::Metrics::instance();
+  metrics.reloads.fetch_add(1, std::memory_order_relaxed);
+  metrics.reload_last_ns.store(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+      std::memory_order_relaxed);
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(1)
+     << std::chrono::duration<double, std::milli>(elapsed).count() << " ms";
+  return ss.str();
+}
+
+void reload_failed(const std::string &what, const std::exception &e) {
+  utils::Metrics::instance().reload_failures.fetch_add(
+      1, std::memory_order_relaxed);
+  utils::Logger::instance().log("Reloading " + what + " failed, keeping " +
+                                "the current version: " + e.what());
+}
+} // namespace
+
+void server::reload_commands(data_watcher::clock::time_point since) {
+  std::shared_ptr<const CommandManager> next;
+  try {
+    next = std::make_shared<const CommandManager>(
+        data_path_ + "/commands.json", command_manager_.load().get());
+  } catch (const std::exception &e) {
+    reload_failed("commands.json", e);
+    return;
+  }
+  // Commands already found keep the old table alive until they have run.
+  command_manager_.store(std::move(next));
+  utils::Logger::instance().log("Reloaded commands.json, " +
+                                record_reload(since) + " after the change");
+}
+
+void server::reload_world(data_watcher::clock::time_point since) {
+  auto next = std::make_shared<world::World::Snapshot>();
+  try {
+    *next = world::World::load(data_path_ + "/maps");
+    if (!next->rooms.count("town_square")) {
+      throw std::runtime_error("no map has the starting room, town_square");
+    }
+  } catch (const std::exception &e) {
+    reload_failed("the maps", e);
+    return;
+  }
+  // Swapped in on the tick, between commands, which read the rooms.
+  timers_->schedule(world::TimingWheel::clock::duration::zero(),
+                    [this, next, since] {
+    auto changed = world_.replace(std::move(*next));
+    std::string rooms;
+    for (const auto &id : changed) {
+      rooms += (rooms.empty() ? "" : ", ") + id;
+    }
+    utils::Logger::instance().log(
+        "Reloaded the maps (changed: " + (rooms.empty() ? "none" : rooms) +
+        "), " + record_reload(since) + " after the change");
+    if (changed.empty()) {
+      return;
+    }
+    // Players are found on their shards, then moved on the tick.
+    std::set<std::string> room_ids(changed.begin(), changed.end());
+    for (auto &s : shards_) {
+      shard &owner = *s;
+      owner.post([this, &owner, room_ids] {
+        auto players = owner.players_in(room_ids);
+        if (players.empty()) {
+          return;
         }
+        timers_->schedule(world::TimingWheel::clock::duration::zero(),
+                          [this, players] {
+          for (const auto &player : players) {
+            relocate(player);
+          }
+        });
+      });
     }
+  });
 }
 
-void server::broadcast_to_room(const std::string &msg,
-                               std::shared_ptr<world::Room> room,
-                               chat_participant_ptr sender) {
-  for (auto &participant : sessions_) {
-    if (participant != sender) {
-      auto s = std::dynamic_pointer_cast<mud::session>(participant);
-      if (s && s->is_logged_in() && s->get_player() &&
-          s->get_player()->get_room() == room) {
-        s->deliver(msg);
-      }
+void server::relocate(const std::shared_ptr<Player> &player) {
+  auto [room, x, y] = player->get_location();
+  if (!room) {
+    return;
+  }
+  auto current = world_.get_room(room->get_id());
+  if (current == room) {
+    // Already moved on since the reload.
+    return;
+  }
+  if (!current) {
+    // Gone from the new maps.
+    current = world_.get_room("town_square");
+    if (!current) {
+      return;
     }
+    x = current->get_width() / 2;
+    y = current->get_height() / 2;
   }
+  player->set_location(
+      current, std::clamp(x, 0, std::max(current->get_width() - 1, 0)),
+      std::clamp(y, 0, std::max(current->get_height() - 1, 0)));
 }
 
-std::shared_ptr<Player> server::add_player(const std::string &name) {
-    if (players_.find(name) != players_.end()) {
-        return nullptr;
+void server::take_over(handoff::state inherited) {
+  // Keep an acceptor per shard if the old process had one for each of
+  // ours; otherwise shard 0 accepts on all of them and spreads sockets.
+  auto text_listeners = std::count_if(
+      inherited.listeners.begin(), inherited.listeners.end(),
+      [](const handoff::listener &l) {
+        return l.protocol == wire_protocol::text;
+      });
+  shared_acceptor_ = static_cast<std::size_t>(text_listeners) < shards_.size();
+  std::size_t next[2] = {0, 0};
+  for (const auto &l : inherited.listeners) {
+    auto &index = next[l.protocol == wire_protocol::binary];
+    shard &target =
+        shared_acceptor_ ? *shards_[0] : *shards_[index++ % shards_.size()];
+    target.adopt(l.fd, l.protocol);
+  }
+
+  for (std::size_t i = 0; i < inherited.sessions.size(); ++i) {
+    auto &detached = inherited.sessions[i];
+    shard &target = *shards_[i % shards_.size()];
+    tcp::socket socket(boost::asio::make_strand(target.get_io_context()));
+    boost::system::error_code ec;
+    socket.assign(handoff::protocol_of(detached.fd), detached.fd, ec);
+    if (ec) {
+      std::cerr << "Failed to adopt connection: " << ec.message() << std::endl;
+      continue;
     }
-    auto player = std::make_shared<Player>(name);
-    players_[name] = player;
-    return player;
+    auto resumed = std::make_shared<session>(std::move(socket), *this, target,
+                                             detached.state.protocol);
+    resumed->resume(std::move(detached.state));
+  }
+  utils::Logger::instance().log(
+      "Took over " + std::to_string(inherited.sessions.size()) +
+      " connections from the previous server");
 }
 
-void server::remove_player(const std::string &name) {
-    players_.erase(name);
+void server::listen_for_handoff() {
+#if defined(MUD_HAS_HANDOFF)
+  // A server we took over from still holds the old path; replace it.
+  std::error_code ignored;
+  std::filesystem::remove(options_.handoff_path, ignored);
+  boost::asio::local::stream_protocol::endpoint path(options_.handoff_path);
+  handoff_acceptor_ = std::make_unique<control_acceptor>(
+      shards_[0]->get_io_context(),
+      control_protocol::endpoint(path.data(), path.size()));
+  handoff_acceptor_->async_accept(
+      [this](boost::system::error_code ec, control_protocol::socket control) {
+        if (!ec) {
+          hand_off(std::move(control));
+        }
+      });
+#endif
 }
 
-std::shared_ptr<Player> server::get_player_by_name(const std::string &name) {
-  auto it = players_.find(name);
-  if (it != players_.end()) {
-    return it->second;
+void server::hand_off(control_protocol::socket control) {
+  utils::Logger::instance().log("Handing off to a new server process");
+  auto shared_control =
+      std::make_shared<control_protocol::socket>(std::move(control));
+  drain([this, shared_control](handoff::state state) {
+    boost::system::error_code ignored;
+    shared_control->native_non_blocking(false, ignored);
+    if (!handoff::send(shared_control->native_handle(), state)) {
+      utils::Logger::instance().log("Hand-off failed; closing connections");
+    }
+    handoff::close_all(state);
+    stop();
+  });
+}
+
+void server::shutdown() {
+  utils::Logger::instance().log("Shutting down");
+  bus_.publish(topic::global(),
+               make_message(utils::color::system("The server is shutting down.")));
+  // Queued behind the publish on every shard, so it is flushed too.
+  drain([this](handoff::state state) {
+    handoff::close_all(state);
+    stop();
+  });
+}
+
+void server::drain(std::function<void(handoff::state)> done) {
+  if (draining_.exchange(true)) {
+    return;
+  }
+  if (handoff_acceptor_) {
+    boost::system::error_code ignored;
+    handoff_acceptor_->close(ignored);
+  }
+  auto collector =
+      std::make_shared<handoff::collector>(shards_.size(), std::move(done));
+  for (auto &s : shards_) {
+    shard &target = *s;
+    target.post([&target, collector] { target.detach_all(collector); });
   }
-  return nullptr;
 }
 
-world::World &server::get_world() { return world_; }
+void server::stop() {
+  for (auto &s : shards_) {
+    s->get_io_context().stop();
+  }
+  if (ticks_) {
+    ticks_->stop();
+  }
+}
 
-const CommandManager &server::get_command_manager() const {
-  return command_manager_;
+void server::run() {
+  std::vector<std::thread> workers;
+  if (ticks_) {
+    workers.emplace_back([this] { ticks_->run(); });
+  }
+  if (options_.mode == io_mode::pool) {
+    auto &io_context = shards_[0]->get_io_context();
+    workers.reserve(options_.threads - 1);
+    for (std::size_t i = 1; i < options_.threads; ++i) {
+      workers.emplace_back([&io_context] { io_context.run(); });
+    }
+    io_context.run();
+  } else {
+    workers.reserve(shards_.size() - 1);
+    for (std::size_t i = 1; i < shards_.size(); ++i) {
+      workers.emplace_back([this, i] {
+        pin_current_thread(i);
+        shards_[i]->get_io_context().run();
+      });
+    }
+    pin_current_thread(0);
+    shards_[0]->get_io_context().run();
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
 }
 
-void server::do_accept() {
-  acceptor_.async_accept([this](std::error_code ec, tcp::socket socket) {
-    if (!ec) {
-      auto new_session =
-          std::make_shared<session>(std::move(socket), *this);
-      new_session->start();
+void server::join(chat_participant_ptr participant) {
+  auto joining = std::dynamic_pointer_cast<mud::session>(participant);
+  if (joining && joining->get_player()) {
+    bus_.subscribe(topic::player(joining->get_player()->get_name()),
+                   participant);
+  }
+  bus_.subscribe(topic::global(), participant);
+}
+
+void server::leave(chat_participant_ptr participant) {
+  auto departing = std::dynamic_pointer_cast<mud::session>(participant);
+  if (departing && departing->get_player()) {
+    bus_.move(participant, departing->get_player()->get_room(), nullptr);
+    bus_.unsubscribe(topic::player(departing->get_player()->get_name()),
+                     participant);
+  }
+
+  bus_.unsubscribe(topic::global(), participant,
+                   [this, departing, participant](bool joined) {
+    if (joined && departing && departing->get_player()) {
+        std::string username = departing->get_player()->get_name();
+        // std::string msg = "\033[90m" + username + " has left the game.\033[0m";
+        std::string msg = utils::color::left(username + " has left the game.");
+        utils::Logger::instance().log(username + " has left the game.");
+        remove_player(username);
+        bus_.publish(topic::global(), make_message(msg), participant);
     }
-    do_accept();
   });
 }
+
+void server::add_player(std::shared_ptr<Player> player,
+                        std::function<void(bool)> handler) {
+  shard &owner = owner_of(player->get_name());
+  owner.post([&owner, player, handler] { handler(owner.add_player(player)); });
+}
+
+void server::remove_player(const std::string &name) {
+  shard &owner = owner_of(name);
+  owner.post([&owner, name] { owner.erase_player(name); });
+}
+
+void server::get_player_by_name(
+    const std::string &name,
+    std::function<void(std::shared_ptr<Player>)> handler) {
+  shard &owner = owner_of(name);
+  owner.post([&owner, name, handler] { handler(owner.find_player(name)); });
+}
+
+event_bus &server::get_bus() { return bus_; }
+
+world::World &server::get_world() { return world_; }
+
+std::shared_ptr<const CommandManager> server::get_command_manager() const {
+  return command_manager_.load();
+}
+
+const server_options &server::get_options() const { return options_; }
+
+world::TickScheduler *server::get_ticks() { return ticks_.get(); }
+
+world::TimingWheel &server::get_timers() { return *timers_; }
+
+shard &server::placement_for(shard &acceptor) {
+  if (!shared_acceptor_) {
+    return acceptor;
+  }
+  // Only shard 0 accepts in this case, so the counter is never shared.
+  return *shards_[next_placement_++ % shards_.size()];
+}
+
+shard &server::owner_of(const std::string &key) {
+  return *shards_[std::hash<std::string>{}(key) % shards_.size()];
+}
 } // namespace mud
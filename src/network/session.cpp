@@ -1,25 +1,38 @@
 #include "network/session.hpp"
+#include "network/gmcp.hpp"
+#include "network/handler_memory.hpp"
 #include "network/server.hpp"
 #include "players/player.hpp"
 #include "world/room.hpp"
+#include "world/tick_scheduler.hpp"
 #include "utils/color.hpp"
 #include "utils/logger.hpp"
+#include "utils/metrics.hpp"
+#include "utils/utf8.hpp"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
-#include <istream>
-#include <sstream>
+#include <iterator>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
 namespace mud {
 
+namespace {
+std::atomic<std::uint64_t> next_session_id{0};
+} // namespace
+
 void look_at_tile(session *s) {
   auto player = s->get_player();
-  if (!player || !player->get_room())
+  if (!player)
+    return;
+  auto location = player->get_location();
+  if (!location.room)
     return;
 
-  auto room = player->get_room();
-  const auto &tile = room->get_tile(player->get_x(), player->get_y());
+  const auto &tile = location.room->get_tile(location.x, location.y);
 
   for (const auto &obj : tile.objects) {
     s->deliver(utils::color::event(obj.description));
@@ -33,8 +46,21 @@ void look_at_tile(session *s) {
   }
 }
 
-session::session(tcp::socket socket, server &server)
-    : socket_(std::move(socket)), server_(server), command_handler_(*this) {
+session::session(tcp::socket socket, server &server, shard &shard,
+                 wire_protocol protocol)
+    : socket_(std::move(socket)),
+      strand_(*socket_.get_executor()
+                   .target<boost::asio::strand<
+                       boost::asio::io_context::executor_type>>()),
+      server_(server), shard_(shard), protocol_(protocol),
+      id_(next_session_id.fetch_add(1, std::memory_order_relaxed)),
+      write_queue_(server.get_options().output, protocol),
+      outbox_(outbox_capacity),
+      write_signal_(socket_.get_executor(),
+                    boost::asio::steady_timer::time_point::max()),
+      detach_deadline_(socket_.get_executor()),
+      relay_(*this, socket_.get_executor()) {
+  gmcp_enabled_ = protocol_ == wire_protocol::binary;
   try {
     remote_endpoint_str_ = socket_.remote_endpoint().address().to_string() +
                            ":" +
@@ -46,90 +72,720 @@ session::session(tcp::socket socket, server &server)
 }
 
 void session::start() {
-  server_.join(shared_from_this());
-  deliver(utils::color::color(utils::color::SYSTEM, "Welcome! Please enter your name:"));
-  do_read();
+  auto self(shared_from_this());
+  shard_.post([self] { self->shard_.add_connection(self); });
+  // The lambdas stay alive inside co_spawn until their coroutine returns,
+  // so self keeps the session alive for the whole read and write loops.
+  boost::asio::co_spawn(
+      socket_.get_executor(), [self] { return self->writer(); },
+      boost::asio::detached);
+  boost::asio::co_spawn(
+      socket_.get_executor(),
+      [self] {
+        return self->protocol_ == wire_protocol::binary ? self->binary_reader()
+                                                        : self->reader();
+      },
+      boost::asio::detached);
+}
+
+void session::resume(handoff::session_state state) {
+  resumed_ = true;
+  auto self(shared_from_this());
+  shard_.post([self] { self->shard_.add_connection(self); });
+  boost::asio::co_spawn(
+      socket_.get_executor(), [self] { return self->writer(); },
+      boost::asio::detached);
+  boost::asio::co_spawn(
+      socket_.get_executor(),
+      [self, state = std::move(state)]() mutable {
+        return self->resume_reader(std::move(state));
+      },
+      boost::asio::detached);
 }
 
 void session::stop() {
   bool expected = false;
   if (closing_.compare_exchange_strong(expected, true)) {
-    server_.leave(shared_from_this());
-    socket_.close();
+    // A quit runs on the tick thread; the socket and the rest belong to
+    // our strand. closing_ already stops further commands and output.
+    auto self(shared_from_this());
+    boost::asio::dispatch(strand_, recycle(handler_op::deliver, [self] {
+      self->shard_.post([self] { self->shard_.remove_connection(self); });
+      self->server_.leave(self);
+      self->relay_.cancel_all();
+      boost::system::error_code ignored;
+      self->socket_.close(ignored);
+      self->write_signal_.cancel();
+      if (self->detach_handler_) {
+        // Closed while draining: nothing left to hand over.
+        std::exchange(self->detach_handler_, nullptr)({});
+      }
+    }));
   }
 }
 
-void session::deliver(const std::string &msg) {
-  bool write_in_progress = !write_msgs_.empty();
-  write_msgs_.push_back(msg + "\n");
-  if (!write_in_progress) {
-    do_write();
+bool session::is_closing() const { return closing_; }
+
+std::uint64_t session::id() const { return id_; }
+
+void session::detach(std::function<void(handoff::detached_session)> handler) {
+  auto self(shared_from_this());
+  boost::asio::dispatch(
+      strand_, recycle(handler_op::deliver, [self, handler = std::move(
+                                                       handler)]() mutable {
+        if (self->closing_ || self->detach_handler_) {
+          handler({});
+          return;
+        }
+        self->detach_handler_ = std::move(handler);
+        self->relay_.cancel_all();
+        // A client that stopped reading leaves a write pending forever,
+        // and the drain waits for every session.
+        self->detach_deadline_.expires_after(
+            self->server_.get_options().drain_timeout);
+        self->detach_deadline_.async_wait(
+            [self](const boost::system::error_code &ec) {
+              if (ec || !self->detach_handler_ || self->drained_) {
+                return;
+              }
+              utils::Logger::instance().log(
+                  "Closing " + self->remote_endpoint_str_ +
+                  ", which did not drain in time");
+              self->stop();
+            });
+        if (auto *ticks = self->server_.get_ticks()) {
+          // The readers have stopped, so nothing more is submitted. Once
+          // the tick has run what is queued, its output goes out too.
+          self->finishing_commands_ = true;
+          ticks->finish(self, [self] {
+            boost::asio::dispatch(
+                self->strand_, recycle(handler_op::deliver, [self] {
+                  self->finishing_commands_ = false;
+                  self->drain_outbox();
+                  if (!self->write_queue_.writing()) {
+                    self->write_signal_.cancel_one();
+                  }
+                }));
+          });
+          return;
+        }
+        self->drain_outbox();
+        if (!self->write_queue_.writing()) {
+          self->write_signal_.cancel_one();
+        }
+      }));
+}
+
+void session::deliver(shared_message msg, message_lane lane) {
+  if (protocol_ == wire_protocol::binary) {
+    msg = make_raw_message(binary::event(*msg));
   }
+  enqueue(std::move(msg), lane);
+}
+
+void session::deliver_frame(shared_message frame, message_lane lane) {
+  enqueue(std::move(frame), lane);
+}
+
+void session::enqueue(shared_message msg, message_lane lane) {
+  // May be called from another session's strand or a shard strand, so
+  // the queue is only touched on our own strand. dispatch() runs inline
+  // when we are already there.
+  auto self(shared_from_this());
+  if (world::TickScheduler::in_tick()) {
+    // The tick thread is the outbox's only producer. The writer is woken
+    // once, in the tick's flush phase.
+    if (outbox_overflow_.load(std::memory_order_acquire) == 0) {
+      outbound_message out{std::move(msg), lane};
+      switch (outbox_.try_push(std::move(out))) {
+      case utils::SpscQueue<outbound_message>::push_result::queued:
+        return;
+      case utils::SpscQueue<outbound_message>::push_result::wake:
+        server_.get_ticks()->defer_flush(std::move(self));
+        return;
+      case utils::SpscQueue<outbound_message>::push_result::full:
+        msg = std::move(out.msg);
+        break;
+      }
+    }
+    outbox_overflow_.fetch_add(1, std::memory_order_relaxed);
+    boost::asio::dispatch(
+        strand_, recycle(handler_op::deliver,
+                         [self, msg = std::move(msg), lane]() mutable {
+                           self->drain_outbox();
+                           self->push_output(std::move(msg), lane);
+                           self->outbox_overflow_.fetch_sub(
+                               1, std::memory_order_release);
+                           self->wake_writer();
+                         }));
+    return;
+  }
+  boost::asio::dispatch(strand_,
+                        recycle(handler_op::deliver,
+                                [self, msg = std::move(msg), lane]() mutable {
+    self->drain_outbox();
+    if (self->push_output(std::move(msg), lane)) {
+      self->wake_writer();
+    }
+  }));
+}
+
+bool session::push_output(shared_message msg, message_lane lane) {
+  if (closing_ || drained_) {
+    return false;
+  }
+  auto &metrics = utils::Metrics::instance();
+  switch (write_queue_.push(std::move(msg), lane)) {
+  case output_queue::push_result::queued:
+    return true;
+  case output_queue::push_result::dropped:
+    metrics.messages_dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  case output_queue::push_result::collapsed:
+    metrics.messages_collapsed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  case output_queue::push_result::disconnect:
+    metrics.slow_consumer_disconnects.fetch_add(1, std::memory_order_relaxed);
+    utils::Logger::instance().log("Disconnecting slow consumer " +
+                                  remote_endpoint_str_);
+    stop();
+    return false;
+  }
+  return false;
+}
+
+void session::drain_outbox() {
+  outbox_.drain([this](outbound_message &&out) {
+    push_output(std::move(out.msg), out.lane);
+  });
+}
+
+void session::wake_writer() {
+  if (!write_queue_.empty() && !write_queue_.writing()) {
+    // writer() is idle on the signal, or about to re-check the queue.
+    write_signal_.cancel_one();
+  }
+}
+
+void session::flush_output() {
+  auto self(shared_from_this());
+  boost::asio::dispatch(strand_, recycle(handler_op::deliver, [self] {
+    // Messages pushed after the drain but before sleep() don't wake us
+    // again, so they are picked up here.
+    do {
+      self->drain_outbox();
+    } while (!self->outbox_.sleep());
+    self->wake_writer();
+  }));
 }
 
 std::shared_ptr<Player> session::get_player() const { return player_; }
 server &session::get_server() { return server_; }
+shard &session::get_shard() { return shard_; }
 bool session::is_logged_in() const { return is_logged_in_; }
 
-void session::do_read() {
+boost::asio::awaitable<void> session::reader() {
+  if (!resumed_) {
+    if (server_.get_options().telnet) {
+      deliver(make_raw_message(telnet_protocol::offer()));
+    }
+    deliver(utils::color::color(utils::color::SYSTEM,
+                                "Welcome! Please enter your name:"));
+  } else {
+    // Already filtered by the previous process.
+    auto buffer = framer_.prepare();
+    std::size_t length = std::min(resumed_input_.size(), buffer.size());
+    std::memcpy(buffer.data(), resumed_input_.data(), length);
+    framer_.commit(length);
+    resumed_input_.clear();
+  }
+
+  boost::system::error_code ec;
+  // Lines still buffered after a quit must not run, so closing_ is
+  // checked before every read and every line.
+  while (!closing_) {
+    // Runs every complete line buffered so far before reading again.
+    std::string_view line;
+    while (!closing_ && !detach_handler_ && framer_.next_line(line)) {
+      if (!is_logged_in_) {
+        co_await login(std::string(line));
+        continue;
+      }
+      if (file_relay::is_data_header(line)) {
+        co_await relay_.relay_chunk(line);
+        continue;
+      }
+      if (relay_.handle_line(line)) {
+        continue;
+      }
+      handle_message(line);
+    }
+    if (framer_.take_overflow()) {
+      deliver(utils::color::system(
+          "Line too long (max " + std::to_string(framer_.max_line_length()) +
+          " bytes); ignored."));
+    }
+
+    if (drained_) {
+      finish_detach(framer_.take(std::string_view::npos));
+      co_return;
+    }
+    if (detach_handler_) {
+      // Leaves further input in the kernel for the next process until
+      // writer() has drained and cancels this wait.
+      co_await socket_.async_wait(
+          tcp::socket::wait_error,
+          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      continue;
+    }
+
+    auto buffer = framer_.prepare();
+    std::size_t length = co_await socket_.async_read_some(
+        buffer, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {
+      if (!drained_) {
+        read_failed(ec);
+      }
+      continue;
+    }
+    if (server_.get_options().telnet && (telnet_mode_ || !is_logged_in_)) {
+      length = telnet_.filter(static_cast<char *>(buffer.data()), length);
+      handle_telnet();
+    }
+    framer_.commit(length);
+  }
+}
+
+boost::asio::awaitable<void> session::binary_reader() {
+  binary::framer framer;
+  if (!resumed_) {
+    deliver(utils::color::system("Welcome! Send a login frame."));
+  } else {
+    auto buffer = framer.prepare();
+    std::size_t length = std::min(resumed_input_.size(), buffer.size());
+    std::memcpy(buffer.data(), resumed_input_.data(), length);
+    framer.commit(length);
+    resumed_input_.clear();
+  }
+
+  binary::request request;
+  boost::system::error_code ec;
+  while (!closing_) {
+    auto result = binary::framer::result::incomplete;
+    while (!closing_ && !detach_handler_ &&
+           (result = framer.next(request)) == binary::framer::result::complete) {
+      if (request.type == binary::frame_type::login) {
+        if (!is_logged_in_) {
+          co_await login(std::move(request.args.front()));
+        }
+        continue;
+      }
+      if (!is_logged_in_) {
+        deliver(utils::color::error("Log in first."));
+        continue;
+      }
+      process_request(request);
+    }
+    if (result == binary::framer::result::malformed) {
+      // Nothing after a bad length can be trusted.
+      std::cerr << "Malformed frame from " << remote_endpoint_str_
+                << std::endl;
+      stop();
+      co_return;
+    }
+
+    if (drained_) {
+      finish_detach(framer.pending());
+      co_return;
+    }
+    if (detach_handler_) {
+      co_await socket_.async_wait(
+          tcp::socket::wait_error,
+          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      continue;
+    }
+
+    std::size_t length = co_await socket_.async_read_some(
+        framer.prepare(),
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {
+      if (!drained_) {
+        read_failed(ec);
+      }
+      continue;
+    }
+    framer.commit(length);
+  }
+}
+
+boost::asio::awaitable<void>
+session::resume_reader(handoff::session_state state) {
+  telnet_.restore(state.telnet_active, state.gmcp_enabled,
+                  std::move(state.gmcp_modules), state.width, state.height,
+                  std::move(state.terminal_type));
+  telnet_mode_ = state.telnet_mode;
+  if (protocol_ == wire_protocol::text) {
+    gmcp_enabled_ = state.gmcp_enabled;
+  }
+  if (state.compress) {
+    // The client still has MCCP2 on; the old stream ended before the
+    // hand-off, so start a new one.
+    mccp_start_ = make_raw_message(telnet_protocol::start_compression());
+    enqueue(mccp_start_, message_lane::priority);
+  }
+  resumed_input_ = std::move(state.input);
+
+  if (!state.name.empty()) {
+    auto player = std::make_shared<Player>(state.name);
+    player->set_session(shared_from_this());
+    if (!co_await register_player(player)) {
+      deliver(utils::color::color(
+          utils::color::ERROR_,
+          "Name is already taken. Please choose another name:"));
+    } else if (closing_) {
+      server_.remove_player(player->get_name());
+    } else {
+      player_ = std::move(player);
+      auto room = server_.get_world().get_room(state.room);
+      if (!room) {
+        // Gone from the new maps.
+        room = server_.get_world().get_room("town_square");
+        state.x = room ? room->get_width() / 2 : 0;
+        state.y = room ? room->get_height() / 2 : 0;
+      }
+      if (room) {
+        player_->set_location(
+            room, std::clamp(state.x, 0, std::max(room->get_width() - 1, 0)),
+            std::clamp(state.y, 0, std::max(room->get_height() - 1, 0)));
+      }
+      is_logged_in_ = true;
+      server_.join(shared_from_this());
+    }
+  }
+
+  if (protocol_ == wire_protocol::binary) {
+    co_await binary_reader();
+  } else {
+    co_await reader();
+  }
+}
+
+void session::finish_detach(std::string_view input) {
+  handoff::detached_session detached;
+  auto &state = detached.state;
+  state.protocol = protocol_;
+  if (auto location = player_ ? player_->get_location() : Player::Location{};
+      location.room) {
+    state.name = player_->get_name();
+    state.room = location.room->get_id();
+    state.x = location.x;
+    state.y = location.y;
+  }
+  state.telnet_mode = telnet_mode_;
+  state.telnet_active = telnet_.active();
+  state.gmcp_enabled = telnet_.gmcp_enabled();
+  state.gmcp_modules = telnet_.gmcp_modules();
+  state.compress = compression_ended_;
+  state.width = telnet_.width();
+  state.height = telnet_.height();
+  state.terminal_type = telnet_.terminal_type();
+  state.input.assign(input);
+  detached.fd = handoff::duplicate(socket_.native_handle());
+
+  auto handler = std::exchange(detach_handler_, nullptr);
+  // The player carries on in the next process, so this is not a leave().
+  closing_ = true;
   auto self(shared_from_this());
-  boost::asio::async_read_until(
-      socket_, buffer_, '\n',
-      [self](boost::system::error_code ec, std::size_t length) {
-        if (!ec) {
-          std::istream is(&self->buffer_);
-          std::string msg;
-          std::getline(is, msg);
-
-          if (!msg.empty() && msg.back() == '\r') {
-            msg.pop_back();
-          }
-
-          if (!self->is_logged_in_) {
-            self->handle_initial_input(msg);
-          } else {
-            self->handle_message(msg);
-          }
-          self->do_read();
-        } else if (ec != boost::asio::error::eof &&
-                   ec != boost::asio::error::connection_reset) {
-          std::cerr << "Read error from " << self->remote_endpoint_str_
-                    << ": " << ec.message() << std::endl;
-          self->stop();
-        } else {
-          self->stop();
+  shard_.post([self] { self->shard_.remove_connection(self); });
+  boost::system::error_code ignored;
+  socket_.close(ignored);
+  write_signal_.cancel();
+  detach_deadline_.cancel();
+  handler(std::move(detached));
+}
+
+void session::read_failed(const boost::system::error_code &ec) {
+  if (ec != boost::asio::error::eof &&
+      ec != boost::asio::error::connection_reset &&
+      ec != boost::asio::error::operation_aborted) {
+    std::cerr << "Read error from " << remote_endpoint_str_ << ": "
+              << ec.message() << std::endl;
+  }
+  stop();
+}
+
+void session::handle_telnet() {
+  std::string reply = telnet_.take_output();
+  if (!reply.empty()) {
+    deliver(make_raw_message(std::move(reply)));
+  }
+  if (telnet_.take_compression_request()) {
+    mccp_start_ = make_raw_message(telnet_protocol::start_compression());
+    deliver(mccp_start_);
+  }
+  if (telnet_.take_gmcp_enabled()) {
+    gmcp_enabled_ = true;
+    if (is_logged_in_) {
+      location_changed(true);
+    }
+  }
+}
+
+boost::asio::awaitable<void> session::writer() {
+  boost::system::error_code ec;
+  while (!closing_) {
+    if (write_queue_.empty()) {
+      if (detach_handler_ && !finishing_commands_) {
+        if (compressor_.active()) {
+          // End the MCCP2 stream so the next process can start its own.
+          compressed_.clear();
+          compressor_.finish(compressed_);
+          compression_ended_ = true;
+          co_await boost::asio::async_write(
+              socket_, boost::asio::buffer(compressed_),
+              boost::asio::redirect_error(boost::asio::use_awaitable, ec));
         }
-      });
+        // Wakes the reader, which hands the socket over.
+        drained_ = true;
+        boost::system::error_code ignored;
+        socket_.cancel(ignored);
+        co_return;
+      }
+      co_await write_signal_.async_wait(
+          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      continue;
+    }
+
+    // Gather as many queued messages as fit under the byte cap into a
+    // single write. The queue keeps each payload alive until consume().
+    std::size_t bytes = write_queue_.gather(write_buffers_, max_write_bytes);
+    if (compressor_.active() || mccp_start_) {
+      compress_output();
+    }
+
+    ++writes_;
+    messages_written_ += write_buffers_.size();
+    auto &metrics = utils::Metrics::instance();
+    metrics.writes.fetch_add(1, std::memory_order_relaxed);
+    metrics.messages_written.fetch_add(write_buffers_.size(),
+                                       std::memory_order_relaxed);
+    metrics.bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+
+    co_await boost::asio::async_write(
+        socket_, write_buffers_,
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {
+      if (ec != boost::asio::error::eof &&
+          ec != boost::asio::error::connection_reset &&
+          ec != boost::asio::error::operation_aborted) {
+        std::cerr << "Write error to " << remote_endpoint_str_ << ": "
+                  << ec.message() << std::endl;
+      }
+      stop();
+      co_return;
+    }
+    write_queue_.consume();
+  }
 }
 
-void session::do_write() {
+const output_queue &session::get_output_queue() const { return write_queue_; }
+
+void session::compress_output() {
+  auto first = write_buffers_.cbegin();
+  if (!compressor_.active()) {
+    // The MCCP2 start sequence itself goes out plain; compress what follows.
+    auto marker = std::find_if(
+        write_buffers_.cbegin(), write_buffers_.cend(),
+        [this](const boost::asio::const_buffer &b) {
+          return b.data() == mccp_start_->data();
+        });
+    if (marker == write_buffers_.cend()) {
+      return;
+    }
+    mccp_start_.reset();
+    if (!compressor_.start()) {
+      std::cerr << "MCCP2 init failed for " << remote_endpoint_str_
+                << std::endl;
+      return;
+    }
+    first = std::next(marker);
+  }
+
+  compressed_.clear();
+  auto in_before = compressor_.bytes_in();
+  auto out_before = compressor_.bytes_out();
+  auto cpu_before = compressor_.cpu_time();
+  if (!compressor_.compress(first, write_buffers_.cend(), compressed_)) {
+    std::cerr << "MCCP2 deflate failed for " << remote_endpoint_str_
+              << std::endl;
+  }
+  auto &metrics = utils::Metrics::instance();
+  metrics.compress_bytes_in.fetch_add(compressor_.bytes_in() - in_before,
+                                      std::memory_order_relaxed);
+  metrics.compress_bytes_out.fetch_add(compressor_.bytes_out() - out_before,
+                                       std::memory_order_relaxed);
+  metrics.compress_ns.fetch_add(
+      (compressor_.cpu_time() - cpu_before).count(), std::memory_order_relaxed);
+
+  write_buffers_.erase(first, write_buffers_.cend());
+  if (!compressed_.empty()) {
+    write_buffers_.push_back(boost::asio::buffer(compressed_));
+  }
+}
+
+void session::send_gmcp(std::string module, shared_message frame) {
   auto self(shared_from_this());
-  boost::asio::async_write(
-      socket_, boost::asio::buffer(write_msgs_.front()),
-      [self](boost::system::error_code ec, std::size_t /*length*/) {
-        if (!ec) {
-          self->write_msgs_.pop_front();
-          if (!self->write_msgs_.empty()) {
-            self->do_write();
-          }
-        } else if (ec != boost::asio::error::eof &&
-                   ec != boost::asio::error::connection_reset) {
-          std::cerr << "Write error to " << self->remote_endpoint_str_
-                    << ": " << ec.message() << std::endl;
-          self->stop();
-        } else {
-          self->stop();
+  boost::asio::dispatch(
+      strand_,
+      recycle(handler_op::deliver, [self, module = std::move(module),
+                                    frame = std::move(frame)]() mutable {
+        if (self->gmcp_supports(module)) {
+          self->enqueue(std::move(frame), message_lane::priority);
         }
-      });
+      }));
 }
 
-void session::handle_initial_input(const std::string &input) {
-  player_ = server_.add_player(input);
-  if (!player_) {
-    deliver(utils::color::color(utils::color::ERROR_, "Name is already taken. Please choose another name:"));
+bool session::gmcp_enabled() const { return gmcp_enabled_; }
+
+bool session::gmcp_supports(const std::string &module) const {
+  return protocol_ == wire_protocol::binary || telnet_.gmcp_supports(module);
+}
+
+shared_message session::package(std::string_view name,
+                                const std::string &json) const {
+  return make_raw_message(protocol_ == wire_protocol::binary
+                              ? binary::data(name, json)
+                              : telnet_protocol::gmcp(std::string(name), json));
+}
+
+void session::deliver_unless_gmcp(std::string module, std::string msg) {
+  auto self(shared_from_this());
+  boost::asio::dispatch(
+      strand_, recycle(handler_op::deliver, [self, module = std::move(module),
+                                             msg = std::move(msg)] {
+        if (!self->gmcp_supports(module)) {
+          self->deliver(msg);
+        }
+      }));
+}
+
+void session::location_changed(bool room_changed) {
+  auto self(shared_from_this());
+  boost::asio::dispatch(strand_,
+                        recycle(handler_op::deliver, [self, room_changed] {
+                          self->send_location(room_changed);
+                        }));
+}
+
+void session::send_location(bool room_changed) {
+  if (!gmcp_enabled_ || !player_) {
     return;
   }
-  player_->set_session(shared_from_this());
+  auto [room, x, y] = player_->get_location();
+  if (!room) {
+    return;
+  }
+  if (gmcp_supports("char")) {
+    enqueue(package("Char.Position", gmcp::char_position(*room, x, y)),
+            message_lane::priority);
+  }
+  if (room_changed && gmcp_supports("room")) {
+    enqueue(package("Room.Info", gmcp::room_info(*room)),
+            message_lane::priority);
+    // The owner shard answers after our own subscription to the room, so
+    // the list includes us and later Room.AddPlayer/RemovePlayer updates
+    // apply to it.
+    auto self(shared_from_this());
+    server_.get_bus().get_subscriber_names(
+        topic::room(room->get_id()), [self](std::vector<std::string> names) {
+          self->send_gmcp("room", self->package("Room.Players",
+                                                gmcp::room_players(names)));
+        });
+  }
+}
+
+const telnet_protocol &session::get_telnet() const { return telnet_; }
+
+const mccp_compressor &session::get_compressor() const { return compressor_; }
+
+file_relay &session::get_relay() { return relay_; }
+
+bool session::telnet_mode() const { return telnet_mode_; }
+
+wire_protocol session::protocol() const { return protocol_; }
+
+boost::asio::awaitable<bool> session::read_raw(char *data, std::size_t size) {
+  std::string_view buffered = framer_.take(size);
+  std::memcpy(data, buffered.data(), buffered.size());
+  std::size_t filled = buffered.size();
+
+  boost::system::error_code ec;
+  while (filled < size && !closing_ && !drained_) {
+    std::size_t length = co_await socket_.async_read_some(
+        boost::asio::buffer(data + filled, size - filled),
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {
+      if (!drained_) {
+        stop();
+      }
+      co_return false;
+    }
+    if (telnet_mode_) {
+      length = telnet_.filter(data + filled, length);
+      handle_telnet();
+    }
+    filled += length;
+  }
+  co_return filled == size;
+}
+
+double session::average_messages_per_write() const {
+  return writes_ == 0 ? 0.0
+                      : static_cast<double>(messages_written_) / writes_;
+}
+
+boost::asio::awaitable<bool>
+session::register_player(std::shared_ptr<Player> player) {
+  // server::add_player completes on the owner shard's strand; hop back to
+  // ours before resuming the coroutine.
+  co_return co_await boost::asio::async_initiate<
+      const boost::asio::use_awaitable_t<> &, void(bool)>(
+      [this](auto handler, std::shared_ptr<Player> player) {
+        auto shared_handler =
+            std::make_shared<decltype(handler)>(std::move(handler));
+        server_.add_player(std::move(player), [this, shared_handler](bool added) {
+          boost::asio::post(strand_,
+                            recycle(handler_op::deliver,
+                                    [shared_handler, added] {
+                                      (*shared_handler)(added);
+                                    }));
+        });
+      },
+      boost::asio::use_awaitable, std::move(player));
+}
+
+boost::asio::awaitable<void> session::login(std::string name) {
+  // Names go out as JSON (GMCP, hand-off), which only carries UTF-8; a
+  // client in another encoding (CP949) would otherwise take down the
+  // strand that announces it.
+  if (!utils::utf8::valid(name)) {
+    deliver(utils::color::error(
+        "Names must be UTF-8. Please choose another name:"));
+    co_return;
+  }
+  auto player = std::make_shared<Player>(name);
+  player->set_session(shared_from_this());
+
+  if (!co_await register_player(player)) {
+    deliver(utils::color::color(utils::color::ERROR_, "Name is already taken. Please choose another name:"));
+    co_return;
+  }
+  if (closing_) {
+    // Disconnected while the name was being registered.
+    server_.remove_player(player->get_name());
+    co_return;
+  }
+  player_ = std::move(player);
 
   auto starting_room = server_.get_world().get_room("town_square");
   if (starting_room) {
@@ -137,8 +793,12 @@ void session::handle_initial_input(const std::string &input) {
                           starting_room->get_height() / 2);
   }
 
+  // Clients that never answered the offer are plain byte streams from here
+  // on, so file transfers can pass 0xFF through unescaped.
+  telnet_mode_ = server_.get_options().telnet && telnet_.active();
   is_logged_in_ = true;
-  deliver("\033[2J\033[H"); // Clear screen
+  server_.join(shared_from_this());
+  deliver(utils::color::CLEAR_SCREEN);
 //   deliver("\033[1;32mHello, " + player_->get_name() +
 //                                "! Welcome to the MUD.\033[0m");
 deliver(utils::color::color(utils::color::SAY ,"Hello, " + player_->get_name() +
@@ -146,12 +806,13 @@ deliver(utils::color::color(utils::color::SAY ,"Hello, " + player_->get_name() +
 
   std::string join_msg = utils::color::join(player_->get_name() + " has joined the game.");
   utils::Logger::instance().log(player_->get_name() + " has joined the game.");
-  server_.broadcast(join_msg, shared_from_this());
+  server_.get_bus().publish(topic::global(), make_message(join_msg),
+                            shared_from_this());
 
   process_command("look");
 }
 
-void session::handle_message(const std::string &msg) {
+void session::handle_message(std::string_view msg) {
   if (msg.empty()) {
     return;
   }
@@ -159,42 +820,93 @@ void session::handle_message(const std::string &msg) {
   if (msg[0] == '/') {
     process_command(msg.substr(1));
   } else {
-    process_command("say " + msg);
+    // Plain text is said as it is, without building "say <text>" first.
+    utils::Metrics::instance().commands.fetch_add(1,
+                                                  std::memory_order_relaxed);
+    auto commands = server_.get_command_manager();
+    if (const auto *say = commands->find_command("say")) {
+      submit({{commands, say}, CommandArgs(msg)});
+    }
   }
 }
 
-void session::process_command(const std::string &input) {
-  std::istringstream iss(input);
-  std::string alias;
-  iss >> alias;
+void session::process_command(std::string_view input) {
+  utils::Metrics::instance().commands.fetch_add(1, std::memory_order_relaxed);
+  auto line = split_command(input);
 
-  std::string command =
-      server_.get_command_manager().get_canonical_command(alias);
+  auto commands = server_.get_command_manager();
+  auto match = commands->match_command(line.word);
 
-  if (command.empty()) {
+  if (match.result == AliasMatch::kind::ambiguous) {
+    std::string candidates;
+    for (const auto &alias : commands->complete_command(line.word)) {
+      candidates += (candidates.empty() ? "" : ", ") + alias;
+    }
+    deliver(utils::color::system("Ambiguous command: " +
+                                 std::string(line.word) + " (" + candidates +
+                                 ")"));
+    return;
+  }
+  if (!match.command) {
     // deliver(utils::color::ERROR("Unknown command: " + alias));
-    deliver(utils::color::system("Unknown command: " + alias));
+    deliver(utils::color::system("Unknown command: " + std::string(line.word)));
     return;
   }
 
-  // std::vector<std::string> args;
-  // std::string arg;
-  // if (std::getline(iss, arg)) {
-  //   if (!arg.empty() && arg[0] == ' ') {
-  //     arg = arg.substr(1);
-  //   }
-  //   if (!arg.empty()) {
-  //     args.push_back(arg);
-  //   }
-  // }
+  submit({{commands, match.command}, CommandArgs(line.rest)});
+}
+
+void session::process_request(const binary::request &request) {
+  utils::Metrics::instance().commands.fetch_add(1, std::memory_order_relaxed);
+  auto commands = server_.get_command_manager();
+  const auto *command = commands->find_command(request.command_id);
+  if (!command) {
+    deliver(utils::color::system("Unknown command id: " +
+                                 std::to_string(request.command_id)));
+    return;
+  }
+  submit({{commands, command}, CommandArgs(request.args)});
+}
 
-std::vector<std::string> args;
-std::string arg;
-while (iss >> arg) {
-    args.push_back(arg);
+void session::submit(QueuedCommand command) {
+  auto *ticks = server_.get_ticks();
+  if (!ticks) {
+    if (!command_queue_.take_token(*command.command,
+                                   CommandQueue::clock::now())) {
+      utils::Metrics::instance().commands_rejected.fetch_add(
+          1, std::memory_order_relaxed);
+      deliver(utils::color::system("Slow down; " + command.command->name +
+                                   " ignored."));
+      return;
+    }
+    run_command(*command.command, command.args);
+    return;
+  }
+  if (!command_queue_.reserve(
+          server_.get_command_manager()->get_max_queued())) {
+    utils::Metrics::instance().commands_rejected.fetch_add(
+        1, std::memory_order_relaxed);
+    deliver(utils::color::system("Too many commands waiting; " +
+                                 command.command->name + " ignored."));
+    return;
+  }
+  if (!ticks->submit(shared_from_this(), std::move(command))) {
+    command_queue_.release();
+    utils::Metrics::instance().commands_rejected.fetch_add(
+        1, std::memory_order_relaxed);
+    deliver(utils::color::system("The world is busy; " +
+                                 command.command->name + " ignored."));
+  }
 }
 
-  command_handler_.handle(command, args);
+void session::run_command(const Command &command, const CommandArgs &args) {
+  if (!command.handler) {
+    deliver("Command not implemented: " + command.name);
+    return;
+  }
+  command.handler(*this, args);
 }
 
+CommandQueue &session::get_command_queue() { return command_queue_; }
+
 } // namespace mud
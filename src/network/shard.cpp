@@ -0,0 +1,236 @@
+#include "network/shard.hpp"
+#include "network/binary_protocol.hpp"
+#include "network/gmcp.hpp"
+#include "network/server.hpp"
+#include "network/session.hpp"
+#include "network/telnet.hpp"
+#include <iostream>
+#include <utility>
+
+namespace mud {
+
+#if defined(SO_REUSEPORT)
+using reuse_port =
+    boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+shard::shard(server &server, std::size_t index,
+             boost::asio::io_context *io_context)
+    : server_(server), index_(index),
+      owned_io_context_(io_context ? nullptr
+                                   : std::make_unique<boost::asio::io_context>(1)),
+      io_context_(io_context ? *io_context : *owned_io_context_),
+      strand_(boost::asio::make_strand(io_context_)) {}
+
+std::size_t shard::index() const { return index_; }
+
+boost::asio::io_context &shard::get_io_context() { return io_context_; }
+
+void shard::listen(const tcp::endpoint &endpoint, bool reuse_port,
+                   wire_protocol protocol) {
+  auto acceptor = std::make_unique<tcp::acceptor>(io_context_);
+  acceptor->open(endpoint.protocol());
+  acceptor->set_option(tcp::acceptor::reuse_address(true));
+  if (reuse_port) {
+#if defined(SO_REUSEPORT)
+    acceptor->set_option(mud::reuse_port(true));
+#endif
+  }
+  acceptor->bind(endpoint);
+  acceptor->listen();
+  start_accepting(std::move(acceptor), protocol);
+}
+
+void shard::adopt(handoff::native_handle fd, wire_protocol protocol) {
+  auto acceptor = std::make_unique<tcp::acceptor>(io_context_);
+  boost::system::error_code ec;
+  acceptor->assign(handoff::protocol_of(fd), fd, ec);
+  if (ec) {
+    std::cerr << "Failed to adopt listener: " << ec.message() << std::endl;
+    return;
+  }
+  start_accepting(std::move(acceptor), protocol);
+}
+
+void shard::start_accepting(std::unique_ptr<tcp::acceptor> acceptor,
+                            wire_protocol protocol) {
+  listeners_.push_back({std::move(acceptor), protocol});
+  do_accept(*listeners_.back().acceptor, protocol);
+}
+
+void shard::add_connection(std::shared_ptr<session> connection) {
+  connections_.insert(std::move(connection));
+}
+
+void shard::remove_connection(const std::shared_ptr<session> &connection) {
+  connections_.erase(connection);
+}
+
+void shard::detach_all(const std::shared_ptr<handoff::collector> &collector) {
+  for (auto &l : listeners_) {
+    auto fd = handoff::duplicate(l.acceptor->native_handle());
+    if (fd != handoff::invalid_handle) {
+      collector->add_listener({fd, l.protocol});
+    }
+    boost::system::error_code ignored;
+    l.acceptor->close(ignored);
+  }
+  for (auto &connection : connections_) {
+    collector->expect_session();
+    connection->detach([collector](handoff::detached_session detached) {
+      collector->add_session(std::move(detached));
+    });
+  }
+  collector->shard_done();
+}
+
+void shard::subscribe(const topic &t, chat_participant_ptr participant) {
+  auto &subscribers = subscribers_[t.key()];
+  if (t.type == topic::kind::room) {
+    announce(subscribers, participant, true);
+  }
+  subscribers.insert(std::move(participant));
+}
+
+bool shard::unsubscribe(const topic &t,
+                        const chat_participant_ptr &participant) {
+  auto it = subscribers_.find(t.key());
+  if (it == subscribers_.end()) {
+    return false;
+  }
+  bool subscribed = it->second.erase(participant) > 0;
+  if (subscribed && t.type == topic::kind::room) {
+    announce(it->second, participant, false);
+  }
+  if (it->second.empty()) {
+    subscribers_.erase(it);
+  }
+  return subscribed;
+}
+
+void shard::announce(const std::set<chat_participant_ptr> &occupants,
+                     const chat_participant_ptr &participant, bool entered) {
+  auto mover = std::dynamic_pointer_cast<mud::session>(participant);
+  if (!mover || !mover->get_player()) {
+    return;
+  }
+  // Framed lazily, once per protocol, and only if someone in the room
+  // takes GMCP packages.
+  const char *package = entered ? "Room.AddPlayer" : "Room.RemovePlayer";
+  std::string payload;
+  shared_message telnet_frame;
+  shared_message binary_frame;
+  for (auto &occupant : occupants) {
+    auto s = std::dynamic_pointer_cast<mud::session>(occupant);
+    if (!s || !s->gmcp_enabled()) {
+      continue;
+    }
+    if (payload.empty()) {
+      const auto &name = mover->get_player()->get_name();
+      payload = entered ? gmcp::room_add_player(name)
+                        : gmcp::room_remove_player(name);
+    }
+    bool binary = s->protocol() == wire_protocol::binary;
+    auto &frame = binary ? binary_frame : telnet_frame;
+    if (!frame) {
+      frame = make_raw_message(binary ? binary::data(package, payload)
+                                      : telnet_protocol::gmcp(package, payload));
+    }
+    s->send_gmcp("room", frame);
+  }
+}
+
+std::size_t shard::publish(const event_bus::event &e) {
+  auto it = subscribers_.find(e.target.key());
+  if (it == subscribers_.end()) {
+    return 0;
+  }
+  std::size_t delivered = 0;
+  // Binary recipients share one event frame, built on first use.
+  shared_message binary_frame;
+  for (auto &participant : it->second) {
+    if (participant == e.sender) {
+      continue;
+    }
+    auto *s = dynamic_cast<mud::session *>(participant.get());
+    if (s && s->protocol() == wire_protocol::binary) {
+      if (!binary_frame) {
+        binary_frame = make_raw_message(binary::event(*e.msg));
+      }
+      s->deliver_frame(binary_frame, e.lane);
+    } else {
+      participant->deliver(e.msg, e.lane);
+    }
+    ++delivered;
+  }
+  return delivered;
+}
+
+std::vector<std::string> shard::subscriber_names(const topic &t) const {
+  std::vector<std::string> names;
+  auto it = subscribers_.find(t.key());
+  if (it == subscribers_.end()) {
+    return names;
+  }
+  names.reserve(it->second.size());
+  for (auto &participant : it->second) {
+    auto s = std::dynamic_pointer_cast<mud::session>(participant);
+    if (s && s->get_player()) {
+      names.push_back(s->get_player()->get_name());
+    }
+  }
+  return names;
+}
+
+bool shard::add_player(std::shared_ptr<Player> player) {
+  return players_.emplace(player->get_name(), player).second;
+}
+
+void shard::erase_player(const std::string &name) { players_.erase(name); }
+
+std::shared_ptr<Player> shard::find_player(const std::string &name) const {
+  auto it = players_.find(name);
+  if (it != players_.end()) {
+    return it->second;
+  }
+  return nullptr;
+}
+
+std::vector<std::shared_ptr<Player>>
+shard::players_in(const std::set<std::string> &room_ids) const {
+  std::vector<std::shared_ptr<Player>> found;
+  for (const auto &[name, player] : players_) {
+    auto room = player->get_room();
+    if (room && room_ids.count(room->get_id())) {
+      found.push_back(player);
+    }
+  }
+  return found;
+}
+
+void shard::do_accept(tcp::acceptor &acceptor, wire_protocol protocol) {
+  // Sessions normally stay on the shard that accepted them. Without
+  // SO_REUSEPORT only shard 0 listens and the server spreads the sockets.
+  shard &target = server_.placement_for(*this);
+  // Completes on our strand so detach_all() can close the acceptor.
+  acceptor.async_accept(
+      boost::asio::make_strand(target.get_io_context()),
+      boost::asio::bind_executor(
+          strand_,
+          recycle(handler_op::accept, [this, &acceptor, &target, protocol](
+                                          std::error_code ec,
+                                          tcp::socket socket) {
+            if (!acceptor.is_open()) {
+              // Closed by detach_all(). A connection accepted just before
+              // that is dropped with this process.
+              return;
+            }
+            if (!ec) {
+              auto new_session = std::make_shared<session>(
+                  std::move(socket), server_, target, protocol);
+              new_session->start();
+            }
+            do_accept(acceptor, protocol);
+          })));
+}
+} // namespace mud
@@ -0,0 +1,255 @@
+#include "network/telnet.hpp"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+namespace mud {
+
+namespace {
+// Enough for Core.Supports.Set from common clients; the rest is ignored.
+constexpr std::size_t max_subnegotiation = 4096;
+
+std::string command(unsigned char verb, unsigned char option) {
+  return {static_cast<char>(telnet::IAC), static_cast<char>(verb),
+          static_cast<char>(option)};
+}
+} // namespace
+
+std::string telnet_protocol::offer() {
+  return command(telnet::WILL, telnet::OPT_MCCP2) +
+         command(telnet::WILL, telnet::OPT_GMCP) +
+         command(telnet::DO, telnet::OPT_NAWS) +
+         command(telnet::DO, telnet::OPT_TTYPE);
+}
+
+std::string telnet_protocol::start_compression() {
+  return command(telnet::SB, telnet::OPT_MCCP2) +
+         std::string{static_cast<char>(telnet::IAC),
+                     static_cast<char>(telnet::SE)};
+}
+
+std::string telnet_protocol::gmcp(const std::string &package,
+                                  const std::string &payload) {
+  // JSON is UTF-8, which never contains a 0xFF byte, so no IAC escaping.
+  std::string out = command(telnet::SB, telnet::OPT_GMCP);
+  out.reserve(out.size() + package.size() + payload.size() + 3);
+  out += package;
+  if (!payload.empty()) {
+    out.push_back(' ');
+    out += payload;
+  }
+  out.push_back(static_cast<char>(telnet::IAC));
+  out.push_back(static_cast<char>(telnet::SE));
+  return out;
+}
+
+void telnet_protocol::escape(std::string_view data, std::string &out) {
+  out.reserve(out.size() + data.size());
+  for (char c : data) {
+    out.push_back(c);
+    if (static_cast<unsigned char>(c) == telnet::IAC) {
+      out.push_back(c);
+    }
+  }
+}
+
+std::size_t telnet_protocol::filter(char *data, std::size_t size) {
+  std::size_t out = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    auto byte = static_cast<unsigned char>(data[i]);
+    switch (state_) {
+    case state::data:
+      if (byte == telnet::IAC) {
+        state_ = state::iac;
+      } else {
+        data[out++] = data[i];
+      }
+      break;
+    case state::iac:
+      if (byte == telnet::IAC) {
+        data[out++] = data[i];
+        state_ = state::data;
+        break;
+      }
+      active_ = true;
+      if (byte >= telnet::WILL && byte <= telnet::DONT) {
+        verb_ = byte;
+        state_ = state::option;
+      } else if (byte == telnet::SB) {
+        state_ = state::sb_option;
+      } else {
+        // NOP, GA, AYT and friends carry no state we need.
+        state_ = state::data;
+      }
+      break;
+    case state::option:
+      handle_option(verb_, byte);
+      state_ = state::data;
+      break;
+    case state::sb_option:
+      sb_option_ = byte;
+      sb_data_.clear();
+      state_ = state::sb_data;
+      break;
+    case state::sb_data:
+      if (byte == telnet::IAC) {
+        state_ = state::sb_iac;
+      } else if (sb_data_.size() < max_subnegotiation) {
+        sb_data_.push_back(data[i]);
+      }
+      break;
+    case state::sb_iac:
+      if (byte == telnet::SE) {
+        handle_subnegotiation();
+        state_ = state::data;
+      } else if (byte == telnet::IAC) {
+        if (sb_data_.size() < max_subnegotiation) {
+          sb_data_.push_back(data[i]);
+        }
+        state_ = state::sb_data;
+      } else {
+        state_ = state::data;
+      }
+      break;
+    }
+  }
+  return out;
+}
+
+std::string telnet_protocol::take_output() { return std::move(output_); }
+
+bool telnet_protocol::take_compression_request() {
+  bool requested = compression_requested_;
+  compression_requested_ = false;
+  return requested;
+}
+
+bool telnet_protocol::take_gmcp_enabled() {
+  bool enabled = gmcp_just_enabled_;
+  gmcp_just_enabled_ = false;
+  return enabled;
+}
+
+bool telnet_protocol::gmcp_enabled() const { return gmcp_enabled_; }
+
+bool telnet_protocol::active() const { return active_; }
+
+bool telnet_protocol::gmcp_supports(const std::string &module) const {
+  return gmcp_enabled_ && gmcp_modules_.count(module) > 0;
+}
+
+const std::set<std::string> &telnet_protocol::gmcp_modules() const {
+  return gmcp_modules_;
+}
+
+void telnet_protocol::restore(bool active, bool gmcp_enabled,
+                              std::set<std::string> gmcp_modules, int width,
+                              int height, std::string terminal_type) {
+  active_ = active;
+  gmcp_enabled_ = gmcp_enabled;
+  gmcp_modules_ = std::move(gmcp_modules);
+  width_ = width;
+  height_ = height;
+  terminal_type_ = std::move(terminal_type);
+  compression_offered_ = false;
+}
+
+int telnet_protocol::width() const { return width_; }
+
+int telnet_protocol::height() const { return height_; }
+
+const std::string &telnet_protocol::terminal_type() const {
+  return terminal_type_;
+}
+
+void telnet_protocol::handle_option(unsigned char verb, unsigned char option) {
+  switch (option) {
+  case telnet::OPT_MCCP2:
+    if (verb == telnet::DO && compression_offered_) {
+      compression_offered_ = false;
+      compression_requested_ = true;
+    }
+    return;
+  case telnet::OPT_GMCP:
+    if (verb == telnet::DO && !gmcp_enabled_) {
+      gmcp_enabled_ = true;
+      gmcp_just_enabled_ = true;
+    } else if (verb == telnet::DONT) {
+      gmcp_enabled_ = false;
+    }
+    return;
+  case telnet::OPT_NAWS:
+    // We asked with DO; the size itself arrives as a subnegotiation.
+    return;
+  case telnet::OPT_TTYPE:
+    if (verb == telnet::WILL) {
+      output_ += command(telnet::SB, telnet::OPT_TTYPE);
+      output_.push_back(static_cast<char>(telnet::TTYPE_SEND));
+      output_.push_back(static_cast<char>(telnet::IAC));
+      output_.push_back(static_cast<char>(telnet::SE));
+    }
+    return;
+  default:
+    // Refuse everything else so the client stops asking.
+    if (verb == telnet::DO) {
+      output_ += command(telnet::WONT, option);
+    } else if (verb == telnet::WILL) {
+      output_ += command(telnet::DONT, option);
+    }
+    return;
+  }
+}
+
+void telnet_protocol::handle_subnegotiation() {
+  if (sb_option_ == telnet::OPT_NAWS && sb_data_.size() == 4) {
+    auto b = [this](std::size_t i) {
+      return static_cast<unsigned char>(sb_data_[i]);
+    };
+    width_ = (b(0) << 8) | b(1);
+    height_ = (b(2) << 8) | b(3);
+  } else if (sb_option_ == telnet::OPT_TTYPE && !sb_data_.empty() &&
+             static_cast<unsigned char>(sb_data_[0]) == telnet::TTYPE_IS) {
+    terminal_type_ = sb_data_.substr(1);
+  } else if (sb_option_ == telnet::OPT_GMCP) {
+    handle_gmcp(sb_data_);
+  }
+}
+
+void telnet_protocol::handle_gmcp(const std::string &message) {
+  auto space = message.find(' ');
+  std::string package = message.substr(0, space);
+  std::transform(package.begin(), package.end(), package.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  bool set = package == "core.supports.set";
+  bool add = package == "core.supports.add";
+  bool remove = package == "core.supports.remove";
+  if ((!set && !add && !remove) || space == std::string::npos) {
+    return;
+  }
+
+  nlohmann::json modules =
+      nlohmann::json::parse(message.substr(space + 1), nullptr, false);
+  if (!modules.is_array()) {
+    return;
+  }
+  if (set) {
+    gmcp_modules_.clear();
+  }
+  for (const auto &entry : modules) {
+    if (!entry.is_string()) {
+      continue;
+    }
+    // Entries look like "Room 1"; only the module name matters here.
+    std::string name = entry.get<std::string>();
+    name = name.substr(0, name.find(' '));
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (remove) {
+      gmcp_modules_.erase(name);
+    } else {
+      gmcp_modules_.insert(name);
+    }
+  }
+}
+} // namespace mud
@@ -1,4 +1,5 @@
 #include "players/player.hpp"
+#include "network/server.hpp"
 #include "network/session.hpp"
 #include <utility>
 
@@ -18,16 +19,49 @@ void Player::set_session(std::weak_ptr<session> session) {
   session_ = std::move(session);
 }
 
+std::shared_ptr<session> Player::get_session() const {
+  return session_.lock();
+}
+
 void Player::set_location(std::shared_ptr<world::Room> room, int x, int y) {
+  auto spt = session_.lock();
+  std::unique_lock<std::mutex> lock(location_mutex_);
+  if (spt && spt->is_closing()) {
+    return;
+  }
+  auto previous = std::move(current_room_);
   current_room_ = std::move(room);
   x_ = x;
   y_ = y;
+  bool room_changed = previous != current_room_;
+  if (spt && room_changed) {
+    // Posted under the lock, so the owner shards see the moves in order.
+    spt->get_server().get_bus().move(spt, previous, current_room_);
+  }
+  lock.unlock();
+  if (spt) {
+    spt->location_changed(room_changed);
+  }
 }
 
-std::shared_ptr<world::Room> Player::get_room() const { return current_room_; }
+std::shared_ptr<world::Room> Player::get_room() const {
+  std::lock_guard<std::mutex> lock(location_mutex_);
+  return current_room_;
+}
 
-int Player::get_x() const { return x_; }
+int Player::get_x() const {
+  std::lock_guard<std::mutex> lock(location_mutex_);
+  return x_;
+}
 
-int Player::get_y() const { return y_; }
+int Player::get_y() const {
+  std::lock_guard<std::mutex> lock(location_mutex_);
+  return y_;
+}
+
+Player::Location Player::get_location() const {
+  std::lock_guard<std::mutex> lock(location_mutex_);
+  return {current_room_, x_, y_};
+}
 
 } // namespace mud
@@ -0,0 +1,125 @@
+#include "utils/metrics.hpp"
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+#if defined(MUD_COUNT_ALLOCATIONS)
+// Counting replacements for the global allocation functions. Debug and
+// benchmark builds only: every allocation pays one relaxed atomic add.
+void *operator new(std::size_t size) {
+    mud::utils::Metrics::instance().allocations.fetch_add(
+        1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return ::operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    mud::utils::Metrics::instance().allocations.fetch_add(
+        1, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept {
+    return ::operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+#endif
+
+namespace mud::utils {
+
+double Metrics::average_messages_per_write() const {
+    auto w = writes.load(std::memory_order_relaxed);
+    if (w == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(messages_written.load(std::memory_order_relaxed)) / w;
+}
+
+double Metrics::allocations_per_command() const {
+    auto c = commands.load(std::memory_order_relaxed);
+    if (c == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(allocations.load(std::memory_order_relaxed)) / c;
+}
+
+std::string Metrics::report() const {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    ss << "writes: " << writes.load(std::memory_order_relaxed)
+       << ", messages: " << messages_written.load(std::memory_order_relaxed)
+       << ", bytes: " << bytes_written.load(std::memory_order_relaxed)
+       << ", messages/write: " << average_messages_per_write()
+       << ", dropped: " << messages_dropped.load(std::memory_order_relaxed)
+       << ", collapsed: " << messages_collapsed.load(std::memory_order_relaxed)
+       << ", slow disconnects: "
+       << slow_consumer_disconnects.load(std::memory_order_relaxed);
+
+    ss << ", commands: " << commands.load(std::memory_order_relaxed)
+       << " (queued: " << commands_queued.load(std::memory_order_relaxed)
+       << ", deepest queue: "
+       << command_queue_peak.load(std::memory_order_relaxed)
+       << ", throttled: " << command_throttles.load(std::memory_order_relaxed)
+       << ", rejected: " << commands_rejected.load(std::memory_order_relaxed)
+       << ")";
+    if (allocations.load(std::memory_order_relaxed) > 0) {
+        ss << ", allocations: " << allocations.load(std::memory_order_relaxed)
+           << " (" << allocations_per_command() << "/command)";
+    }
+
+    auto files = files_relayed.load(std::memory_order_relaxed);
+    auto file_bytes = file_bytes_relayed.load(std::memory_order_relaxed);
+    if (file_bytes > 0) {
+        ss << ", files: " << files << " (" << file_bytes << " bytes relayed)";
+    }
+
+    auto in = compress_bytes_in.load(std::memory_order_relaxed);
+    auto out = compress_bytes_out.load(std::memory_order_relaxed);
+    if (out > 0) {
+        ss << ", mccp: " << in << " -> " << out << " bytes ("
+           << static_cast<double>(in) / out << "x, "
+           << compress_ns.load(std::memory_order_relaxed) / 1000000.0
+           << " ms)";
+    }
+
+    auto ticked = ticks.load(std::memory_order_relaxed);
+    if (ticked > 0) {
+        auto average_ms = [ticked](const std::atomic<std::uint64_t> &ns) {
+            return ns.load(std::memory_order_relaxed) / 1000000.0 / ticked;
+        };
+        ss << std::setprecision(3) << ", ticks: " << ticked << " (avg "
+           << average_ms(tick_ns) << " ms = commands "
+           << average_ms(tick_command_ns) << " + systems "
+           << average_ms(tick_system_ns) << " + flush "
+           << average_ms(tick_flush_ns) << ", max "
+           << tick_max_ns.load(std::memory_order_relaxed) / 1000000.0
+           << " ms, overruns: "
+           << tick_overruns.load(std::memory_order_relaxed) << ")";
+    }
+
+    auto pending = timers_pending.load(std::memory_order_relaxed);
+    auto fired = timers_fired.load(std::memory_order_relaxed);
+    if (pending > 0 || fired > 0) {
+        ss << ", timers: " << pending << " pending, " << fired << " fired";
+    }
+
+    auto reloaded = reloads.load(std::memory_order_relaxed);
+    auto failed = reload_failures.load(std::memory_order_relaxed);
+    if (reloaded > 0 || failed > 0) {
+        ss << ", reloads: " << reloaded << " (last "
+           << reload_last_ns.load(std::memory_order_relaxed) / 1000000.0
+           << " ms, failed: " << failed << ")";
+    }
+    return ss.str();
+}
+
+} // namespace mud::utils
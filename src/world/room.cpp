@@ -1,13 +1,13 @@
 #include "world/room.hpp"
-#include <utility>
 
 namespace mud {
 namespace world {
 
 Room::Room(const std::string &id, const std::string &name,
-           const std::string &description, int width, int height)
-    : id_(id), name_(name), description_(description), width_(width),
-      height_(height) {
+           const std::string &description, int width, int height,
+           const std::string &zone)
+    : id_(id), name_(name), description_(description), zone_(zone),
+      width_(width), height_(height) {
   tiles_.resize(height, std::vector<Tile>(width));
 }
 
@@ -17,6 +17,8 @@ const std::string &Room::get_name() const { return name_; }
 
 const std::string &Room::get_description() const { return description_; }
 
+const std::string &Room::get_zone() const { return zone_; }
+
 int Room::get_width() const { return width_; }
 
 int Room::get_height() const { return height_; }
@@ -30,16 +32,21 @@ const Tile &Room::get_tile(int x, int y) const {
   return empty_tile;
 }
 
-void Room::link(const std::string &direction, std::shared_ptr<Room> room) {
-  exits_[direction] = std::move(room);
+void Room::link(const std::string &direction, const std::string &room_id) {
+  exits_[direction] = room_id;
 }
 
-std::shared_ptr<Room> Room::get_exit(const std::string &direction) const {
+const std::string &Room::get_exit(const std::string &direction) const {
+  static const std::string none;
   auto it = exits_.find(direction);
   if (it != exits_.end()) {
     return it->second;
   }
-  return nullptr;
+  return none;
+}
+
+const std::map<std::string, std::string> &Room::get_exits() const {
+  return exits_;
 }
 
 void Room::add_object(int x, int y, const Object &object) {
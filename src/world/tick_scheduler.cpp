@@ -0,0 +1,196 @@
+#include "world/tick_scheduler.hpp"
+#include "network/session.hpp"
+#include "utils/metrics.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace mud {
+namespace world {
+
+namespace {
+thread_local bool in_tick_ = false;
+
+std::uint64_t nanoseconds(std::chrono::steady_clock::duration d) {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+} // namespace
+
+TickScheduler::TickScheduler(unsigned rate)
+    : period_(std::chrono::nanoseconds(std::chrono::seconds(1)) /
+              std::max(rate, 1u)),
+      timer_(io_context_), inbox_(inbox_capacity) {}
+
+void TickScheduler::run() {
+  deadline_ = std::chrono::steady_clock::now() + period_;
+  schedule();
+  io_context_.run();
+}
+
+void TickScheduler::stop() { io_context_.stop(); }
+
+bool TickScheduler::submit(std::shared_ptr<session> s,
+                           QueuedCommand &&command) {
+  submitted entry{std::move(s), std::move(command)};
+  if (inbox_.try_push(std::move(entry))) {
+    return true;
+  }
+  command = std::move(entry.command);
+  return false;
+}
+
+void TickScheduler::finish(std::shared_ptr<session> s,
+                           std::function<void()> done) {
+  // Runs on the tick thread before the next tick, which has everything s
+  // submitted in its inbox by then.
+  boost::asio::post(io_context_, [this, s = std::move(s),
+                                  done = std::move(done)]() mutable {
+    finishing_.push_back({std::move(s), std::move(done)});
+  });
+}
+
+void TickScheduler::add_system(std::string name,
+                               std::function<void(std::uint64_t)> system) {
+  systems_.push_back({std::move(name), std::move(system)});
+}
+
+bool TickScheduler::in_tick() { return in_tick_; }
+
+void TickScheduler::defer_flush(std::shared_ptr<session> s) {
+  dirty_.push_back(std::move(s));
+}
+
+std::chrono::nanoseconds TickScheduler::period() const { return period_; }
+
+void TickScheduler::schedule() {
+  timer_.expires_at(deadline_);
+  timer_.async_wait([this](const boost::system::error_code &ec) {
+    if (!ec) {
+      tick();
+    }
+  });
+}
+
+void TickScheduler::run_commands() {
+  std::size_t drained = inbox_.drain([this](submitted &&entry) {
+    auto &queue = entry.target->get_command_queue();
+    queue.push(std::move(entry.command));
+    if (!queue.active) {
+      queue.active = true;
+      active_.push_back(std::move(entry.target));
+    }
+  });
+  if (drained > 0) {
+    // Arrival order depends on the network; session ids don't.
+    std::sort(active_.begin(), active_.end(),
+              [](const std::shared_ptr<session> &a,
+                 const std::shared_ptr<session> &b) {
+                return a->id() < b->id();
+              });
+  }
+
+  QueuedCommand next;
+  finish_commands(next);
+
+  auto now = std::chrono::steady_clock::now();
+  bool ran = true;
+  while (ran) {
+    ran = false;
+    for (auto &s : active_) {
+      if (!s) {
+        continue;
+      }
+      auto &queue = s->get_command_queue();
+      if (s->is_closing()) {
+        // Includes a quit earlier in this tick.
+        queue.clear();
+        queue.active = false;
+        s.reset();
+        continue;
+      }
+      switch (queue.pop(now, next)) {
+      case CommandQueue::pop_result::ready:
+        s->run_command(*next.command, next.args);
+        ran = true;
+        break;
+      case CommandQueue::pop_result::throttled:
+        break;
+      case CommandQueue::pop_result::empty:
+        queue.active = false;
+        s.reset();
+        break;
+      }
+    }
+  }
+  active_.erase(std::remove(active_.begin(), active_.end(), nullptr),
+                active_.end());
+  // Whatever is left waits for its tokens.
+  utils::Metrics::instance().command_throttles.fetch_add(
+      active_.size(), std::memory_order_relaxed);
+}
+
+void TickScheduler::finish_commands(QueuedCommand &next) {
+  for (auto &f : finishing_) {
+    auto &queue = f.target->get_command_queue();
+    // Left active with an empty queue; the round-robin pass retires it.
+    while (!f.target->is_closing() && queue.pop_now(next)) {
+      f.target->run_command(*next.command, next.args);
+    }
+    queue.clear();
+    finished_.push_back(std::move(f.done));
+  }
+  finishing_.clear();
+}
+
+void TickScheduler::tick() {
+  using clock = std::chrono::steady_clock;
+  auto started = clock::now();
+  in_tick_ = true;
+  run_commands();
+  auto commands_done = clock::now();
+
+  for (auto &s : systems_) {
+    s.run(ticks_);
+  }
+  in_tick_ = false;
+  auto systems_done = clock::now();
+
+  for (auto &s : dirty_) {
+    s->flush_output();
+  }
+  dirty_.clear();
+  for (auto &done : finished_) {
+    done();
+  }
+  finished_.clear();
+  auto finished = clock::now();
+
+  ++ticks_;
+  auto &metrics = utils::Metrics::instance();
+  auto duration = nanoseconds(finished - started);
+  metrics.ticks.fetch_add(1, std::memory_order_relaxed);
+  metrics.tick_ns.fetch_add(duration, std::memory_order_relaxed);
+  metrics.tick_command_ns.fetch_add(nanoseconds(commands_done - started),
+                                    std::memory_order_relaxed);
+  metrics.tick_system_ns.fetch_add(nanoseconds(systems_done - commands_done),
+                                   std::memory_order_relaxed);
+  metrics.tick_flush_ns.fetch_add(nanoseconds(finished - systems_done),
+                                  std::memory_order_relaxed);
+  auto longest = metrics.tick_max_ns.load(std::memory_order_relaxed);
+  while (duration > longest &&
+         !metrics.tick_max_ns.compare_exchange_weak(
+             longest, duration, std::memory_order_relaxed)) {
+  }
+
+  // Fixed rate: a late tick doesn't shift the ones after it, and ticks
+  // missed while it ran are skipped rather than run back to back.
+  deadline_ += period_;
+  if (deadline_ <= finished) {
+    metrics.tick_overruns.fetch_add(1, std::memory_order_relaxed);
+    deadline_ += (finished - deadline_) / period_ * period_ + period_;
+  }
+  schedule();
+}
+
+} // namespace world
+} // namespace mud
@@ -0,0 +1,298 @@
+#include "world/timing_wheel.hpp"
+#include "utils/metrics.hpp"
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace mud {
+namespace world {
+
+struct TimingWheel::state {
+  static constexpr int level_bits = 6;
+  static constexpr std::uint32_t slots = 1u << level_bits;
+  static constexpr int levels = 4;
+  static constexpr std::uint64_t max_delay =
+      (std::uint64_t(1) << (level_bits * levels)) - 1;
+  static constexpr std::uint32_t nil =
+      std::numeric_limits<std::uint32_t>::max();
+  // Lists 0 .. levels * slots - 1 are the wheel slots, level by level;
+  // the last one holds the timers of the tick being fired.
+  static constexpr std::uint32_t firing = levels * slots;
+
+  struct node {
+    std::uint32_t prev = nil;
+    std::uint32_t next = nil;
+    // nil while the node is free.
+    std::uint32_t list = nil;
+    // Bumped on release, so old handles stop matching.
+    std::uint32_t generation = 0;
+    std::uint64_t expires = 0;
+    // In ticks; 0 for one-shot timers.
+    std::uint64_t interval = 0;
+    std::shared_ptr<const callback> fn;
+  };
+
+  explicit state(clock::duration res)
+      : resolution(std::max(res, clock::duration(1))), start(clock::now()) {
+    heads.fill(nil);
+    tails.fill(nil);
+  }
+
+  // First tick that starts at or after t.
+  std::uint64_t tick_at(clock::time_point t) const {
+    if (t <= start) {
+      return 0;
+    }
+    auto elapsed = t - start + resolution - clock::duration(1);
+    return static_cast<std::uint64_t>(elapsed / resolution);
+  }
+
+  std::uint32_t allocate() {
+    if (free_list == nil) {
+      nodes.emplace_back();
+      return static_cast<std::uint32_t>(nodes.size() - 1);
+    }
+    std::uint32_t i = free_list;
+    free_list = nodes[i].next;
+    return i;
+  }
+
+  void release(std::uint32_t i) {
+    auto &n = nodes[i];
+    n.list = nil;
+    ++n.generation;
+    n.fn.reset();
+    n.prev = nil;
+    n.next = free_list;
+    free_list = i;
+    --count;
+    utils::Metrics::instance().timers_pending.fetch_sub(
+        1, std::memory_order_relaxed);
+  }
+
+  void link(std::uint32_t i, std::uint32_t list) {
+    auto &n = nodes[i];
+    n.list = list;
+    n.next = nil;
+    n.prev = tails[list];
+    if (n.prev == nil) {
+      heads[list] = i;
+    } else {
+      nodes[n.prev].next = i;
+    }
+    tails[list] = i;
+  }
+
+  void unlink(std::uint32_t i) {
+    auto &n = nodes[i];
+    if (n.prev == nil) {
+      heads[n.list] = n.next;
+    } else {
+      nodes[n.prev].next = n.next;
+    }
+    if (n.next == nil) {
+      tails[n.list] = n.prev;
+    } else {
+      nodes[n.next].prev = n.prev;
+    }
+    n.prev = n.next = nil;
+  }
+
+  // Files i by how far its expiry is from next_tick. Beyond the top
+  // level's reach it goes in the farthest slot and is filed again from
+  // there.
+  void insert(std::uint32_t i) {
+    auto &n = nodes[i];
+    n.expires = std::max(n.expires, next_tick);
+    std::uint64_t delta = std::min(n.expires - next_tick, max_delay);
+    std::uint64_t at = next_tick + delta;
+    int level = 0;
+    while (level < levels - 1 &&
+           delta >= (std::uint64_t(1) << (level_bits * (level + 1)))) {
+      ++level;
+    }
+    link(i, level * slots +
+                static_cast<std::uint32_t>((at >> (level_bits * level)) &
+                                           (slots - 1)));
+  }
+
+  // Moves one slot of a higher level down to where its timers belong now.
+  void cascade(int level, std::uint32_t slot) {
+    std::uint32_t list = level * slots + slot;
+    std::uint32_t i = heads[list];
+    heads[list] = tails[list] = nil;
+    while (i != nil) {
+      std::uint32_t next = nodes[i].next;
+      nodes[i].prev = nodes[i].next = nil;
+      insert(i);
+      i = next;
+    }
+  }
+
+  // Moves the timers due at next_tick onto the firing list.
+  void expire() {
+    std::uint64_t t = next_tick;
+    auto index = static_cast<std::uint32_t>(t & (slots - 1));
+    for (int level = 1; index == 0 && level < levels; ++level) {
+      index = static_cast<std::uint32_t>((t >> (level_bits * level)) &
+                                         (slots - 1));
+      cascade(level, index);
+    }
+    std::uint32_t list = static_cast<std::uint32_t>(t & (slots - 1));
+    for (std::uint32_t i = heads[list]; i != nil; i = nodes[i].next) {
+      nodes[i].list = firing;
+    }
+    heads[firing] = heads[list];
+    tails[firing] = tails[list];
+    heads[list] = tails[list] = nil;
+    next_tick = t + 1;
+  }
+
+  mutable std::mutex mutex;
+  const clock::duration resolution;
+  const clock::time_point start;
+  // The next tick advance() will process.
+  std::uint64_t next_tick = 0;
+  std::size_t count = 0;
+  std::vector<node> nodes;
+  // Free nodes, chained through next.
+  std::uint32_t free_list = nil;
+  std::array<std::uint32_t, firing + 1> heads;
+  std::array<std::uint32_t, firing + 1> tails;
+};
+
+TimingWheel::TimingWheel(clock::duration resolution)
+    : state_(std::make_shared<state>(resolution)) {}
+
+TimingWheel::~TimingWheel() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  utils::Metrics::instance().timers_pending.fetch_sub(
+      state_->count, std::memory_order_relaxed);
+}
+
+TimerHandle TimingWheel::schedule(clock::duration delay, callback fn) {
+  return add(delay, clock::duration::zero(), std::move(fn));
+}
+
+TimerHandle TimingWheel::schedule_every(clock::duration interval,
+                                        callback fn) {
+  return add(interval, interval, std::move(fn));
+}
+
+TimerHandle TimingWheel::add(clock::duration delay, clock::duration interval,
+                             callback fn) {
+  // Built before taking the lock; this is the one allocation per timer
+  // once the node pool has grown.
+  auto shared_fn = std::make_shared<const callback>(std::move(fn));
+  auto now = clock::now();
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  std::uint32_t i = state_->allocate();
+  auto &n = state_->nodes[i];
+  n.expires = state_->tick_at(now + std::max(delay, clock::duration::zero()));
+  n.interval = 0;
+  if (interval > clock::duration::zero()) {
+    n.interval = std::max<std::uint64_t>(
+        1, static_cast<std::uint64_t>(
+               (interval + state_->resolution / 2) / state_->resolution));
+  }
+  n.fn = std::move(shared_fn);
+  state_->insert(i);
+  ++state_->count;
+  utils::Metrics::instance().timers_pending.fetch_add(
+      1, std::memory_order_relaxed);
+  return TimerHandle(state_, i, n.generation);
+}
+
+std::size_t TimingWheel::advance(clock::time_point now) {
+  auto &s = *state_;
+  std::size_t fired = 0;
+  std::unique_lock<std::mutex> lock(s.mutex);
+  std::uint64_t target = 0;
+  if (now > s.start) {
+    target = static_cast<std::uint64_t>((now - s.start) / s.resolution);
+  }
+  while (s.next_tick <= target) {
+    if (s.count == 0) {
+      // Nothing to cascade or fire on the way.
+      s.next_tick = target + 1;
+      break;
+    }
+    std::uint64_t t = s.next_tick;
+    s.expire();
+    // One at a time, so a callback can still cancel a timer due in the
+    // same tick.
+    while (s.heads[state::firing] != state::nil) {
+      std::uint32_t i = s.heads[state::firing];
+      s.unlink(i);
+      auto &n = s.nodes[i];
+      std::shared_ptr<const callback> fn;
+      if (n.interval > 0) {
+        // Re-armed first, so the callback can cancel it.
+        fn = n.fn;
+        n.expires = t + n.interval;
+        s.insert(i);
+      } else {
+        fn = std::move(n.fn);
+        s.release(i);
+      }
+      lock.unlock();
+      (*fn)();
+      ++fired;
+      lock.lock();
+    }
+  }
+  lock.unlock();
+  if (fired > 0) {
+    utils::Metrics::instance().timers_fired.fetch_add(
+        fired, std::memory_order_relaxed);
+  }
+  return fired;
+}
+
+std::size_t TimingWheel::size() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->count;
+}
+
+TimingWheel::clock::duration TimingWheel::resolution() const {
+  return state_->resolution;
+}
+
+TimerHandle::TimerHandle(std::weak_ptr<TimingWheel::state> state,
+                         std::uint32_t index, std::uint32_t generation)
+    : state_(std::move(state)), index_(index), generation_(generation) {}
+
+bool TimerHandle::cancel() {
+  auto s = state_.lock();
+  if (!s) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(s->mutex);
+  if (index_ >= s->nodes.size()) {
+    return false;
+  }
+  auto &n = s->nodes[index_];
+  if (n.generation != generation_ || n.list == TimingWheel::state::nil) {
+    return false;
+  }
+  s->unlink(index_);
+  s->release(index_);
+  return true;
+}
+
+bool TimerHandle::pending() const {
+  auto s = state_.lock();
+  if (!s) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(s->mutex);
+  return index_ < s->nodes.size() &&
+         s->nodes[index_].generation == generation_ &&
+         s->nodes[index_].list != TimingWheel::state::nil;
+}
+
+} // namespace world
+} // namespace mud
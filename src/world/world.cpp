@@ -2,7 +2,7 @@
 #include <nlohmann/json.hpp>
 #include <filesystem>
 #include <fstream>
-#include <iostream>
+#include <stdexcept>
 #include <utility>
 
 namespace mud {
@@ -11,14 +11,18 @@ namespace world {
 using json = nlohmann::json;
 
 World::World(const std::string &maps_directory) {
-  load_world_from_files(maps_directory);
+  auto initial = load(maps_directory);
+  rooms_ = std::move(initial.rooms);
+  sources_ = std::move(initial.sources);
 }
 
 void World::add_room(const std::string &id, std::shared_ptr<Room> room) {
+  std::lock_guard<std::mutex> lock(mutex_);
   rooms_[id] = std::move(room);
 }
 
 std::shared_ptr<Room> World::get_room(const std::string &id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
   auto it = rooms_.find(id);
   if (it != rooms_.end()) {
     return it->second;
@@ -26,69 +30,96 @@ std::shared_ptr<Room> World::get_room(const std::string &id) const {
   return nullptr;
 }
 
-void World::load_world_from_files(const std::string &maps_directory) {
+World::Snapshot World::load(const std::string &maps_directory) {
+  Snapshot snapshot;
   std::map<std::string, json> map_data;
+  std::map<std::string, std::string> files;
 
   // 1. Read all json files and create Room objects
   for (const auto &entry :
        std::filesystem::directory_iterator(maps_directory)) {
-    if (entry.path().extension() == ".json") {
-      std::ifstream f(entry.path());
-      json data = json::parse(f);
-
-      std::string id = data["id"];
-      map_data[id] = data;
+    if (entry.path().extension() != ".json") {
+      continue;
+    }
+    const std::string file = entry.path().filename().string();
+    std::ifstream f(entry.path());
+    json data = json::parse(f);
 
-      auto room = std::make_shared<Room>(
-          id, data["name"], data["description"],
-          data["size"]["width"], data["size"]["height"]);
+    std::string id = data["id"];
+    if (!files.emplace(id, file).second) {
+      throw std::runtime_error(file + ": room " + id + " is also defined in " +
+                               files[id]);
+    }
+    int width = data["size"]["width"];
+    int height = data["size"]["height"];
+    if (width <= 0 || height <= 0) {
+      throw std::runtime_error(file + ": room " + id + " has no tiles");
+    }
 
-    //   for (const auto &obj_data : data["objects"]) {
-    //     Object obj{obj_data["type"], obj_data["name"],
-    //                obj_data["description"], obj_data["is_interactable"]};
-    //     room->add_object(obj_data["x"], obj_data["y"], obj);
-    //   }
+    auto room = std::make_shared<Room>(id, data["name"], data["description"],
+                                       width, height,
+                                       data.value("zone", std::string()));
     for (const auto &obj_data : data["objects"]) {
-Object obj{
-    obj_data["type"].get<std::string>(),
-    obj_data["name"].get<std::string>(),
-    obj_data["is_interactable"].get<bool>(),
-    obj_data["description"].get<std::string>()
-};
-  room->add_object(obj_data["x"], obj_data["y"], obj);
-}
-
-
-      for (const auto &portal_data : data["portals"]) {
-        Portal portal{portal_data["x"].get<int>(),
-                      portal_data["y"].get<int>(),
-                      portal_data["target_map"].get<std::string>(),
-                      portal_data["target_x"].get<int>(),
-                      portal_data["target_y"].get<int>(),
-                      portal_data["description"].get<std::string>()};
-        room->add_portal(portal);
-      }
-      add_room(id, room);
+      Object obj{obj_data["type"].get<std::string>(),
+                 obj_data["name"].get<std::string>(),
+                 obj_data["is_interactable"].get<bool>(),
+                 obj_data["description"].get<std::string>()};
+      room->add_object(obj_data["x"], obj_data["y"], obj);
     }
+    for (const auto &portal_data : data["portals"]) {
+      Portal portal{portal_data["x"].get<int>(),
+                    portal_data["y"].get<int>(),
+                    portal_data["target_map"].get<std::string>(),
+                    portal_data["target_x"].get<int>(),
+                    portal_data["target_y"].get<int>(),
+                    portal_data["description"].get<std::string>()};
+      room->add_portal(portal);
+    }
+    snapshot.sources[id] = data.dump();
+    snapshot.rooms[id] = room;
+    map_data[id] = std::move(data);
   }
 
-  // 2. Link rooms using exit data
-  for (const auto &pair : map_data) {
-    const std::string &current_room_id = pair.first;
-    const json &data = pair.second;
-    auto current_room = get_room(current_room_id);
-
-    if (current_room && data.contains("exits")) {
+  // 2. Link rooms using exit data, and check that every exit and portal
+  // leads somewhere.
+  for (const auto &[id, data] : map_data) {
+    auto &room = snapshot.rooms[id];
+    if (data.contains("exits")) {
       for (auto it = data["exits"].begin(); it != data["exits"].end(); ++it) {
-        std::string direction = it.key();
         std::string target_room_id = it.value();
-        auto target_room = get_room(target_room_id);
-        if (target_room) {
-          current_room->link(direction, target_room);
+        if (!snapshot.rooms.count(target_room_id)) {
+          throw std::runtime_error(files[id] + ": exit " + it.key() +
+                                   " leads to unknown room " +
+                                   target_room_id);
         }
+        room->link(it.key(), target_room_id);
+      }
+    }
+    for (const auto &portal_data : data.value("portals", json::array())) {
+      std::string target = portal_data["target_map"];
+      if (!snapshot.rooms.count(target)) {
+        throw std::runtime_error(files[id] + ": portal leads to unknown room " +
+                                 target);
       }
     }
   }
+  return snapshot;
+}
+
+std::vector<std::string> World::replace(Snapshot next) {
+  std::vector<std::string> changed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &[id, source] : sources_) {
+    auto it = next.sources.find(id);
+    if (it == next.sources.end() || it->second != source) {
+      changed.push_back(id);
+    } else {
+      next.rooms[id] = rooms_[id];
+    }
+  }
+  rooms_ = std::move(next.rooms);
+  sources_ = std::move(next.sources);
+  return changed;
 }
 
 } // namespace world
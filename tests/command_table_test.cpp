@@ -0,0 +1,147 @@
+#include "commands/command_table.hpp"
+#include <gtest/gtest.h>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using mud::AliasMatch;
+using mud::Command;
+using mud::CommandTable;
+
+using alias_list = std::vector<std::pair<std::string, std::size_t>>;
+
+Command command(std::string name, std::uint16_t id = 0,
+                bool abbreviate = true) {
+  Command c;
+  c.name = std::move(name);
+  c.id = id;
+  c.abbreviate = abbreviate;
+  return c;
+}
+
+// The commands.json shape: English and Korean aliases, several commands
+// sharing first letters, and QUIT kept out of abbreviation.
+CommandTable sample_table() {
+  std::vector<Command> commands = {
+      command("SOUTH", 1),   command("SHOUT", 2),
+      command("STATS", 3),   command("WHISPER", 4),
+      command("WHO", 5),     command("QUIT", 8, false),
+  };
+  alias_list aliases = {
+      {"s", 0},      {"south", 0},   {"남", 0},     {"shout", 1},
+      {"외치기", 1}, {"stats", 2},   {"whis", 3},   {"whisper", 3},
+      {"귓속말", 3}, {"who", 4},     {"quit", 5},   {"exit", 5},
+  };
+  return CommandTable(std::move(commands), aliases);
+}
+
+// Enough aliases that building the perfect hash has to search for
+// displacements and, for some sizes, grow the slot array.
+TEST(CommandTableTest, FindsEveryAliasOfLargeTables) {
+  for (std::size_t count : {1u, 2u, 3u, 17u, 100u, 1000u, 5000u}) {
+    std::vector<Command> commands;
+    alias_list aliases;
+    for (std::size_t i = 0; i < count; ++i) {
+      commands.push_back(command("C" + std::to_string(i)));
+      aliases.emplace_back("alias" + std::to_string(i), i);
+      aliases.emplace_back("별칭" + std::to_string(i), i);
+    }
+    CommandTable table(std::move(commands), aliases);
+    for (const auto &[alias, index] : aliases) {
+      const auto *found = table.find(alias);
+      ASSERT_NE(found, nullptr) << alias << " in " << count;
+      EXPECT_EQ(found->name, "C" + std::to_string(index));
+    }
+    EXPECT_EQ(table.find("alias"), nullptr);
+    EXPECT_EQ(table.find("alias" + std::to_string(count)), nullptr);
+    EXPECT_EQ(table.find("alias0 "), nullptr);
+    EXPECT_EQ(table.find(""), nullptr);
+  }
+}
+
+TEST(CommandTableTest, EmptyTableFindsNothing) {
+  CommandTable table;
+  EXPECT_EQ(table.find("look"), nullptr);
+  EXPECT_EQ(table.find(std::uint16_t(1)), nullptr);
+  EXPECT_EQ(table.match("l").result, AliasMatch::kind::none);
+
+  CommandTable no_aliases({command("LOOK", 1)}, {});
+  EXPECT_EQ(no_aliases.find("look"), nullptr);
+  ASSERT_NE(no_aliases.find(std::uint16_t(1)), nullptr);
+}
+
+TEST(CommandTableTest, FindsCommandsById) {
+  auto table = sample_table();
+  ASSERT_NE(table.find(std::uint16_t(4)), nullptr);
+  EXPECT_EQ(table.find(std::uint16_t(4))->name, "WHISPER");
+  EXPECT_EQ(table.find(std::uint16_t(0)), nullptr);
+  EXPECT_EQ(table.find(std::uint16_t(6)), nullptr);
+  EXPECT_EQ(table.find(std::uint16_t(9)), nullptr);
+}
+
+TEST(CommandTableTest, ExactAliasesWinOverAbbreviations) {
+  auto table = sample_table();
+  auto match = table.match("s");
+  EXPECT_EQ(match.result, AliasMatch::kind::exact);
+  ASSERT_NE(match.command, nullptr);
+  EXPECT_EQ(match.command->name, "SOUTH");
+
+  match = table.match("whis");
+  EXPECT_EQ(match.result, AliasMatch::kind::exact);
+  EXPECT_EQ(match.command->name, "WHISPER");
+}
+
+TEST(CommandTableTest, MatchesUniqueAbbreviations) {
+  auto table = sample_table();
+  auto match = table.match("sh");
+  EXPECT_EQ(match.result, AliasMatch::kind::prefix);
+  ASSERT_NE(match.command, nullptr);
+  EXPECT_EQ(match.command->name, "SHOUT");
+
+  // Both WHISPER aliases start with it, so it is still unique.
+  match = table.match("whi");
+  EXPECT_EQ(match.result, AliasMatch::kind::prefix);
+  EXPECT_EQ(match.command->name, "WHISPER");
+
+  match = table.match("귓속");
+  EXPECT_EQ(match.result, AliasMatch::kind::prefix);
+  EXPECT_EQ(match.command->name, "WHISPER");
+}
+
+TEST(CommandTableTest, ReportsAmbiguousAndUnknownWords) {
+  auto table = sample_table();
+  EXPECT_EQ(table.match("wh").result, AliasMatch::kind::ambiguous);
+  EXPECT_EQ(table.match("wh").command, nullptr);
+  EXPECT_EQ(table.completions("wh"),
+            (std::vector<std::string>{"whis", "whisper", "who"}));
+
+  EXPECT_EQ(table.match("zz").result, AliasMatch::kind::none);
+  EXPECT_EQ(table.match("shouts").result, AliasMatch::kind::none);
+  EXPECT_EQ(table.match("").result, AliasMatch::kind::none);
+}
+
+TEST(CommandTableTest, PartialCharactersMatchNothing) {
+  auto table = sample_table();
+  // The first two bytes of 귓 (EA B7 93).
+  EXPECT_EQ(table.match("\xea\xb7").result, AliasMatch::kind::none);
+  // The first byte of 외 (EC 99 B8).
+  EXPECT_EQ(table.match("\xec").result, AliasMatch::kind::none);
+}
+
+TEST(CommandTableTest, CommandsThatMayNotBeAbbreviatedNeedTheirFullAlias) {
+  auto table = sample_table();
+  EXPECT_EQ(table.match("qu").result, AliasMatch::kind::none);
+  EXPECT_EQ(table.match("ex").result, AliasMatch::kind::none);
+  EXPECT_TRUE(table.completions("qu").empty());
+
+  auto match = table.match("quit");
+  EXPECT_EQ(match.result, AliasMatch::kind::exact);
+  ASSERT_NE(match.command, nullptr);
+  EXPECT_EQ(match.command->name, "QUIT");
+  EXPECT_EQ(table.match("exit").command, match.command);
+}
+
+} // namespace
@@ -0,0 +1,101 @@
+#include "utils/mpsc_queue.hpp"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using mud::utils::MpscQueue;
+
+TEST(MpscQueueTest, RoundsCapacityUpToAPowerOfTwo) {
+  EXPECT_EQ(MpscQueue<int>(1).capacity(), 2u);
+  EXPECT_EQ(MpscQueue<int>(5).capacity(), 8u);
+  EXPECT_EQ(MpscQueue<int>(64).capacity(), 64u);
+}
+
+TEST(MpscQueueTest, RejectsPushesWhenFullAndKeepsTheValue) {
+  MpscQueue<std::vector<int>> queue(4);
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(queue.try_push({i}));
+  }
+  std::vector<int> extra{99};
+  EXPECT_FALSE(queue.try_push(std::move(extra)));
+  EXPECT_EQ(extra, std::vector<int>{99});
+
+  std::vector<int> drained;
+  EXPECT_EQ(queue.drain([&](std::vector<int> &&v) { drained.push_back(v[0]); }),
+            4u);
+  EXPECT_EQ(drained, (std::vector<int>{0, 1, 2, 3}));
+  EXPECT_TRUE(queue.try_push(std::move(extra)));
+}
+
+TEST(MpscQueueTest, DrainStopsAtMax) {
+  MpscQueue<int> queue(8);
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_TRUE(queue.try_push(int(i)));
+  }
+  std::vector<int> drained;
+  auto collect = [&](int &&v) { drained.push_back(v); };
+  EXPECT_EQ(queue.drain(collect, 2), 2u);
+  EXPECT_EQ(queue.drain(collect), 3u);
+  EXPECT_EQ(queue.drain(collect), 0u);
+  EXPECT_EQ(drained, (std::vector<int>{0, 1, 2, 3, 4}));
+}
+
+// Producers wrap round a small ring many times while the consumer drains
+// concurrently. Every item must arrive exactly once, and each producer's
+// items in the order it pushed them.
+TEST(MpscQueueTest, ManyProducersLoseNothing) {
+  constexpr int producers = 8;
+  constexpr std::uint32_t per_producer = 100000;
+  MpscQueue<std::uint64_t> queue(64);
+
+  std::atomic<bool> go{false};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&, p] {
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      for (std::uint32_t i = 0; i < per_producer; ++i) {
+        std::uint64_t value = (std::uint64_t(p) << 32) | i;
+        while (!queue.try_push(std::uint64_t(value))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<std::uint32_t> next(producers, 0);
+  std::uint64_t received = 0;
+  bool in_order = true;
+  go.store(true, std::memory_order_release);
+  while (received < std::uint64_t(producers) * per_producer) {
+    auto drained = queue.drain([&](std::uint64_t &&value) {
+      auto p = static_cast<std::size_t>(value >> 32);
+      auto i = static_cast<std::uint32_t>(value);
+      if (p >= next.size() || next[p] != i) {
+        in_order = false;
+      } else {
+        ++next[p];
+      }
+    });
+    if (drained == 0) {
+      std::this_thread::yield();
+    }
+    received += drained;
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  EXPECT_TRUE(in_order);
+  for (int p = 0; p < producers; ++p) {
+    EXPECT_EQ(next[p], per_producer) << "producer " << p;
+  }
+  EXPECT_EQ(queue.drain([](std::uint64_t &&) {}), 0u);
+}
+
+} // namespace
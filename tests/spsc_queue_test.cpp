@@ -0,0 +1,117 @@
+#include "utils/spsc_queue.hpp"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using mud::utils::SpscQueue;
+using push_result = SpscQueue<int>::push_result;
+
+TEST(SpscQueueTest, OnlyTheFirstPushAfterSleepWakes) {
+  SpscQueue<int> queue(8);
+  // Starts asleep.
+  EXPECT_EQ(queue.try_push(1), push_result::wake);
+  EXPECT_EQ(queue.try_push(2), push_result::queued);
+
+  std::vector<int> drained;
+  auto collect = [&](int &&v) { drained.push_back(v); };
+  EXPECT_EQ(queue.drain(collect), 2u);
+  EXPECT_TRUE(queue.sleep());
+  EXPECT_EQ(queue.try_push(3), push_result::wake);
+  EXPECT_EQ(queue.try_push(4), push_result::queued);
+  EXPECT_EQ(queue.drain(collect), 2u);
+  EXPECT_EQ(drained, (std::vector<int>{1, 2, 3, 4}));
+}
+
+TEST(SpscQueueTest, SleepFailsIfItemsArrivedAfterTheDrain) {
+  SpscQueue<int> queue(8);
+  EXPECT_EQ(queue.try_push(1), push_result::wake);
+  EXPECT_EQ(queue.drain([](int &&) {}), 1u);
+  // Still awake, so this push doesn't wake anyone...
+  EXPECT_EQ(queue.try_push(2), push_result::queued);
+  // ...and the consumer must not go to sleep on it.
+  EXPECT_FALSE(queue.sleep());
+  EXPECT_EQ(queue.drain([](int &&) {}), 1u);
+  EXPECT_TRUE(queue.sleep());
+}
+
+TEST(SpscQueueTest, FullLeavesTheValueAlone) {
+  SpscQueue<std::vector<int>> queue(2);
+  ASSERT_NE(queue.try_push({1}), SpscQueue<std::vector<int>>::push_result::full);
+  ASSERT_NE(queue.try_push({2}), SpscQueue<std::vector<int>>::push_result::full);
+  std::vector<int> extra{3};
+  EXPECT_EQ(queue.try_push(std::move(extra)),
+            SpscQueue<std::vector<int>>::push_result::full);
+  EXPECT_EQ(extra, std::vector<int>{3});
+}
+
+// The consumer drains and sleeps until woken, the way a session's strand
+// handles the tick's outbox; the producer wakes it only when try_push says
+// so. A lost wake-up leaves items queued with the consumer asleep, and the
+// wait below times out.
+TEST(SpscQueueTest, NoWakeUpIsLost) {
+  constexpr std::uint32_t items = 200000;
+  SpscQueue<std::uint32_t> queue(16);
+
+  std::mutex mutex;
+  std::condition_variable woken;
+  std::uint64_t wakes_sent = 0;
+  std::uint64_t wakes_seen = 0;
+  auto wake = [&] {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++wakes_sent;
+    woken.notify_one();
+  };
+
+  std::thread producer([&] {
+    for (std::uint32_t i = 0; i < items; ++i) {
+      std::uint32_t value = i;
+      for (;;) {
+        auto result = queue.try_push(std::move(value));
+        if (result == SpscQueue<std::uint32_t>::push_result::full) {
+          std::this_thread::yield();
+          continue;
+        }
+        if (result == SpscQueue<std::uint32_t>::push_result::wake) {
+          wake();
+        }
+        break;
+      }
+    }
+  });
+
+  std::uint32_t expected = 0;
+  bool in_order = true;
+  bool stalled = false;
+  while (expected < items) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (!woken.wait_for(lock, std::chrono::seconds(5),
+                          [&] { return wakes_sent > wakes_seen; })) {
+        stalled = true;
+        break;
+      }
+      ++wakes_seen;
+    }
+    do {
+      queue.drain([&](std::uint32_t &&value) {
+        in_order = in_order && value == expected;
+        ++expected;
+      });
+    } while (!queue.sleep());
+  }
+  producer.join();
+
+  EXPECT_FALSE(stalled) << "asleep with " << items - expected
+                        << " items left";
+  EXPECT_TRUE(in_order);
+  EXPECT_EQ(expected, items);
+}
+
+} // namespace
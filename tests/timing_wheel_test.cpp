@@ -0,0 +1,168 @@
+#include "world/timing_wheel.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace {
+
+using mud::world::TimerHandle;
+using mud::world::TimingWheel;
+using namespace std::chrono_literals;
+
+// The wheel counts ticks from its construction and schedules from
+// clock::now(), so ticks are made long enough that the test's own running
+// time never moves a timer to the next one. A delay half a tick short of
+// n ticks then lands exactly on tick n.
+constexpr TimingWheel::clock::duration resolution = 1s;
+
+TimingWheel::clock::duration ticks(std::uint64_t n) {
+  return resolution * n - resolution / 2;
+}
+
+class TimingWheelTest : public ::testing::Test {
+protected:
+  TimingWheelTest() : wheel(resolution), start(TimingWheel::clock::now()) {}
+
+  // Advances one tick at a time up to and including tick last.
+  void advance_to(std::uint64_t last) {
+    for (; now <= last; ++now) {
+      wheel.advance(start + resolution * now);
+    }
+  }
+
+  TimingWheel wheel;
+  TimingWheel::clock::time_point start;
+  std::uint64_t now = 1;
+};
+
+// Delays either side of every level boundary, so each timer is filed on a
+// higher level and cascades down before it fires.
+const std::vector<std::uint64_t> boundary_delays = {
+    1,      2,      63,     64,     65,       127,           128,
+    4095,   4096,   4097,   4160,   262143,   262144,        262145,
+    266240, 1 << 20, (1 << 20) + 1};
+
+TEST_F(TimingWheelTest, FiresOnTheTickAcrossLevelBoundaries) {
+  std::map<std::uint64_t, std::uint64_t> fired_at;
+  for (auto delay : boundary_delays) {
+    wheel.schedule(ticks(delay), [this, &fired_at, delay] {
+      fired_at[delay] = now;
+    });
+  }
+  EXPECT_EQ(wheel.size(), boundary_delays.size());
+
+  advance_to(boundary_delays.back() + 1);
+
+  EXPECT_EQ(wheel.size(), 0u);
+  for (auto delay : boundary_delays) {
+    ASSERT_TRUE(fired_at.count(delay)) << "delay " << delay;
+    EXPECT_EQ(fired_at[delay], delay) << "delay " << delay;
+  }
+}
+
+TEST_F(TimingWheelTest, OneLargeAdvanceFiresEverythingDue) {
+  int fired = 0;
+  for (auto delay : boundary_delays) {
+    wheel.schedule(ticks(delay), [&fired] { ++fired; });
+  }
+  auto due = static_cast<std::size_t>(
+      std::count_if(boundary_delays.begin(), boundary_delays.end(),
+                    [](std::uint64_t delay) { return delay <= 4096; }));
+  EXPECT_EQ(wheel.advance(start + resolution * 4096), due);
+  EXPECT_EQ(fired, static_cast<int>(due));
+  EXPECT_EQ(wheel.advance(start + resolution * (1u << 21)),
+            boundary_delays.size() - due);
+  EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST_F(TimingWheelTest, NothingFiresEarly) {
+  bool fired = false;
+  wheel.schedule(ticks(4096), [&fired] { fired = true; });
+  wheel.advance(start + resolution * 4095);
+  EXPECT_FALSE(fired);
+  wheel.advance(start + resolution * 4096);
+  EXPECT_TRUE(fired);
+}
+
+// Past 2^24 ticks a timer parks in the top level's farthest slot and is
+// filed again from there.
+TEST_F(TimingWheelTest, DelaysBeyondTheTopLevelGoRoundAgain) {
+  constexpr std::uint64_t delay = (std::uint64_t(1) << 24) + 100;
+  bool fired = false;
+  wheel.schedule(ticks(delay), [&fired] { fired = true; });
+  wheel.advance(start + resolution * (delay - 1));
+  EXPECT_FALSE(fired);
+  EXPECT_EQ(wheel.size(), 1u);
+  wheel.advance(start + resolution * delay);
+  EXPECT_TRUE(fired);
+}
+
+TEST_F(TimingWheelTest, RecurringTimersKeepTheirPeriodThroughCascades) {
+  std::vector<std::uint64_t> fired_at;
+  auto handle = wheel.schedule_every(
+      ticks(64), [this, &fired_at] { fired_at.push_back(now); });
+  advance_to(64 * 70);
+  ASSERT_EQ(fired_at.size(), 70u);
+  for (std::size_t i = 0; i < fired_at.size(); ++i) {
+    EXPECT_EQ(fired_at[i], 64 * (i + 1));
+  }
+  EXPECT_TRUE(handle.pending());
+  EXPECT_TRUE(handle.cancel());
+  EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST_F(TimingWheelTest, CancelledTimersNeverFire) {
+  bool near_fired = false;
+  bool far_fired = false;
+  auto near = wheel.schedule(ticks(10), [&near_fired] { near_fired = true; });
+  auto far = wheel.schedule(ticks(5000), [&far_fired] { far_fired = true; });
+  // Cancelled after it has cascaded down from level 2.
+  advance_to(4100);
+  EXPECT_TRUE(near_fired);
+  EXPECT_FALSE(near.pending());
+  EXPECT_FALSE(near.cancel());
+  EXPECT_TRUE(far.pending());
+  EXPECT_TRUE(far.cancel());
+  EXPECT_FALSE(far.cancel());
+  advance_to(6000);
+  EXPECT_FALSE(far_fired);
+  EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST_F(TimingWheelTest, CallbacksMayCancelTimersDueInTheSameTick) {
+  TimerHandle second;
+  bool second_fired = false;
+  wheel.schedule(ticks(100), [&second] { second.cancel(); });
+  second = wheel.schedule(ticks(100), [&second_fired] { second_fired = true; });
+  advance_to(100);
+  EXPECT_FALSE(second_fired);
+}
+
+TEST_F(TimingWheelTest, RecurringCallbacksMayCancelThemselves) {
+  int fired = 0;
+  TimerHandle handle;
+  handle = wheel.schedule_every(ticks(3), [&] {
+    if (++fired == 4) {
+      handle.cancel();
+    }
+  });
+  advance_to(30);
+  EXPECT_EQ(fired, 4);
+  EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST(TimerHandleTest, OutlivesItsWheel) {
+  TimerHandle handle;
+  {
+    TimingWheel wheel(resolution);
+    handle = wheel.schedule(ticks(10), [] {});
+    EXPECT_TRUE(handle.pending());
+  }
+  EXPECT_FALSE(handle.pending());
+  EXPECT_FALSE(handle.cancel());
+}
+
+} // namespace